@@ -0,0 +1,261 @@
+#!/bin/bash
+#
+#  File           : fs3_bench.sh
+#  Description    : This is the benchmark driver for the FS3 client. It runs
+#                   workloads under a matrix of cache sizes and builds,
+#                   collects the JSON results each client run writes (-j)
+#                   into one results file, and in compare mode flags the
+#                   runs of two results files that got worse.
+#
+#  Author         :
+#  Last Modified  :
+#
+
+USAGE="USAGE: fs3_bench.sh [-o <results>] [-w <workloads>] [-c <cache sizes>] [-b <builds>] [-a <client args>] [-S <server>] [-p <port>]
+       fs3_bench.sh -C <old results> <new results> [-t <percent>]
+
+where:
+    -o - file the results go to (fs3_bench_results.json by default)
+    -w - workloads to run, small, medium and jumbo stand for assign4-<name>-workload.txt,
+         anything else is a workload file (\"small medium jumbo\" by default)
+    -c - cache sizes to run every workload with, in sectors (\"2048\" by default)
+    -b - builds to run every workload with, <name>=<extra CFLAGS> (\"default=\" runs the
+         binaries as they are, anything else rebuilds them, e.g. \"O0=-O0 O3=-O3,-march=native\",
+         commas stand for spaces)
+    -a - more options for every client run (e.g. \"-w 64 -r\")
+    -S - server to run against, started fresh for every run (./fs3_local_server by default,
+         \"none\" runs the controller inside the client)
+    -p - port the server listens on (22887 by default)
+    -C - compare two results files, list what got worse or better, fail if anything got worse
+    -t - change in percent that counts as worse or better when comparing (10 by default)
+"
+
+# Defaults
+RESULTS=fs3_bench_results.json
+WORKLOADS="small medium jumbo"
+CACHES="2048"
+BUILDS="default="
+CLIENTARGS=""
+SERVER=./fs3_local_server
+PORT=22887
+COMPARE=0
+THRESHOLD=10
+
+#
+# Functions
+
+# Compare two results files run by run, metric by metric. Every metric has a
+# direction (higher or lower is better), and a change larger than the
+# threshold is listed; latencies and times also need to move by more than
+# their noise floor, and percentiles of calls made fewer than 100 times are
+# left out. Exit status 1 if anything got worse.
+compare_results() {
+	awk -v threshold="$THRESHOLD" '
+	# higher is better (1), lower is better (-1), not compared (0)
+	function direction(key) {
+		if (key ~ /^(calls_per_s|throughput_mb_s|cache\.hit_ratio)$/) return 1
+		if (key ~ /^(elapsed_s|workload_s|round_trips|peak_rss_kb|cache\.misses)$/) return -1
+		if (key ~ /^latency_us\.[a-z0-9_]+\.p(50|90|99)$/ || key ~ /^requests\./) return -1
+		return 0
+	}
+	# changes smaller than this are noise
+	function floor(key) {
+		if (key ~ /^latency_us\./) return 1.0
+		if (key ~ /_s$/) return 0.01
+		if (key == "peak_rss_kb") return 1024
+		return 0
+	}
+	# flattens the lines of a run ("key": value) to dotted keys
+	{
+		line = $0
+		gsub(/^[ \t]+|[ \t,]+$/, "", line)
+		if (line ~ /^"runs": \[/) { inruns = 1; next }
+		if (!inruns) next
+		if (line == "{") { depth = 0; run = ""; next }
+		if (line == "}" || line == "]") { if (depth > 0) depth--; next }
+		if (match(line, /^"[^"]+": \{$/)) {
+			stack[++depth] = substr(line, 2, index(substr(line, 2), "\"") - 1)
+			next
+		}
+		if (!match(line, /^"[^"]+": /)) next
+		key = substr(line, 2, RLENGTH - 4)
+		value = substr(line, RLENGTH + 1)
+		if (key == "name" && depth == 0) {
+			run = value
+			gsub(/"/, "", run)
+			if (FNR == NR) oldruns[run] = 1
+			else newruns[run] = 1
+			next
+		}
+		if (value !~ /^-?[0-9.]+([eE][-+]?[0-9]+)?$/ || run == "") next
+		for (i = depth; i >= 1; i--) key = stack[i] "." key
+		sub(/^result\./, "", key)
+		if (FNR == NR) old[run, key] = value
+		else {
+			cur[run, key] = value
+			order[++keys] = run SUBSEP key
+		}
+	}
+	END {
+		for (k = 1; k <= keys; k++) {
+			split(order[k], part, SUBSEP)
+			run = part[1]; key = part[2]
+			if (!((run, key) in old) || (dir = direction(key)) == 0) continue
+			calls = key
+			sub(/\.p[0-9]+$/, ".calls", calls)
+			if (calls != key && (cur[run, calls] < 100 || old[run, calls] < 100)) continue
+			was = old[run, key] + 0; now = cur[run, key] + 0
+			if (was == 0 || (now - was < floor(key) && was - now < floor(key))) continue
+			change = (now - was) * 100.0 / was
+			if (change * dir <= -threshold) {
+				printf("WORSE    %-32s %-28s %14.3f -> %14.3f (%+.1f%%)\n", run, key, was, now, change)
+				worse++
+			} else if (change * dir >= threshold) {
+				printf("better   %-32s %-28s %14.3f -> %14.3f (%+.1f%%)\n", run, key, was, now, change)
+				better++
+			}
+		}
+		for (run in oldruns) if (!(run in newruns)) printf("missing  %s (only in the old results)\n", run)
+		for (run in newruns) {
+			runs++
+			if (!(run in oldruns)) printf("new      %s (only in the new results)\n", run)
+		}
+		printf("%d metrics worse, %d better by %s%% or more over %d runs\n", worse, better, threshold, runs)
+		exit(worse > 0)
+	}' "$1" "$2"
+}
+
+# Build the client and servers with these extra CFLAGS
+build() {
+	make clean > /dev/null && make CFLAGS="-I. -c -g -Wall $1" LINKARGS="-g $1" > "$LOGS/build.log" 2>&1 || {
+		tail -20 "$LOGS/build.log" >&2
+		echo "fs3_bench: the build with [$1] failed" >&2
+		exit 1
+	}
+}
+
+# Run one workload against a fresh server and append its results as run $1
+run() {
+	local name=$1 workload=$2 cache=$3 build=$4 flags=$5 pid="" status
+
+	if [ "$SERVER" != "none" ]; then
+		$SERVER -p $PORT > "$LOGS/server.log" 2>&1 &
+		pid=$!
+		sleep 0.5
+		./fs3_client -p $PORT -c $cache -j "$LOGS/run.json" $CLIENTARGS "$workload" > "$LOGS/client.log" 2>&1
+	else
+		./fs3_client -e "" -c $cache -j "$LOGS/run.json" $CLIENTARGS "$workload" > "$LOGS/client.log" 2>&1
+	fi
+	status=$?
+	if [ -n "$pid" ]; then
+		kill $pid 2> /dev/null
+		wait $pid 2> /dev/null
+	fi
+	if [ $status -ne 0 ] || ! grep -q "all tests successful" "$LOGS/client.log" || [ ! -s "$LOGS/run.json" ]; then
+		tail -20 "$LOGS/client.log" >&2
+		echo "fs3_bench: run $name failed, its log is $LOGS/client.log" >&2
+		exit 1
+	fi
+
+	[ $RUNS -gt 0 ] && echo "    }," >> "$RESULTS.tmp"
+	{
+		echo "    {"
+		echo "      \"name\": \"$name\","
+		echo "      \"workload\": \"$workload\","
+		echo "      \"cache\": $cache,"
+		echo "      \"build\": \"$build\","
+		echo "      \"cflags\": \"$flags\","
+		echo "      \"client_args\": \"$CLIENTARGS\","
+		echo -n "      \"result\": "
+		sed -e '2,$s/^/      /' "$LOGS/run.json"
+	} >> "$RESULTS.tmp"
+	RUNS=$((RUNS + 1))
+	echo "fs3_bench: $name $(grep -E '"(elapsed_s|throughput_mb_s)"' "$LOGS/run.json" | tr -d ' ,\n' | sed -e 's/"\([a-z_]*\)":/ \1 /g')"
+}
+
+#
+# Main
+
+# Process the command line parameters
+while getopts "ho:w:c:b:a:S:p:Ct:" ch; do
+	case $ch in
+	h) echo "$USAGE" >&2; exit 1 ;;
+	o) RESULTS=$OPTARG ;;
+	w) WORKLOADS=$OPTARG ;;
+	c) CACHES=$OPTARG ;;
+	b) BUILDS=$OPTARG ;;
+	a) CLIENTARGS=$OPTARG ;;
+	S) SERVER=$OPTARG ;;
+	p) PORT=$OPTARG ;;
+	C) COMPARE=1 ;;
+	t) THRESHOLD=$OPTARG ;;
+	*) echo "$USAGE" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $COMPARE -eq 1 ]; then
+	if [ $# -ne 2 ] || [ ! -r "$1" ] || [ ! -r "$2" ]; then
+		echo "$USAGE" >&2
+		exit 1
+	fi
+	compare_results "$1" "$2"
+	exit $?
+fi
+
+# Every run starts from the directory the client and its workload directory are in
+case $RESULTS in
+/*) ;;
+*) RESULTS=$PWD/$RESULTS ;;
+esac
+cd "$(dirname "$0")" || exit 1
+LOGS=$(mktemp -d /tmp/fs3_bench.XXXXXX) || exit 1
+RUNS=0
+REBUILT=0
+{
+	echo "{"
+	echo "  \"date\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\","
+	echo "  \"host\": \"$(uname -n)\","
+	echo "  \"commit\": \"$(git rev-parse --short HEAD 2> /dev/null)\","
+	echo "  \"runs\": ["
+} > "$RESULTS.tmp"
+
+for b in $BUILDS; do
+	bname=${b%%=*}
+	bflags=${b#*=}
+	[ "$bname" = "$b" ] && bflags=""
+	bflags=${bflags//,/ }
+	if [ "$bname" != "default" ] || [ -n "$bflags" ]; then
+		echo "fs3_bench: building $bname [$bflags]"
+		build "$bflags"
+		REBUILT=1
+	fi
+	for w in $WORKLOADS; do
+		case $w in
+		small|medium|jumbo) file=assign4-$w-workload.txt ;;
+		*) file=$w ;;
+		esac
+		if [ ! -r "$file" ]; then
+			echo "fs3_bench: no workload $file, skipping it" >&2
+			continue
+		fi
+		for c in $CACHES; do
+			run "$(basename "$w" .txt)/c$c/$bname" "$file" "$c" "$bname" "$bflags"
+		done
+	done
+done
+
+# Put the default build back
+if [ $REBUILT -eq 1 ]; then
+	make clean > /dev/null && make > "$LOGS/build.log" 2>&1
+fi
+
+[ $RUNS -gt 0 ] && echo "    }" >> "$RESULTS.tmp"
+{
+	echo "  ]"
+	echo "}"
+} >> "$RESULTS.tmp"
+mv "$RESULTS.tmp" "$RESULTS"
+rm -rf "$LOGS"
+echo "fs3_bench: $RUNS runs written to $RESULTS"
+[ $RUNS -gt 0 ]
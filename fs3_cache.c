@@ -28,6 +28,7 @@ typedef struct{
     struct Node *previous, *next;
     int sector;
     int track;
+    int prefetched; //brought in by readahead and not used yet
     char data[FS3_SECTOR_SIZE];
 }Node;
 
@@ -43,6 +44,7 @@ typedef struct{
 
 Cache cache;
 int inserts, getss, hits, misses;
+int raFills, raHits, raWasted;
 //AllNodes nodes;
 
 int removeLRU(){
@@ -52,6 +54,7 @@ int removeLRU(){
     }
 
     logMessage(LOG_INFO_LEVEL, "Ejecting cache item %d.%d (trk.sct), length 1024", cache.last->track, cache.last->sector);
+    if(cache.last->prefetched) raWasted++;
 
     if(cache.last == cache.first){
         cache.first = NULL;
@@ -74,6 +77,7 @@ Node* newNode(FS3TrackIndex trk, FS3SectorIndex sct, void *buf){
     temp->sector = sct;
     temp->next = NULL;
     temp->previous = NULL;
+    temp->prefetched = 0;
     memcpy(temp->data, buf, FS3_SECTOR_SIZE);
     return temp;
 }
@@ -145,10 +149,15 @@ int fs3_close_cache(void)  {
     Node *cur = cache.last;
     while(cur->previous != NULL){
         Node *temp = cur->previous;
+        if(cur->prefetched) raWasted++;
         free(cur);
         cur = temp;
     }
+    if(cur->prefetched) raWasted++;
     free(cur);
+    cache.first = NULL;
+    cache.last = NULL;
+    cache.currentCapacity = 0;
     return(0);
 }
 
@@ -168,6 +177,7 @@ int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
 
     if(temp != NULL){
         memcpy(temp->data, buf, FS3_SECTOR_SIZE);
+        temp->prefetched = 0;
         if(cache.first == temp) return 0;
         if(temp == cache.last) cache.last = (Node *)(temp->previous);
         else {((Node *)(temp->next))->previous = temp->previous;}
@@ -218,10 +228,15 @@ void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)  {
         return NULL;
     } else{
         hits++;
+        if (node->prefetched){
+            raHits++;
+            node->prefetched = 0;
+        }
         if (cache.first != node){ 
             if(node == cache.last) cache.last = (Node *)(node->previous);
             else {((Node *)(node->next))->previous = node->previous;}
             ((Node *)(node->previous))->next = node->next;
+            node->previous = NULL;
             node->next = cache.first;
             cache.first->previous = node;
             cache.first = node;
@@ -231,6 +246,144 @@ void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)  {
     // IF returns null, then add to cache in driver code
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_prefetch_cache
+// Description  : Put a sector fetched by readahead in the cache
+//
+// Inputs       : trk - the track number of the sector to put in cache
+//                sct - the sector number of the sector to put in cache
+//                buf - the sector contents
+// Outputs      : 0 if inserted, -1 if not inserted
+
+int fs3_prefetch_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    if(fs3_put_cache(trk, sct, buf) != 0) return -1;
+    cache.first->prefetched = 1; //put always leaves the line at the front
+    raFills++;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_demote_cache
+// Description  : Move a cached sector to the end of the LRU list so it is the
+//                next one evicted
+//
+// Inputs       : trk - the track number of the sector to demote
+//                sct - the sector number of the sector to demote
+// Outputs      : 0 if demoted or not cached, -1 if failure
+
+int fs3_demote_cache(FS3TrackIndex trk, FS3SectorIndex sct) {
+    Node *node = lookupNode(trk, sct);
+
+    if(node == NULL || node == cache.last) return(0);
+
+    if(node == cache.first){
+        cache.first = (Node *)(node->next);
+        cache.first->previous = NULL;
+    } else{
+        ((Node *)(node->previous))->next = node->next;
+        ((Node *)(node->next))->previous = node->previous;
+    }
+    node->previous = (struct Node *)cache.last;
+    node->next = NULL;
+    cache.last->next = (struct Node *)node;
+    cache.last = node;
+    logMessage(LOG_INFO_LEVEL, "Demoted cache item %d.%d (trk.sct)", trk, sct);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_evict_cache
+// Description  : Drop a sector from the cache, its contents changed on disk
+//                without passing through the cache
+//
+// Inputs       : trk - the track number of the sector to drop
+//                sct - the sector number of the sector to drop
+// Outputs      : 0 if dropped or not cached, -1 if failure
+
+int fs3_evict_cache(FS3TrackIndex trk, FS3SectorIndex sct) {
+    Node *node = lookupNode(trk, sct);
+
+    if(node == NULL) return(0);
+
+    //the last line goes the way every eviction does
+    if(fs3_demote_cache(trk, sct) != 0) return(-1);
+    return(removeLRU());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_promote_cache
+// Description  : Move a cached sector to the front of the LRU list without
+//                counting a hit, so loads queued next to it do not evict it
+//
+// Inputs       : trk - the track number of the sector to promote
+//                sct - the sector number of the sector to promote
+// Outputs      : 1 if cached (and promoted), 0 if not
+
+int fs3_promote_cache(FS3TrackIndex trk, FS3SectorIndex sct) {
+    Node *node = lookupNode(trk, sct);
+
+    if(node == NULL) return(0);
+    if(node == cache.first) return(1);
+
+    if(node == cache.last) cache.last = (Node *)(node->previous);
+    else ((Node *)(node->next))->previous = node->previous;
+    ((Node *)(node->previous))->next = node->next;
+    node->previous = NULL;
+    node->next = (struct Node *)cache.first;
+    cache.first->previous = (struct Node *)node;
+    cache.first = node;
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_in_cache
+// Description  : Check whether a sector is cached without touching the LRU
+//                order or the metrics
+//
+// Inputs       : trk - the track number of the sector to find
+//                sct - the sector number of the sector to find
+// Outputs      : 1 if cached, 0 if not
+
+int fs3_in_cache(FS3TrackIndex trk, FS3SectorIndex sct) {
+    return(lookupNode(trk, sct) != NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_size
+// Description  : Number of cache lines the cache was initialized with
+//
+// Inputs       : none
+// Outputs      : the number of cache lines
+
+int fs3_cache_size(void) {
+    return(cache.length);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_cache_stats
+// Description  : Copy the counters of the cache, for the results of a run
+//
+// Inputs       : stats - receives the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_cache_stats(FS3CacheStats *stats) {
+    stats->inserts = inserts;
+    stats->gets = getss;
+    stats->hits = hits;
+    stats->misses = misses;
+    stats->raFills = raFills;
+    stats->raHits = raHits;
+    stats->raWasted = raWasted;
+    return(0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_log_cache_metrics
@@ -245,5 +398,8 @@ int fs3_log_cache_metrics(void) {
     logMessage(LOG_OUTPUT_LEVEL, "Cache hits       [     %d]", hits);
     logMessage(LOG_OUTPUT_LEVEL, "Cache misses     [     %d]", misses);
     logMessage(LOG_OUTPUT_LEVEL, "Hit ratio: %%%f", ((hits/(float)getss)*100));
+    logMessage(LOG_OUTPUT_LEVEL, "Readahead fills  [     %d]", raFills);
+    logMessage(LOG_OUTPUT_LEVEL, "Readahead hits   [     %d]", raHits);
+    logMessage(LOG_OUTPUT_LEVEL, "Readahead wasted [     %d]", raWasted);
     return(0);
 }
\ No newline at end of file
@@ -17,6 +17,12 @@
 // Defines
 #define FS3_DEFAULT_CACHE_SIZE 2048; // 256 cache entries, by default
 
+// Type definitions
+typedef struct {
+    int inserts, gets, hits, misses;
+    int raFills, raHits, raWasted;   // sectors readahead brought in, later read, dropped unread
+} FS3CacheStats;
+
 //
 // Cache Functions
 
@@ -32,6 +38,27 @@ int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
 void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct);
     // Get an element from the cache (returns NULL if not found)
 
+int fs3_prefetch_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Put a sector fetched by readahead in the cache
+
+int fs3_demote_cache(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Move a cached sector to the front of the eviction order
+
+int fs3_evict_cache(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Drop a sector from the cache (no metrics beyond a wasted readahead)
+
+int fs3_promote_cache(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Move a cached sector to the front of the LRU order (no metrics), 1 if cached
+
+int fs3_in_cache(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Check whether a sector is cached (no LRU update, no metrics)
+
+int fs3_cache_size(void);
+    // Number of cache lines the cache was initialized with
+
+int fs3_cache_stats(FS3CacheStats *stats);
+    // Copy the cache counters into stats
+
 int fs3_log_cache_metrics(void);
     // Log the metrics for the cache 
 
@@ -0,0 +1,186 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_codec.c
+//  Description    : This is the implementation of the sector codec for packed
+//                   FS3 payloads. Sectors are compressed one at a time with a
+//                   small LZ77 scheme in the LZ4 block layout: a token byte
+//                   (literal count in the high nibble, match length - 4 in
+//                   the low nibble, 15 meaning more bytes follow), the
+//                   literals, then a 2 byte little-endian match offset. The
+//                   last sequence carries literals only. Text and runs of
+//                   one character shrink severalfold; sectors that do not
+//                   shrink are sent as they are.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Includes
+#include <string.h>
+#include <stdint.h>
+
+// Project Includes
+#include <fs3_codec.h>
+
+//
+// Support Macros/Data
+
+#define CODEC_MIN_MATCH 4
+#define CODEC_HASH_BITS 10
+#define CODEC_HASH(v) ((uint32_t)((v) * 2654435761u) >> (32 - CODEC_HASH_BITS))
+
+//
+// Implementation
+
+//writes an extended length (the part of it above 15)
+int putLength(uint8_t *out, int pos, int cap, int len){
+    for (len -= 15; len >= 255; len -= 255){
+        if (pos >= cap) return -1;
+        out[pos++] = 255;
+    }
+    if (pos >= cap) return -1;
+    out[pos++] = (uint8_t)len;
+    return pos;
+}
+
+//compresses len bytes into at most cap bytes, returns the compressed size or -1 if it does not fit
+int compressSector(const uint8_t *in, int len, uint8_t *out, int cap){
+    uint16_t table[1 << CODEC_HASH_BITS];
+    int pos = 0, anchor = 0, i = 0, ref, lit, mlen, token;
+    uint32_t v;
+
+    memset(table, 0xff, sizeof(table));
+    while (i + CODEC_MIN_MATCH <= len){
+        memcpy(&v, in + i, sizeof(v));
+        ref = table[CODEC_HASH(v)];
+        table[CODEC_HASH(v)] = i;
+        if (ref == 0xffff || memcmp(in + ref, in + i, CODEC_MIN_MATCH) != 0){
+            i++;
+            continue;
+        }
+
+        //extend the match, then emit the literals before it and the match
+        for (mlen = CODEC_MIN_MATCH; i + mlen < len && in[ref + mlen] == in[i + mlen]; mlen++);
+        lit = i - anchor;
+        if (pos >= cap) return -1;
+        token = pos++;
+        out[token] = (uint8_t)(((lit < 15 ? lit : 15) << 4) | (mlen - CODEC_MIN_MATCH < 15 ? mlen - CODEC_MIN_MATCH : 15));
+        if (lit >= 15 && (pos = putLength(out, pos, cap, lit)) < 0) return -1;
+        if (pos + lit + 2 > cap) return -1;
+        memcpy(out + pos, in + anchor, lit);
+        pos += lit;
+        out[pos++] = (uint8_t)((i - ref) & 0xff);
+        out[pos++] = (uint8_t)((i - ref) >> 8);
+        if (mlen - CODEC_MIN_MATCH >= 15 && (pos = putLength(out, pos, cap, mlen - CODEC_MIN_MATCH)) < 0) return -1;
+        i += mlen;
+        anchor = i;
+    }
+
+    //the rest goes out as literals
+    lit = len - anchor;
+    if (pos >= cap) return -1;
+    out[pos++] = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15 && (pos = putLength(out, pos, cap, lit)) < 0) return -1;
+    if (pos + lit > cap) return -1;
+    memcpy(out + pos, in + anchor, lit);
+    return pos + lit;
+}
+
+//reads an extended length, -1 if the input runs out
+int getLength(const uint8_t *in, int *pos, int end, int len){
+    uint8_t b;
+    do{
+        if (*pos >= end) return -1;
+        b = in[(*pos)++];
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+//expands a compressed sector of clen bytes into exactly len bytes, 0 if successful, -1 if malformed
+int decompressSector(const uint8_t *in, int clen, uint8_t *out, int len){
+    int pos = 0, o = 0, lit, mlen, off;
+
+    while (pos < clen){
+        lit = in[pos] >> 4;
+        mlen = in[pos++] & 0xf;
+        if (lit == 15 && (lit = getLength(in, &pos, clen, lit)) < 0) return -1;
+        if (pos + lit > clen || o + lit > len) return -1;
+        memcpy(out + o, in + pos, lit);
+        pos += lit;
+        o += lit;
+        if (pos == clen) break; //the last sequence has no match
+
+        if (pos + 2 > clen) return -1;
+        off = in[pos] | (in[pos + 1] << 8);
+        pos += 2;
+        if (mlen == 15 && (mlen = getLength(in, &pos, clen, mlen)) < 0) return -1;
+        mlen += CODEC_MIN_MATCH;
+        if (off == 0 || off > o || o + mlen > len) return -1;
+        for (; mlen > 0; mlen--, o++) out[o] = out[o - off]; //matches may overlap themselves
+    }
+    return (o == len) ? 0 : -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_codec_pack
+// Description  : Pack sectors for the wire, each compressed if that saves
+//                anything and sent as it is otherwise
+//
+// Inputs       : sectors - count sectors back to back
+//                count - number of sectors
+//                wire - receives the packed payload (FS3_CODEC_WIRE_MAX(count) bytes)
+//                packed - receives the number of sectors that compressed (may be NULL)
+// Outputs      : the wire length
+
+int fs3_codec_pack(void *sectors, int count, void *wire, int *packed) {
+    uint8_t *in = sectors, *out = wire;
+    int i, pos = 0, n, squeezed = 0;
+
+    for (i = 0; i < count; i++, in += FS3_SECTOR_SIZE){
+        n = compressSector(in, FS3_SECTOR_SIZE, out + pos + 2, FS3_SECTOR_SIZE - 1);
+        if (n < 0){
+            n = FS3_SECTOR_SIZE;
+            memcpy(out + pos + 2, in, FS3_SECTOR_SIZE);
+        } else{
+            squeezed++;
+        }
+        out[pos] = (uint8_t)(n >> 8);
+        out[pos + 1] = (uint8_t)(n & 0xff);
+        pos += 2 + n;
+    }
+    if (packed != NULL) *packed = squeezed;
+    return(pos);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_codec_unpack
+// Description  : Unpack a payload from the wire
+//
+// Inputs       : wire - the packed payload
+//                len - its length
+//                sectors - receives count sectors back to back
+//                count - number of sectors
+//                packed - receives the number of sectors that were compressed (may be NULL)
+// Outputs      : 0 if successful, -1 if the payload is malformed
+
+int fs3_codec_unpack(void *wire, int len, void *sectors, int count, int *packed) {
+    uint8_t *in = wire, *out = sectors;
+    int i, pos = 0, n, squeezed = 0;
+
+    for (i = 0; i < count; i++, out += FS3_SECTOR_SIZE){
+        if (pos + 2 > len) return(-1);
+        n = (in[pos] << 8) | in[pos + 1];
+        pos += 2;
+        if (n > FS3_SECTOR_SIZE || pos + n > len) return(-1);
+        if (n == FS3_SECTOR_SIZE) memcpy(out, in + pos, FS3_SECTOR_SIZE);
+        else if (decompressSector(in + pos, n, out, FS3_SECTOR_SIZE) != 0) return(-1);
+        else squeezed++;
+        pos += n;
+    }
+    if (packed != NULL) *packed = squeezed;
+    return((pos == len) ? 0 : -1);
+}
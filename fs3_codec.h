@@ -0,0 +1,41 @@
+#ifndef FS3_CODEC_INCLUDED
+#define FS3_CODEC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_codec.h
+//  Description    : This is the interface for the sector codec that packs
+//                   payloads on the wire once a session has negotiated it.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_CODEC_SECTOR_MAX (FS3_SECTOR_SIZE + 2)          // Wire bytes of one sector at worst
+#define FS3_CODEC_WIRE_MAX(n) ((n) * FS3_CODEC_SECTOR_MAX)  // Wire bytes of n sectors at worst
+#define FS3_CODEC_FITS(wire, raw) ((wire) <= FS3_CODEC_WIRE_MAX((raw) / FS3_SECTOR_SIZE)) // Packed length is possible for raw bytes
+
+//
+// Packed payloads
+//
+//   Every sector of the payload goes out as a 2 byte big-endian length n
+//   followed by n bytes: the compressed sector if n < FS3_SECTOR_SIZE, the
+//   sector itself if n == FS3_SECTOR_SIZE (it did not compress). Sectors
+//   compress independently, a lost or odd sector never affects another.
+
+//
+// Codec Functions
+
+int fs3_codec_pack(void *sectors, int count, void *wire, int *packed);
+    // Pack count sectors into wire (FS3_CODEC_WIRE_MAX(count) bytes), returns the wire length
+
+int fs3_codec_unpack(void *wire, int len, void *sectors, int count, int *packed);
+    // Unpack a wire payload of len bytes into count sectors, 0 if successful, -1 if malformed
+
+// packed (may be NULL) receives how many of the sectors were compressed
+
+#endif
@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_controller.c
+//  Description    : This is an in-tree implementation of the FS3 controller.
+//                   It executes command blocks against a 64 track x 1024
+//                   sector disk, held in memory or mapped onto an image
+//                   file that keeps it across restarts, and is what the
+//                   local server stand-in runs behind its socket.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_common.h>
+
+//
+// Support Macros/Data
+
+#define FS3_CMD_FAIL(b) ((FS3CmdBlk)(b) | ((FS3CmdBlk)1 << 11))
+
+#define FS3_DISK_BYTES ((size_t)FS3_MAX_TRACKS * sizeof(FS3Track))
+
+FS3Track *fs3Disk = NULL;
+int fs3DiskMapped = 0; // the disk is an image file mapped in, not memory of our own
+pthread_rwlock_t trackLocks[FS3_MAX_TRACKS]; // sessions on other threads read a track together, write it alone
+pthread_once_t trackLocksOnce = PTHREAD_ONCE_INIT;
+
+//
+// Support Functions
+
+//sets up the track locks, once for the life of the process
+void initTrackLocks(void) {
+    int i;
+
+    for(i = 0; i < FS3_MAX_TRACKS; i++) pthread_rwlock_init(&trackLocks[i], NULL);
+}
+
+//
+// Implementation
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_init
+// Description  : Set up the disk the controller serves, mapped onto an image
+//                file (a new or empty one starts zeroed) or allocated zeroed
+//                in memory
+//
+// Inputs       : image - path of the image file, NULL for a disk in memory
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_controller_init(char *image) {
+    struct stat st;
+    int fd;
+
+    pthread_once(&trackLocksOnce, initTrackLocks);
+    if(fs3Disk != NULL) return(0);
+    if(image == NULL){
+        fs3Disk = calloc(FS3_MAX_TRACKS, sizeof(FS3Track));
+        if(fs3Disk == NULL){
+            logMessage(LOG_ERROR_LEVEL, "FS3 controller: could not allocate the disk");
+            return(-1);
+        }
+        logMessage(FS3ControllerLLevel, "FS3 controller: disk of %d tracks allocated", FS3_MAX_TRACKS);
+        return(0);
+    }
+
+    //an image is exactly one disk, anything else is not ours to overwrite
+    if((fd = open(image, O_RDWR | O_CREAT, 0644)) == -1 || fstat(fd, &st) != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 controller: cannot open disk image %s [%s]", image, strerror(errno));
+        if(fd != -1) close(fd);
+        return(-1);
+    }
+    if(st.st_size != 0 && (size_t)st.st_size != FS3_DISK_BYTES){
+        logMessage(LOG_ERROR_LEVEL, "FS3 controller: %s is %ld bytes, not a disk image of %lu", image, (long)st.st_size, (unsigned long)FS3_DISK_BYTES);
+        close(fd);
+        return(-1);
+    }
+    if(st.st_size == 0 && ftruncate(fd, FS3_DISK_BYTES) != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 controller: cannot size disk image %s [%s]", image, strerror(errno));
+        close(fd);
+        return(-1);
+    }
+
+    //the mapping is shared, so every write is in the file's pages as soon as it is made
+    fs3Disk = mmap(NULL, FS3_DISK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(fs3Disk == MAP_FAILED){
+        logMessage(LOG_ERROR_LEVEL, "FS3 controller: cannot map disk image %s [%s]", image, strerror(errno));
+        fs3Disk = NULL;
+        return(-1);
+    }
+    fs3DiskMapped = 1;
+    logMessage(LOG_OUTPUT_LEVEL, "FS3 controller: disk of %d tracks mapped from %s%s", FS3_MAX_TRACKS, image,
+        st.st_size ? "" : " (new image)");
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_sync
+// Description  : Write the disk back to its image file
+//
+// Inputs       : wait - non-zero to return only once it is on stable storage
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_controller_sync(int wait) {
+    if(fs3Disk == NULL || !fs3DiskMapped) return(0);
+    if(msync(fs3Disk, FS3_DISK_BYTES, wait ? MS_SYNC : MS_ASYNC) != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 controller: cannot sync the disk image [%s]", strerror(errno));
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_close
+// Description  : Write a mapped disk back to its image and release the disk
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_controller_close(void) {
+    int ret = 0;
+
+    if(fs3DiskMapped){
+        ret = fs3_controller_sync(1);
+        munmap(fs3Disk, FS3_DISK_BYTES);
+        fs3DiskMapped = 0;
+    } else{
+        free(fs3Disk);
+    }
+    fs3Disk = NULL;
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_controller_execute
+// Description  : Run one command against the disk. Sessions may run
+//                commands from several threads at once; every command
+//                holds the lock of the track(s) it touches, so a sector or
+//                range it writes is never seen half written.
+//
+// Inputs       : sess - the state of the connection the command came in on
+//                cmd - the command block (host byte order)
+//                buf - sector data for WRSECT, receives the sector for RDSECT,
+//                      offset and bytes for WRPART, the source for COPY
+// Outputs      : the reply block, the return bit is set on failure
+
+FS3CmdBlk fs3_controller_execute(FS3ControllerSession *sess, FS3CmdBlk cmd, void *buf) {
+    uint32_t trk = FS3_CMD_TRACK(cmd);
+    uint16_t sct = FS3_CMD_SECTOR(cmd), off, strk, ssct;
+    FS3CmdBlk reply = cmd & ~((FS3CmdBlk)1 << 11);
+
+    switch(FS3_CMD_OPCODE(cmd)){
+        case FS3_OP_MOUNT:
+            if(sess->mounted) return(FS3_CMD_FAIL(reply));
+            sess->mounted = 1;
+            sess->track = FS3_NO_TRACK;
+            return(reply & ~(FS3CmdBlk)0x7ff); //like fs3_server, no option bits come back unless a server grants them
+
+        case FS3_OP_TSEEK:
+            if(!sess->mounted || trk >= FS3_MAX_TRACKS) return(FS3_CMD_FAIL(reply));
+            sess->track = trk;
+            return(reply);
+
+        case FS3_OP_RDSECT:
+            //sector reads and writes land on the track of the last seek
+            if(!sess->mounted || sess->track == FS3_NO_TRACK || sct >= FS3_TRACK_SIZE) return(FS3_CMD_FAIL(reply));
+            pthread_rwlock_rdlock(&trackLocks[sess->track]);
+            memcpy(buf, fs3Disk[sess->track][sct], FS3_SECTOR_SIZE);
+            pthread_rwlock_unlock(&trackLocks[sess->track]);
+            return(reply);
+
+        case FS3_OP_WRSECT:
+            if(!sess->mounted || sess->track == FS3_NO_TRACK || sct >= FS3_TRACK_SIZE) return(FS3_CMD_FAIL(reply));
+            pthread_rwlock_wrlock(&trackLocks[sess->track]);
+            memcpy(fs3Disk[sess->track][sct], buf, FS3_SECTOR_SIZE);
+            pthread_rwlock_unlock(&trackLocks[sess->track]);
+            return(reply);
+
+        case FS3_OP_RDRANGE:
+        case FS3_OP_WRRANGE:
+            //the sectors of a range are consecutive on disk, so one copy moves them all
+            if(!sess->mounted || sess->track == FS3_NO_TRACK || FS3_CMD_COUNT(cmd) == 0 ||
+                    sct + FS3_CMD_COUNT(cmd) > FS3_TRACK_SIZE) return(FS3_CMD_FAIL(reply));
+            if(FS3_CMD_OPCODE(cmd) == FS3_OP_RDRANGE){
+                pthread_rwlock_rdlock(&trackLocks[sess->track]);
+                memcpy(buf, fs3Disk[sess->track][sct], FS3_CMD_COUNT(cmd) * FS3_SECTOR_SIZE);
+            } else{
+                pthread_rwlock_wrlock(&trackLocks[sess->track]);
+                memcpy(fs3Disk[sess->track][sct], buf, FS3_CMD_COUNT(cmd) * FS3_SECTOR_SIZE);
+            }
+            pthread_rwlock_unlock(&trackLocks[sess->track]);
+            return(reply);
+
+        case FS3_OP_WRPART:
+            //only the bytes that changed come over, merged into the sector here
+            off = (((uint8_t *)buf)[0] << 8) | ((uint8_t *)buf)[1];
+            if(!sess->mounted || sess->track == FS3_NO_TRACK || sct >= FS3_TRACK_SIZE || FS3_CMD_COUNT(cmd) == 0 ||
+                    off + FS3_CMD_COUNT(cmd) > FS3_SECTOR_SIZE) return(FS3_CMD_FAIL(reply));
+            pthread_rwlock_wrlock(&trackLocks[sess->track]);
+            memcpy(fs3Disk[sess->track][sct] + off, (char *)buf + FS3_WRPART_HEADER, FS3_CMD_COUNT(cmd));
+            pthread_rwlock_unlock(&trackLocks[sess->track]);
+            return(reply);
+
+        case FS3_OP_COPY:
+            //the sectors never leave the disk, the source may sit on any track
+            strk = (((uint8_t *)buf)[0] << 8) | ((uint8_t *)buf)[1];
+            ssct = (((uint8_t *)buf)[2] << 8) | ((uint8_t *)buf)[3];
+            if(!sess->mounted || sess->track == FS3_NO_TRACK || FS3_CMD_COUNT(cmd) == 0 || strk >= FS3_MAX_TRACKS ||
+                    sct + FS3_CMD_COUNT(cmd) > FS3_TRACK_SIZE || ssct + FS3_CMD_COUNT(cmd) > FS3_TRACK_SIZE) return(FS3_CMD_FAIL(reply));
+            //two tracks are always locked lower one first, so crossed copies cannot wait on each other
+            if(strk < sess->track) pthread_rwlock_rdlock(&trackLocks[strk]);
+            pthread_rwlock_wrlock(&trackLocks[sess->track]);
+            if(strk > sess->track) pthread_rwlock_rdlock(&trackLocks[strk]);
+            memmove(fs3Disk[sess->track][sct], fs3Disk[strk][ssct], FS3_CMD_COUNT(cmd) * FS3_SECTOR_SIZE);
+            if(strk != sess->track) pthread_rwlock_unlock(&trackLocks[strk]);
+            pthread_rwlock_unlock(&trackLocks[sess->track]);
+            return(reply);
+
+        case FS3_OP_UMOUNT:
+            //what the session wrote starts on its way to the image
+            if(!sess->mounted || fs3_controller_sync(0) != 0) return(FS3_CMD_FAIL(reply));
+            sess->mounted = 0;
+            return(reply);
+    }
+
+    logMessage(LOG_WARNING_LEVEL, "FS3 controller: bad opcode %d", FS3_CMD_OPCODE(cmd));
+    return(FS3_CMD_FAIL(reply));
+}
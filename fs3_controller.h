@@ -20,6 +20,33 @@
 #define FS3_SECTOR_SIZE 1024
 #define FS3_NO_TRACK (FS3_MAX_TRACKS+0xff)
 
+// Fields of the 64-bit command block (opcode | sector | track | return bit)
+#define FS3_CMD_OPCODE(b)  ((uint8_t)((uint64_t)(b) >> 60))
+#define FS3_CMD_SECTOR(b)  ((uint16_t)(((uint64_t)(b) >> 44) & 0xffff))
+#define FS3_CMD_TRACK(b)   ((uint32_t)(((uint64_t)(b) >> 12) & 0xffffffff))
+#define FS3_CMD_RETURN(b)  ((uint8_t)(((uint64_t)(b) >> 11) & 0x1))
+#define FS3_CMD_COUNT(b)   ((uint16_t)((uint64_t)(b) & 0x7ff))   // Sectors in a RDRANGE/WRRANGE
+#define FS3_MAX_RANGE FS3_TRACK_SIZE                             // Most sectors one range moves
+#define FS3_CMD_WIRE(b)    ((uint32_t)(((uint64_t)(b) >> 22) & 0x3fffff)) // Packed payload bytes (unused high track bits), 0 if raw
+#define FS3_CMD_WIRE_MASK  ((uint64_t)0x3fffff << 22)
+#define FS3_MOUNT_PACK     0x1                                   // MOUNT count bit: packed payloads asked for / granted
+#define FS3_MOUNT_PATCH    0x2                                   // MOUNT count bit: FS3_OP_WRPART asked for / granted
+#define FS3_MOUNT_COPY     0x4                                   // MOUNT count bit: FS3_OP_COPY asked for / granted
+#define FS3_WRPART_HEADER  2                                     // Byte offset (big-endian) in front of a WRPART's bytes
+#define FS3_COPY_HEADER    4                                     // Source track and sector (big-endian) a COPY reads from
+
+// Payload bytes that follow a request / a reply with this command block
+#define FS3_REQUEST_PAYLOAD(b) ((FS3_CMD_OPCODE(b) == FS3_OP_WRSECT) ? FS3_SECTOR_SIZE : \
+	(FS3_CMD_OPCODE(b) == FS3_OP_WRRANGE) ? FS3_CMD_COUNT(b) * FS3_SECTOR_SIZE : \
+	(FS3_CMD_OPCODE(b) == FS3_OP_WRPART) ? FS3_WRPART_HEADER + FS3_CMD_COUNT(b) : \
+	(FS3_CMD_OPCODE(b) == FS3_OP_COPY) ? FS3_COPY_HEADER : 0)
+#define FS3_REPLY_PAYLOAD(b) ((FS3_CMD_OPCODE(b) == FS3_OP_RDSECT) ? FS3_SECTOR_SIZE : \
+	(FS3_CMD_OPCODE(b) == FS3_OP_RDRANGE) ? FS3_CMD_COUNT(b) * FS3_SECTOR_SIZE : 0)
+
+// Payload bytes that actually follow on the wire, a packed payload is as long as its block says
+#define FS3_REQUEST_WIRE(b) ((FS3_REQUEST_PAYLOAD(b) && FS3_CMD_WIRE(b)) ? FS3_CMD_WIRE(b) : FS3_REQUEST_PAYLOAD(b))
+#define FS3_REPLY_WIRE(c, r) ((FS3_REPLY_PAYLOAD(c) && FS3_CMD_WIRE(r)) ? FS3_CMD_WIRE(r) : FS3_REPLY_PAYLOAD(c))
+
 // Type definitions
 typedef uint64_t FS3CmdBlk;                 // The command block base data type
 typedef uint16_t FS3TrackIndex;             // Index number of track
@@ -36,10 +63,21 @@ typedef enum {
 	FS3_OP_RDSECT = 2,  // Read a sector from the disk
 	FS3_OP_WRSECT = 3,  // Write a sector to the disk
 	FS3_OP_UMOUNT = 4,  // Unmount the ffilesystem
-	FS3_OP_MAXVAL = 5   // Maximum opcode value
+	FS3_OP_COMPOUND = 5, // Ordered batch of TSEEK/RDSECT/WRSECT, count in the sector field
+	FS3_OP_RDRANGE = 6, // Read sectors [sector, sector+count) of the current track
+	FS3_OP_WRRANGE = 7, // Write sectors [sector, sector+count) of the current track
+	FS3_OP_WRPART = 8,  // Write count bytes into a sector of the current track, at the offset the payload starts with
+	FS3_OP_COPY = 9,    // Copy count sectors from the track and sector the payload names to [sector, sector+count) of the current track
+	FS3_OP_MAXVAL = 10  // Maximum opcode value
 
 } FS3OpCodes;
 
+// Per-connection state kept by a controller implementation
+typedef struct {
+	int mounted;             // MOUNT seen and no UMOUNT since
+	FS3TrackIndex track;     // Track the head is on, FS3_NO_TRACK before the first seek
+} FS3ControllerSession;
+
 //
 // Global Data ?? wasnt here before?
 //extern unsigned long FS3ControllerLLevel;  // Controller log level
@@ -49,5 +87,17 @@ extern unsigned long FS3DriverLLevel;      // Driver log level
 //
 // Functional Prototypes
 
+int fs3_controller_init(char *image);
+	// Map the disk onto an image file (created zeroed if missing), or allocate a zeroed one if image is NULL
+
+int fs3_controller_sync(int wait);
+	// Write a mapped disk back to its image (wait for stable storage if wait is non-zero)
+
+int fs3_controller_close(void);
+	// Sync and release the disk
+
+FS3CmdBlk fs3_controller_execute(FS3ControllerSession *sess, FS3CmdBlk cmd, void *buf);
+	// Run one command against the disk, returns the reply block (return bit set on failure)
+	// buf holds FS3_REQUEST_PAYLOAD bytes in and receives FS3_REPLY_PAYLOAD bytes
 
 #endif
@@ -0,0 +1,287 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_dedup.c
+//  Description    : This is the implementation of the content-addressed sector
+//                   deduplication index for the FS3 filesystem interface.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Includes
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_dedup.h>
+#include <fs3_controller.h>
+#include <fs3_network.h>
+#include <fs3_common.h>
+
+
+//
+// Support Macros/Data
+
+#define FS3_DEDUP_SEED_LO 0xcbf29ce484222325ULL
+#define FS3_DEDUP_SEED_HI 0x9e3779b97f4a7c15ULL
+#define FS3_DEDUP_PRIME_LO 0x100000001b3ULL
+#define FS3_DEDUP_PRIME_HI 0xff51afd7ed558ccdULL
+
+//
+// Implementation
+
+typedef struct{
+    FS3Fingerprint fp;
+    uint16_t track;
+    uint16_t sector;
+    int used;
+}IndexEntry;
+
+typedef struct{
+    int refs;            // logical sectors mapped onto this physical sector (can pass 65535)
+    int indexed;         // fingerprint of the contents is in the index
+    FS3Fingerprint fp;   // fingerprint last recorded for the contents
+}SectorInfo;
+
+int fs3_dedup_enabled = 0;
+IndexEntry dedupIndex[FS3_DEDUP_INDEX_SIZE];
+SectorInfo sectorInfo[FS3_VOLUME_TRACKS][FS3_TRACK_SIZE];
+long dedupBytes, writesAvoided, cowCopies, indexed;
+
+//final avalanche so that both lanes spread over the whole index
+uint64_t mix64(uint64_t h){
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int sameFingerprint(FS3Fingerprint a, FS3Fingerprint b){
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+int validLocation(FS3TrackIndex trk, FS3SectorIndex sct){
+    return trk < FS3_VOLUME_TRACKS && sct < FS3_TRACK_SIZE;
+}
+
+//removes entry i and shifts any displaced followers back so probing stays correct
+void removeEntry(uint32_t i){
+    uint32_t mask = FS3_DEDUP_INDEX_SIZE - 1;
+    uint32_t j = i;
+
+    dedupIndex[i].used = 0;
+    while(1){
+        j = (j + 1) & mask;
+        if(!dedupIndex[j].used) return;
+        uint32_t home = (uint32_t)dedupIndex[j].fp.lo & mask;
+        //entry j can fill the hole at i only if its home is not between i and j
+        if((i <= j) ? (home <= i || home > j) : (home <= i && home > j)){
+            dedupIndex[i] = dedupIndex[j];
+            dedupIndex[j].used = 0;
+            i = j;
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_init_dedup
+// Description  : Initialize the fingerprint index and sector reference counts
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_init_dedup(void) {
+    memset(dedupIndex, 0, sizeof(dedupIndex));
+    memset(sectorInfo, 0, sizeof(sectorInfo));
+    dedupBytes = writesAvoided = cowCopies = indexed = 0;
+    logMessage(LOG_INFO_LEVEL, "Dedup index initialized [%d slots]", FS3_DEDUP_INDEX_SIZE);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_close_dedup
+// Description  : Close the dedup index, dropping all fingerprints
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_close_dedup(void) {
+    memset(dedupIndex, 0, sizeof(dedupIndex));
+    memset(sectorInfo, 0, sizeof(sectorInfo));
+    indexed = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_dedup_fingerprint
+// Description  : Compute the fingerprint of a full sector
+//
+// Inputs       : buf - the sector contents (FS3_SECTOR_SIZE bytes)
+// Outputs      : the 128-bit fingerprint
+
+FS3Fingerprint fs3_dedup_fingerprint(void *buf) {
+    FS3Fingerprint fp = {FS3_DEDUP_SEED_LO, FS3_DEDUP_SEED_HI};
+    uint64_t word;
+    int i;
+
+    //two word-at-a-time multiplicative lanes, a match on both is treated as identical contents
+    for(i = 0; i < FS3_SECTOR_SIZE; i += sizeof(uint64_t)){
+        memcpy(&word, (char *)buf + i, sizeof(uint64_t));
+        fp.lo = (fp.lo ^ word) * FS3_DEDUP_PRIME_LO;
+        fp.hi = ((fp.hi ^ word) * FS3_DEDUP_PRIME_HI) ^ (fp.hi >> 29);
+    }
+    fp.lo = mix64(fp.lo);
+    fp.hi = mix64(fp.hi ^ fp.lo);
+    return fp;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_dedup_lookup
+// Description  : Find the physical sector holding a fingerprint
+//
+// Inputs       : fp - the fingerprint to look for
+//                trk - set to the track of the matching sector
+//                sct - set to the sector of the matching sector
+// Outputs      : 0 if found, -1 if not found
+
+int fs3_dedup_lookup(FS3Fingerprint fp, FS3TrackIndex *trk, FS3SectorIndex *sct) {
+    uint32_t mask = FS3_DEDUP_INDEX_SIZE - 1;
+    uint32_t i = (uint32_t)fp.lo & mask;
+
+    while(dedupIndex[i].used){
+        if(sameFingerprint(dedupIndex[i].fp, fp)){
+            *trk = dedupIndex[i].track;
+            *sct = dedupIndex[i].sector;
+            return(0);
+        }
+        i = (i + 1) & mask;
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_dedup_insert
+// Description  : Record that a physical sector now holds the fingerprinted
+//                contents
+//
+// Inputs       : fp - the fingerprint of the sector contents
+//                trk - the track of the sector
+//                sct - the sector number of the sector
+// Outputs      : 0 if inserted, -1 if not inserted
+
+int fs3_dedup_insert(FS3Fingerprint fp, FS3TrackIndex trk, FS3SectorIndex sct) {
+    uint32_t mask = FS3_DEDUP_INDEX_SIZE - 1;
+    uint32_t i = (uint32_t)fp.lo & mask;
+
+    if(!validLocation(trk, sct)) return(-1);
+    fs3_dedup_forget(trk, sct);
+    if(indexed >= FS3_DEDUP_INDEX_SIZE - 1){
+        logMessage(LOG_WARNING_LEVEL, "Dedup index full, sector %d.%d (trk.sct) not indexed", trk, sct);
+        return(-1);
+    }
+
+    while(dedupIndex[i].used){
+        if(sameFingerprint(dedupIndex[i].fp, fp)) return(0); //an identical sector is already indexed
+        i = (i + 1) & mask;
+    }
+    dedupIndex[i].fp = fp;
+    dedupIndex[i].track = trk;
+    dedupIndex[i].sector = sct;
+    dedupIndex[i].used = 1;
+    sectorInfo[trk][sct].fp = fp;
+    sectorInfo[trk][sct].indexed = 1;
+    indexed++;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_dedup_forget
+// Description  : Remove the fingerprint of a physical sector whose contents
+//                are changing
+//
+// Inputs       : trk - the track of the sector
+//                sct - the sector number of the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_dedup_forget(FS3TrackIndex trk, FS3SectorIndex sct) {
+    uint32_t mask = FS3_DEDUP_INDEX_SIZE - 1;
+    uint32_t i;
+
+    if(!validLocation(trk, sct)) return(-1);
+    if(!sectorInfo[trk][sct].indexed) return(0);
+
+    i = (uint32_t)sectorInfo[trk][sct].fp.lo & mask;
+    while(dedupIndex[i].used){
+        if(dedupIndex[i].track == trk && dedupIndex[i].sector == sct){
+            removeEntry(i);
+            indexed--;
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    sectorInfo[trk][sct].indexed = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_dedup_ref
+// Description  : Adjust the number of logical sectors mapped to a physical one
+//
+// Inputs       : trk - the track of the sector
+//                sct - the sector number of the sector
+//                delta - change in the number of mappings
+// Outputs      : the new reference count, -1 if failure
+
+int fs3_dedup_ref(FS3TrackIndex trk, FS3SectorIndex sct, int delta) {
+    int refs;
+
+    if(!validLocation(trk, sct)) return(-1);
+    refs = sectorInfo[trk][sct].refs + delta;
+    if(refs < 0) refs = 0;
+    sectorInfo[trk][sct].refs = refs;
+    return(refs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_dedup_account
+// Description  : Record deduplicated bytes, skipped sector writes and
+//                copy-on-write copies
+//
+// Inputs       : bytes - bytes that did not have to be sent
+//                writes - sector writes that were skipped
+//                copies - shared sectors copied before modification
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_dedup_account(int bytes, int writes, int copies) {
+    dedupBytes += bytes;
+    writesAvoided += writes;
+    cowCopies += copies;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_dedup_metrics
+// Description  : Log the metrics for the dedup index
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_dedup_metrics(void) {
+    logMessage(LOG_OUTPUT_LEVEL, "Dedup bytes      [     %ld]", dedupBytes);
+    logMessage(LOG_OUTPUT_LEVEL, "Writes avoided   [     %ld]", writesAvoided);
+    logMessage(LOG_OUTPUT_LEVEL, "COW copies       [     %ld]", cowCopies);
+    logMessage(LOG_OUTPUT_LEVEL, "Indexed sectors  [     %ld]", indexed);
+    return(0);
+}
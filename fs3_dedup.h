@@ -0,0 +1,65 @@
+#ifndef FS3_DEDUP_INCLUDED
+#define FS3_DEDUP_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_dedup.h
+//  Description    : This is the interface for the content-addressed sector
+//                   deduplication index used by the FS3 driver write path.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include
+#include <fs3_controller.h>
+#include <fs3_network.h>
+
+// Defines
+#define FS3_DEDUP_INDEX_SIZE (FS3_VOLUME_TRACKS * FS3_TRACK_SIZE * 2) // Fingerprint slots, twice the sectors of
+                                                                       // the largest volume so probes stay short
+#if (FS3_DEDUP_INDEX_SIZE & (FS3_DEDUP_INDEX_SIZE - 1)) != 0
+#error "FS3_DEDUP_INDEX_SIZE must be a power of two"
+#endif
+
+// Type definitions
+typedef struct {
+	uint64_t lo;  // First fingerprint lane
+	uint64_t hi;  // Second, independently seeded lane
+} FS3Fingerprint;
+
+//
+// Global Data
+extern int fs3_dedup_enabled;  // Non-zero when the write path deduplicates sectors
+
+//
+// Dedup Functions
+
+int fs3_init_dedup(void);
+    // Initialize the fingerprint index and sector reference counts
+
+int fs3_close_dedup(void);
+    // Close the dedup index, dropping all fingerprints
+
+FS3Fingerprint fs3_dedup_fingerprint(void *buf);
+    // Compute the fingerprint of a full sector
+
+int fs3_dedup_lookup(FS3Fingerprint fp, FS3TrackIndex *trk, FS3SectorIndex *sct);
+    // Find the physical sector holding a fingerprint (0 if found, -1 if not)
+
+int fs3_dedup_insert(FS3Fingerprint fp, FS3TrackIndex trk, FS3SectorIndex sct);
+    // Record that a physical sector now holds the fingerprinted contents
+
+int fs3_dedup_forget(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Remove the fingerprint of a physical sector whose contents are changing
+
+int fs3_dedup_ref(FS3TrackIndex trk, FS3SectorIndex sct, int delta);
+    // Adjust the number of logical sectors mapped to a physical one, returns new count
+
+int fs3_dedup_account(int bytes, int writesAvoided, int copies);
+    // Record deduplicated bytes, skipped sector writes and copy-on-write copies
+
+int fs3_log_dedup_metrics(void);
+    // Log the metrics for the dedup index
+
+#endif
@@ -15,6 +15,11 @@
 #include <fs3_controller.h>
 #include <string.h>
 #include <fs3_cache.h>
+#include <fs3_network.h>
+#include <fs3_dedup.h>
+#include <fs3_sched.h>
+#include <fs3_journal.h>
+#include <fs3_image.h>
 
 // Project Includes
 #include <fs3_driver.h>
@@ -23,6 +28,12 @@
 // Defines
 #define SECTOR_INDEX_NUMBER(x) ((int)(x/FS3_SECTOR_SIZE))
 #define FILE_TRACK_CAP 300 //Files to keep track of
+#define FS3_PACK_MAX_BYTES 512 //Largest file tail that gets packed into a shared sector
+#define FS3_PACK_MIN_SLOT 64 //Smallest packed slot, slot sizes double up to FS3_PACK_MAX_BYTES
+#define FS3_PACK_CLASSES 4 //Number of packed slot sizes (64, 128, 256, 512)
+#define FS3_PACK_FREE_CAP 1024 //Released packed slots remembered per slot size
+#define FS3_FREE_SECTOR_CAP 4096 //Released dedicated sectors remembered for reuse
+#define FS3_MAX_FILE_SECTORS (FS3_TRACK_SIZE*2) //Logical sectors a single file can map
 
 //
 // Static Global Variables
@@ -30,6 +41,8 @@
 typedef struct{
 	int track;
 	int sector;
+	int offset; //byte offset of the data inside the sector (only non-zero when packed)
+	int slot; //size of the packed slot in bytes, 0 when the sector belongs to the file alone
 } tsTuple;
 
 
@@ -37,11 +50,15 @@ typedef struct{
 typedef struct{
 	int isOpen;
 	int index;
-	tsTuple ts[FS3_TRACK_SIZE*2]; //NOTE: change back to reasonable value later
+	tsTuple ts[FS3_MAX_FILE_SECTORS]; //NOTE: change back to reasonable value later
 	int position;
 	int length;
 	int fileHandle;
-	char fileName[32];
+	char fileName[FS3_MAX_PATH_LENGTH];
+	int raPos; //file position the next sequential read would start at
+	int raWindow; //current readahead window, in sectors
+	int raEnd; //first logical sector past the run already prefetched
+	int advice; //FS3_ADV_NORMAL, FS3_ADV_SEQUENTIAL or FS3_ADV_RANDOM from fs3_advise
 }flags;
 
 // deconstructedCmdBlock struct
@@ -57,17 +74,42 @@ flags files[FILE_TRACK_CAP] = {{0}}; //arbitrary number of files to keep track o
 int lastAllocatedTrack;
 int lastAllocatedSector; //NOTE: MUST only update if sector written was on the last allocated track
 
+//tail packing state: the shared sector currently being carved into slots, plus released slots/sectors
+tsTuple packSector;
+int packUsed = FS3_SECTOR_SIZE; //bytes of packSector already handed out (full forces a fresh sector)
+tsTuple packFree[FS3_PACK_CLASSES][FS3_PACK_FREE_CAP];
+int packFreeCount[FS3_PACK_CLASSES];
+tsTuple freeSectors[FS3_FREE_SECTOR_CAP];
+int freeSectorCount;
+int imageSectors; //sectors at the start of the disk that belong to a preloaded image
+
 uint64_t cmdblock;
 int isMounted;
-int byteCount;
-flags currentFile; //only really used to create data structure for file to keep track of its state
+int fs3_readahead_max = FS3_DEFAULT_READAHEAD;
+int fs3_load_image;
 
 //
 // Implementation
 
-tsTuple findEmptySector(){ //TODO: need to switch this with sectors essentially
-	tsTuple nextEmpty;
-	
+/*
+hands out a sector nothing uses, track -1 when the disk is full. With -J the journal's tracks at the
+end of the volume are not handed out.
+*/
+tsTuple findEmptySector(){
+	tsTuple nextEmpty = {0};
+	int tracks = network_volume_tracks() - ((fs3_journal_group > 0) ? FS3_JOURNAL_TRACKS : 0);
+
+	//sectors given back by tail packing are reused before the disk grows
+	if(freeSectorCount > 0){
+		return freeSectors[--freeSectorCount];
+	}
+
+	if(lastAllocatedSector + 1 >= FS3_TRACK_SIZE && lastAllocatedTrack + 1 >= tracks){
+		logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: the disk is full, all %d tracks%s are in use", tracks,
+				(fs3_journal_group > 0) ? " below the journal" : "");
+		nextEmpty.track = -1;
+		return nextEmpty;
+	}
 	if(lastAllocatedSector + 1 >= FS3_TRACK_SIZE){
 		lastAllocatedSector = 0;
 		lastAllocatedTrack += 1;
@@ -78,8 +120,62 @@ tsTuple findEmptySector(){ //TODO: need to switch this with sectors essentially
 	return nextEmpty;
 }
 
+//returns the slot size class (0 = 64 bytes ... 3 = 512 bytes) able to hold "bytes"
+int packClass(int bytes){
+	int cls = 0;
+	while((FS3_PACK_MIN_SLOT << cls) < bytes) cls++;
+	return cls;
+}
+
+//hands out a slot inside a shared sector big enough for "bytes" (bytes <= FS3_PACK_MAX_BYTES)
+tsTuple allocatePackedSlot(int bytes){
+	int cls = packClass(bytes);
+	int size = FS3_PACK_MIN_SLOT << cls;
+	tsTuple slot;
+
+	if(packFreeCount[cls] > 0){
+		return packFree[cls][--packFreeCount[cls]];
+	}
+
+	if(packUsed + size > FS3_SECTOR_SIZE){
+		slot = findEmptySector();
+		if(slot.track < 0) return slot;
+		packSector = slot;
+		packUsed = 0;
+		logMessage(FS3DriverLLevel, "FS3 driver: new packing sector at track %d, sector %d", packSector.track, packSector.sector);
+	}
+
+	slot.track = packSector.track;
+	slot.sector = packSector.sector;
+	slot.offset = packUsed;
+	slot.slot = size;
+	packUsed += size;
+	return slot;
+}
+
+//gives a packed slot or a dedicated sector back to the allocator, the sectors of a preloaded image
+//stay where its table says so the next mount finds its files intact
+void releaseLocation(tsTuple loc){
+	if(loc.slot == 0 && loc.track * FS3_TRACK_SIZE + loc.sector < imageSectors) return;
+	if(loc.slot != 0){
+		int cls = packClass(loc.slot);
+		if(packFreeCount[cls] < FS3_PACK_FREE_CAP) packFree[cls][packFreeCount[cls]++] = loc;
+	} else if(freeSectorCount < FS3_FREE_SECTOR_CAP){
+		freeSectors[freeSectorCount++] = loc;
+	}
+}
+
+//drops one mapping of a location, a deduplicated sector is only given back once nothing maps it
+void dropSector(tsTuple loc){
+	if(fs3_dedup_enabled && loc.slot == 0){
+		if(fs3_dedup_ref(loc.track, loc.sector, -1) > 0) return;
+		fs3_dedup_forget(loc.track, loc.sector);
+	}
+	releaseLocation(loc);
+}
+
 void printCmdBlock(FS3CmdBlk cmdblk){
-	char charCMDBLK[64] = {[0 ... 63] = '0'};
+	char charCMDBLK[65] = {[0 ... 63] = '0'};
 	int x = 0;
 	while(cmdblk){
 		if (cmdblk & 1){
@@ -139,16 +235,350 @@ uint8_t deconstCmdBlock(FS3CmdBlk blk, deconstVals *vals){
 int hash(char *input){
 	int hash = 1000;
 	int c;
-	while (c = *input++){
+	while ((c = *input++)){
 		hash = ((hash << 5) + hash) + c;
 	}
 	int fh = abs(hash % FILE_TRACK_CAP);
-	while (files[fh].isOpen != NULL){
-		fh = abs(fh + 1 % FILE_TRACK_CAP);
+	while (files[fh].fileName[0] != '\0'){
+		fh = (fh + 1) % FILE_TRACK_CAP;
 	}
 	return fh;
 }
 
+/*
+fills the file table from the one fs3_mkimage left at the start of the disk (see fs3_image.h). The
+files come back closed, each on its consecutive sectors, and new sectors are handed out past them.
+A disk without the table loads nothing.
+*/
+int loadImageTable(void){
+	FS3Sector table[1 + FS3_IMAGE_TABLE_SECTORS];
+	FS3ImageHeader hdr;
+	FS3ImageEntry ent;
+	uint32_t i, k, sectors, volume = network_volume_tracks() * FS3_TRACK_SIZE;
+	int fh;
+
+	if(fs3_network_servers > 1){
+		logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: a preloaded image is laid out for one server, it cannot be loaded on a volume of %d servers",
+				fs3_network_servers);
+		return -1;
+	}
+	if(fs3_sched_submit(FS3_OP_RDSECT, 0, 0, table[0], 0) != 0 || fs3_sched_run() != 0) return -1;
+	memcpy(&hdr, table[0], sizeof(hdr));
+	if(hdr.magic != FS3_IMAGE_MAGIC){
+		logMessage(LOG_WARNING_LEVEL, "FS3 DRVR: the disk holds no preloaded image, starting empty");
+		return 0;
+	}
+	if(hdr.files > FS3_IMAGE_MAX_FILES || hdr.table != (hdr.files + FS3_IMAGE_ENTRIES_PER_SECTOR - 1) / FS3_IMAGE_ENTRIES_PER_SECTOR ||
+			hdr.next > volume){
+		logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: the preloaded image has a bad header (%u files, %u table sectors)", hdr.files, hdr.table);
+		return -1;
+	}
+	for(i = 1; i <= hdr.table; i++){
+		if(fs3_sched_submit(FS3_OP_RDSECT, i / FS3_TRACK_SIZE, i % FS3_TRACK_SIZE, table[i], 0) != 0) return -1;
+	}
+	if(fs3_sched_run() != 0) return -1;
+
+	memset(files, 0, sizeof(files));
+	for(i = 0; i < hdr.files; i++){
+		memcpy(&ent, table[1 + i / FS3_IMAGE_ENTRIES_PER_SECTOR] + (i % FS3_IMAGE_ENTRIES_PER_SECTOR) * sizeof(ent), sizeof(ent));
+		sectors = (ent.length + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+		if(memchr(ent.name, 0, FS3_MAX_PATH_LENGTH) == NULL || sectors > FS3_MAX_FILE_SECTORS ||
+				ent.first < 1 + hdr.table || ent.first + sectors > hdr.next){
+			logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: bad entry %u in the table of the preloaded image", i);
+			return -1;
+		}
+
+		fh = hash(ent.name);
+		strcpy(files[fh].fileName, ent.name);
+		files[fh].fileHandle = fh;
+		files[fh].length = ent.length;
+		for(k = 0; k < sectors; k++){
+			files[fh].ts[k].track = (ent.first + k) / FS3_TRACK_SIZE;
+			files[fh].ts[k].sector = (ent.first + k) % FS3_TRACK_SIZE;
+			if(fs3_dedup_enabled) fs3_dedup_ref(files[fh].ts[k].track, files[fh].ts[k].sector, 1);
+		}
+	}
+
+	imageSectors = hdr.next;
+	lastAllocatedTrack = hdr.next / FS3_TRACK_SIZE;
+	lastAllocatedSector = (int)(hdr.next % FS3_TRACK_SIZE) - 1; //the next one handed out is hdr.next
+	freeSectorCount = 0;
+	memset(packFreeCount, 0, sizeof(packFreeCount));
+	logMessage(LOG_OUTPUT_LEVEL, "FS3 DRVR: loaded %u preloaded files (%u bytes), new sectors from track %d, sector %d",
+		hdr.files, hdr.bytes, lastAllocatedTrack, lastAllocatedSector + 1);
+	return 0;
+}
+
+//sends a single controller operation and validates the returned command block
+int sectorSyscall(uint8_t opcode, int track, int sector, void *buf){
+	FS3CmdBlk ret = 0;
+	deconstVals vals;
+
+	cmdblock = makeCmdBlock(opcode, sector, track, 0);
+	if(network_fs3_syscall(cmdblock, &ret, buf) != 0) return -1;
+	if(deconstCmdBlock(ret, &vals) != 0) return -1;
+	return 0;
+}
+
+//sends a batch of controller operations, pipelined up to the network window, and validates every reply
+int sectorBatch(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count){
+	deconstVals vals;
+	int i;
+
+	if(network_fs3_pipeline(cmds, rets, bufs, count) != 0) return -1;
+	for(i = 0; i < count; i++){
+		if(deconstCmdBlock(rets[i], &vals) != 0) return -1;
+	}
+	return 0;
+}
+
+//loads a disk sector into buf, going to the controller only on a cache miss the journal cannot serve
+int loadSector(int track, int sector, char *buf){
+	void *tempc = fs3_get_cache(track, sector);
+	if(tempc == NULL && fs3_journal_group > 0) tempc = fs3_journal_lookup(track, sector);
+	if(tempc != NULL){
+		memcpy(buf, tempc, FS3_SECTOR_SIZE);
+		return 0;
+	}
+
+	//the read joins any queued writes, so it comes back after an earlier write to the same sector
+	if(fs3_sched_submit(FS3_OP_RDSECT, track, sector, buf, FS3_SCHED_CACHE) != 0) return -1;
+	return fs3_sched_run();
+}
+
+//queues buf for a disk sector and keeps the cached copy current, fs3_sched_run() sends it (with the
+//journal on, the next group commit does)
+int storeSector(int track, int sector, char *buf){
+	fs3_put_cache(track, sector, buf);
+	if(fs3_journal_group > 0) return fs3_journal_store(track, sector, buf);
+	return fs3_sched_submit(FS3_OP_WRSECT, track, sector, buf, 0);
+}
+
+//queues a partial write of n bytes at "offset" of a disk sector, a cached copy takes the same bytes
+int patchSector(int track, int sector, int offset, char *src, int n){
+	char sbuf[FS3_SECTOR_SIZE];
+
+	if(fs3_in_cache(track, sector)){
+		memcpy(sbuf, fs3_get_cache(track, sector), FS3_SECTOR_SIZE);
+		memcpy(sbuf + offset, src, n);
+		fs3_put_cache(track, sector, sbuf);
+	}
+	return fs3_sched_patch(track, sector, offset, src, n);
+}
+
+//number of bytes of logical sector "index" covered by the current file length
+int sectorBytesUsed(int16_t fd, int index){
+	int used = files[fd].length - index * FS3_SECTOR_SIZE;
+	if(used < 0) return 0;
+	if(used > FS3_SECTOR_SIZE) return FS3_SECTOR_SIZE;
+	return used;
+}
+
+/*
+stores the merged image of a dedicated logical sector. In dedup mode contents that are already on
+disk are mapped onto the existing sector instead of being sent again, and a sector shared by several
+logical sectors is copied before it is modified.
+*/
+int storeFileSector(int16_t fd, int index, int fresh, char *sbuf){
+	tsTuple loc = files[fd].ts[index], copy;
+	FS3Fingerprint fp;
+	FS3TrackIndex trk;
+	FS3SectorIndex sct;
+
+	if(!fs3_dedup_enabled) return storeSector(loc.track, loc.sector, sbuf);
+
+	fp = fs3_dedup_fingerprint(sbuf);
+	if(fs3_dedup_lookup(fp, &trk, &sct) == 0){
+		if(trk != loc.track || sct != loc.sector){
+			fs3_dedup_ref(trk, sct, 1);
+			if(fresh) releaseLocation(loc); //never written, nothing else maps it
+			else dropSector(loc);
+			files[fd].ts[index].track = trk;
+			files[fd].ts[index].sector = sct;
+			logMessage(FS3DriverLLevel, "FS3 driver: fh/index %d/%d deduplicated onto track %d, sector %d", fd, index, trk, sct);
+		}
+		fs3_dedup_account(FS3_SECTOR_SIZE, 1, 0);
+		return 0;
+	}
+
+	if(!fresh && fs3_dedup_ref(loc.track, loc.sector, 0) > 1){
+		copy = findEmptySector();
+		if(copy.track < 0) return -1;
+		fs3_dedup_ref(loc.track, loc.sector, -1);
+		loc = copy;
+		files[fd].ts[index] = loc;
+		fs3_dedup_account(0, 0, 1);
+		fresh = 1;
+	}
+	if(storeSector(loc.track, loc.sector, sbuf) != 0) return -1;
+	if(fresh) fs3_dedup_ref(loc.track, loc.sector, 1);
+	fs3_dedup_insert(fp, loc.track, loc.sector);
+	return 0;
+}
+
+//copies "n" bytes at "secoff" of logical sector "index" into dst (holes read back as zeros)
+int readFileSector(int16_t fd, int index, int secoff, char *dst, int n){
+	char sbuf[FS3_SECTOR_SIZE];
+	tsTuple loc = files[fd].ts[index];
+
+	if(loc.track == 0 && loc.sector == 0){
+		memset(dst, 0, n);
+		return 0;
+	}
+	if(loadSector(loc.track, loc.sector, sbuf) != 0) return -1;
+	memcpy(dst, sbuf + loc.offset + secoff, n);
+	return 0;
+}
+
+//queues reads of the logical sectors [from, to) of a file that are on disk but not cached. Demand
+//loads keep the cached part of the span at the front of the cache so the loads cannot evict it.
+int queueFileSectors(int16_t fd, int from, int to, int flags){
+	int i;
+
+	for(i = from; i < to; i++){
+		tsTuple loc = files[fd].ts[i];
+		if(loc.track == 0 && loc.sector == 0) continue;
+		if(fs3_journal_group > 0 && fs3_journal_lookup(loc.track, loc.sector) != NULL) continue;
+		if((flags & FS3_SCHED_PREFETCH) ? fs3_in_cache(loc.track, loc.sector) : fs3_promote_cache(loc.track, loc.sector)) continue;
+		if(fs3_sched_submit(FS3_OP_RDSECT, loc.track, loc.sector, NULL, flags) != 0) return -1;
+	}
+	return 0;
+}
+
+//reads logical sectors [from, to) of a file straight into the cache, the scheduler orders them by track
+int prefetchSectors(int16_t fd, int from, int to){
+	if(queueFileSectors(fd, from, to, FS3_SCHED_PREFETCH) != 0) return -1;
+	return fs3_sched_run();
+}
+
+/*
+keeps the sectors after "index" of a sequentially read file in the cache. A new batch is issued once
+the reader gets within half a window of the end of the last one; every batch the reader catches up
+with confirms the stream, so the window doubles up to fs3_readahead_max (and a quarter of the cache).
+*/
+void readaheadFile(int16_t fd, int index){
+	int limit = fs3_readahead_max;
+	int lastSector = (files[fd].length - 1) / FS3_SECTOR_SIZE;
+	int from, to;
+
+	if(limit > fs3_cache_size() / 4) limit = fs3_cache_size() / 4;
+	if(files[fd].raWindow > limit) files[fd].raWindow = limit;
+	if(files[fd].raWindow <= 0 || files[fd].length == 0) return;
+	if(files[fd].raEnd > index + 1 + files[fd].raWindow / 2) return; //still far enough ahead
+
+	if(files[fd].raEnd > index){
+		files[fd].raWindow *= 2;
+		if(files[fd].raWindow > limit) files[fd].raWindow = limit;
+	}
+
+	from = (files[fd].raEnd > index + 1) ? files[fd].raEnd : index + 1;
+	to = index + 1 + files[fd].raWindow;
+	if(to > lastSector + 1) to = lastSector + 1;
+	if(from >= to) return;
+
+	logMessage(LOG_INFO_LEVEL, "FS3 DRVR: readahead on fh %d, sectors %d-%d (window %d)", fd, from, to - 1, files[fd].raWindow);
+	if(prefetchSectors(fd, from, to) == 0) files[fd].raEnd = to;
+}
+
+/*
+writes "n" bytes from src at "secoff" of logical sector "index". The sector is (re)located first
+when it has no home yet or has outgrown its packed slot: small files start in a packed slot and
+move to bigger slots, then to a dedicated sector, as they grow.
+*/
+int writeFileSector(int16_t fd, int index, int secoff, char *src, int n){
+	char image[FS3_SECTOR_SIZE] = {0};
+	char sbuf[FS3_SECTOR_SIZE];
+	tsTuple loc = files[fd].ts[index];
+	int used = sectorBytesUsed(fd, index);
+	int newUsed = (secoff + n > used) ? secoff + n : used;
+	int unallocated = (loc.track == 0 && loc.sector == 0);
+	int fresh = 0;
+	tsTuple home;
+
+	if(unallocated || (loc.slot != 0 && newUsed > loc.slot)){
+		//carry the bytes already in the old home over to the new one, which is found first so a full
+		//disk leaves the file as it was
+		if(!unallocated && used > 0){
+			if(loadSector(loc.track, loc.sector, sbuf) != 0) return -1;
+			memcpy(image, sbuf + loc.offset, used);
+		}
+		home = (index == 0 && newUsed <= FS3_PACK_MAX_BYTES) ? allocatePackedSlot(newUsed) : findEmptySector();
+		if(home.track < 0) return -1;
+		if(!unallocated) dropSector(loc);
+		loc = home;
+
+		if(loc.slot != 0){
+			logMessage(FS3DriverLLevel, "FS3 driver: packed fh/index %d/%d into track %d, sector %d, offset %d (%d byte slot)", fd, index, loc.track, loc.sector, loc.offset, loc.slot);
+		} else{
+			logMessage(FS3DriverLLevel, "FS3 driver: allocated fs3 track %d, sector %d for fh/index %d/%d", loc.track, loc.sector, fd, index);
+		}
+		files[fd].ts[index] = loc;
+		fresh = 1;
+	} else if(n == 0){
+		return 0;
+	}
+
+	//a server that takes partial writes merges the bytes itself, so nothing is read first: a fresh
+	//packed slot goes out whole and a sector already in place gets just the new bytes (a fresh
+	//sector and a deduplicated one still need their full image)
+	if(fs3_network_patch && fresh && loc.slot != 0){
+		if(n > 0) memcpy(image + secoff, src, n);
+		return patchSector(loc.track, loc.sector, loc.offset, image, loc.slot);
+	}
+	if(fs3_network_patch && !fresh && n < FS3_SECTOR_SIZE && !(fs3_dedup_enabled && loc.slot == 0)){
+		return patchSector(loc.track, loc.sector, loc.offset + secoff, src, n);
+	}
+
+	if(loc.slot == 0){
+		if(fresh){
+			memcpy(sbuf, image, FS3_SECTOR_SIZE);
+		} else if(secoff != 0 || n != FS3_SECTOR_SIZE){
+			if(loadSector(loc.track, loc.sector, sbuf) != 0) return -1;
+		}
+	} else{
+		//packed sectors are shared with other files, so always merge into the current contents
+		if(loadSector(loc.track, loc.sector, sbuf) != 0) return -1;
+		if(fresh) memcpy(sbuf + loc.offset, image, loc.slot);
+	}
+
+	if(n > 0) memcpy(sbuf + loc.offset + secoff, src, n);
+	if(loc.slot == 0) return storeFileSector(fd, index, fresh, sbuf);
+	return storeSector(loc.track, loc.sector, sbuf);
+}
+
+//moves the partly filled last sector of a file into a packed slot, freeing its dedicated sector
+int packFileTail(int16_t fd){
+	char sbuf[FS3_SECTOR_SIZE];
+	char pbuf[FS3_SECTOR_SIZE];
+	int index = files[fd].length / FS3_SECTOR_SIZE;
+	int used = files[fd].length % FS3_SECTOR_SIZE;
+	tsTuple loc = files[fd].ts[index];
+	tsTuple slot;
+
+	if(used == 0 || used > FS3_PACK_MAX_BYTES || loc.slot != 0 || (loc.track == 0 && loc.sector == 0)){
+		return 0;
+	}
+
+	if(loadSector(loc.track, loc.sector, sbuf) != 0) return -1;
+	slot = allocatePackedSlot(used);
+	if(fs3_network_patch){
+		//the server merges the slot into the shared sector, which need not be read
+		memset(pbuf, 0, slot.slot);
+		memcpy(pbuf, sbuf, used);
+		if(patchSector(slot.track, slot.sector, slot.offset, pbuf, slot.slot) != 0) return -1;
+	} else{
+		if(loadSector(slot.track, slot.sector, pbuf) != 0) return -1;
+		memset(pbuf + slot.offset, 0, slot.slot);
+		memcpy(pbuf + slot.offset, sbuf, used);
+		if(storeSector(slot.track, slot.sector, pbuf) != 0) return -1;
+	}
+
+	dropSector(loc);
+	files[fd].ts[index] = slot;
+	logMessage(FS3DriverLLevel, "FS3 driver: packed %d byte tail of fh %d into track %d, sector %d, offset %d", used, fd, slot.track, slot.sector, slot.offset);
+	return 0;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -159,12 +589,27 @@ int hash(char *input){
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t fs3_mount_disk(void) {
-	isMounted = 0;
+	FS3CmdBlk ret;
 
 	if (isMounted == 0){
+		//journal records carry whole sectors, so partial writes are not asked for
+		if (fs3_journal_group > 0) fs3_network_patch = 0;
 		cmdblock = makeCmdBlock(FS3_OP_MOUNT, 0, 0, 0);
-		network_fs3_syscall(cmdblock, 0);
+		if (network_fs3_syscall(cmdblock, &ret, NULL) != 0){
+			logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: failed mounting.\n");
+			return(-1);
+		}
 		isMounted = 1;
+		packUsed = FS3_SECTOR_SIZE;
+		fs3_sched_init();
+		if (fs3_journal_group > 0 && fs3_journal_init() != 0){
+			logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: failed recovering the journal.\n");
+			return(-1);
+		}
+		if (fs3_load_image && loadImageTable() != 0){
+			logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: failed loading the preloaded image.\n");
+			return(-1);
+		}
 		logMessage(FS3DriverLLevel, "FS3 DRVR: mounted.\n");
 		return(0);
 	}
@@ -181,11 +626,15 @@ int32_t fs3_mount_disk(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t fs3_unmount_disk(void) {
+	FS3CmdBlk ret;
+
 	if(isMounted == 1){
+		if(fs3_sched_run() != 0) return -1; //nothing queued may be lost at unmount
+		if(fs3_journal_group > 0 && fs3_journal_close() != 0) return -1;
 		isMounted = 0;
 		//Need to close out all files first ... for file in files, check if isOpened. If yes close(fd)
 		cmdblock = makeCmdBlock(FS3_OP_UMOUNT, 0, 0, 0);
-		network_fs3_syscall(cmdblock, 0);
+		network_fs3_syscall(cmdblock, &ret, NULL);
 		return 0;
 	}
 	return -1;
@@ -200,28 +649,37 @@ int32_t fs3_unmount_disk(void) {
 // Outputs      : file handle if successful, -1 if failure
 
 int16_t fs3_open(char *path) {
-	char filename[strlen(path)];
-	strcpy(filename, path);
-	int fileHandle = hash(&filename); //generates filehandle based on filename
-	if ((files[fileHandle].isOpen == NULL)){ //create file
-		currentFile.isOpen = 1;
-		currentFile.ts[currentFile.index].track = 0; 
-		currentFile.ts[currentFile.index].sector = 0;
-		currentFile.position = 0;
-		currentFile.length = 0;
-		currentFile.fileName[strlen(filename)];
-		strcpy(currentFile.fileName, filename);
-		currentFile.fileHandle = fileHandle; // file handle can be constant for now since dealing with only one file
-		files[fileHandle] = currentFile; //start tracking this file in system
-		logMessage(FS3DriverLLevel, "Driver creating new file [%s]\n", currentFile.fileName);
-		logMessage(FS3DriverLLevel, "File [%s] opened in driver, fh, %d.\n", currentFile.fileName, currentFile.fileHandle);
-
-		return (currentFile.fileHandle); 
+	int fileHandle;
+
+	if (strlen(path) >= FS3_MAX_PATH_LENGTH){
+		logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: path too long [%s]", path);
+		return(-1);
+	}
+
+	//files that already exist keep their handle and sector map across close/open
+	for (fileHandle = 0; fileHandle < FILE_TRACK_CAP; fileHandle++){
+		if (strcmp(files[fileHandle].fileName, path) == 0) break;
+	}
+
+	if (fileHandle == FILE_TRACK_CAP){ //create file
+		fileHandle = hash(path); //generates filehandle based on filename
+		memset(&files[fileHandle], 0, sizeof(flags));
+		strcpy(files[fileHandle].fileName, path);
+		files[fileHandle].fileHandle = fileHandle;
+		files[fileHandle].isOpen = 1; //start tracking this file in system
+		logMessage(FS3DriverLLevel, "Driver creating new file [%s]\n", files[fileHandle].fileName);
+		logMessage(FS3DriverLLevel, "File [%s] opened in driver, fh, %d.\n", files[fileHandle].fileName, fileHandle);
+		return (fileHandle);
 	} else if(files[fileHandle].isOpen != 1){ //if the file is not open, but is created it opens it
-		currentFile = files[fileHandle];
-		currentFile.isOpen = 1;
-		logMessage(FS3DriverLLevel, "File [%s] opened in driver, fh, %d.\n", currentFile.fileName, currentFile.fileHandle);
-		return (currentFile.fileHandle); 
+		files[fileHandle].isOpen = 1;
+		files[fileHandle].position = 0;
+		files[fileHandle].index = 0;
+		files[fileHandle].raPos = 0;
+		files[fileHandle].raWindow = 0;
+		files[fileHandle].raEnd = 0;
+		files[fileHandle].advice = FS3_ADV_NORMAL;
+		logMessage(FS3DriverLLevel, "File [%s] opened in driver, fh, %d.\n", files[fileHandle].fileName, fileHandle);
+		return (fileHandle);
 	}
 
 	return(-1);
@@ -236,18 +694,19 @@ int16_t fs3_open(char *path) {
 // Outputs      : 0 if successful, -1 if failure
 
 int16_t fs3_close(int16_t fd) {
-	if(files[fd].isOpen == 1){
+	if(fd >= 0 && fd < FILE_TRACK_CAP && files[fd].isOpen == 1){
+		if(packFileTail(fd) != 0 || fs3_sched_run() != 0) return -1; //small tails share a sector while the file sits closed
 		files[fd].isOpen = 0; //pretty basic, just checks if open. if it is, then it sets its state to closed
 		return 0;
 	}
-	
+
 	return -1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_read
-// Description  : Reads "count" bytes from the file handle "fh" into the 
+// Description  : Reads "count" bytes from the file handle "fh" into the
 //                buffer "buf"
 //
 // Inputs       : fd - filename of the file to read from
@@ -256,136 +715,74 @@ int16_t fs3_close(int16_t fd) {
 // Outputs      : bytes read if successful, -1 if failure
 
 int32_t fs3_read(int16_t fd, void *buf, int32_t count) {
+	int byteCount = 0;
+	int first, last, loaded, chunk;
 
-	if (files[fd].isOpen != 1){
+	if (fd < 0 || fd >= FILE_TRACK_CAP || files[fd].isOpen != 1){
 		return -1; //aborts since file not open
 	}
-	void *resizedBuff = (char *)calloc(1024, sizeof(char));
-	byteCount = 0;
-	int offset = 0;
 
-	deconstVals vals;
-	
 	logMessage(LOG_INFO_LEVEL, "POSITION: %d LENGTH: %d", files[fd].position, files[fd].length);
 
-	//if the amount to be read is less than or equal to the file length, than it proceeds with reading 'count' bytes
-	if (files[fd].position + count <= files[fd].length){
-		
-		if ((files[fd].position % FS3_SECTOR_SIZE) + count > FS3_SECTOR_SIZE){ //if read amount exceeds sector length
-
-			int span = (int)((files[fd].position + count) / FS3_SECTOR_SIZE) - (int)(files[fd].position / FS3_SECTOR_SIZE); //find number of sectors read call spans
-
-			logMessage(LOG_INFO_LEVEL, "READ Spanning %d sectors ", span);
-
-			for(int i = 0; i < span; i++){
-				cmdblock = makeCmdBlock(FS3_OP_TSEEK, 0, files[fd].ts[files[fd].index].track, 0); //seeks to the correct track
-				FS3CmdBlk ret = network_fs3_syscall(cmdblock, NULL);
-				int validity = deconstCmdBlock(ret, &vals);
-				if(validity != 0) return -1;
-
-				void *tempc = fs3_get_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector);
-				if (tempc == NULL){
-					cmdblock = makeCmdBlock(FS3_OP_RDSECT, files[fd].ts[files[fd].index].sector, 0, 0); //reads the sector
-					ret = network_fs3_syscall(cmdblock, resizedBuff);
-					int validity = deconstCmdBlock(ret, &vals);
-					if(validity != 0) return -1;
-					fs3_put_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector, resizedBuff);
-				} else{
-					resizedBuff = (char *)tempc;
-				}
-
-				int adjSectorRead = FS3_SECTOR_SIZE - files[fd].position % 1024;
-				//logMessage(LOG_INFO_LEVEL, "%s", (char *)resizedBuff);
-				memcpy(buf + offset, resizedBuff + files[fd].position % FS3_SECTOR_SIZE, adjSectorRead); //copies the read bytes into the buffer
-				logMessage(LOG_INFO_LEVEL, "FS3 DRVR: read on fh %d (%d bytes)\n", fd, count);
-				
-				offset += adjSectorRead;
-				count -= adjSectorRead; 
-				byteCount += adjSectorRead;
-				files[fd].position += adjSectorRead; //updates file pointer
-
-				if(tempc == NULL) free(resizedBuff);
-
-				resizedBuff  = (char *)malloc(FS3_SECTOR_SIZE + 1);
-
-				//REVIEW: new code additions for ts tuple implementation
-				files[fd].index += 1;
-				//files[fd].ts[files[fd].index] = findEmptySector();
-
-				/*
-				if(files[fd].ts[files[fd].index].sector + 1 == FS3_TRACK_SIZE){
-					files[fd].index += 1; //REVIEW: IS THIS CORRECT, PRETTY SURE NOT... NEED TO UPDATE POTENTIALLY
-					files[fd].ts[files[fd].index].track = findEmptyTrack();
-				} else{
-					files[fd].sector += 1;
-				} */
-				logMessage(LOG_INFO_LEVEL, "BYTECOUNT: %d (position: %d)\n", byteCount, files[fd].position);
-			}
-		} 
-
-		cmdblock = makeCmdBlock(FS3_OP_TSEEK, 0, files[fd].ts[files[fd].index].track, 0); //seeks to the correct track
-		FS3CmdBlk ret = network_fs3_syscall(cmdblock, NULL);
-		int validity = deconstCmdBlock(ret, &vals);
-		if(validity != 0) return -1;
-
-		void *tempc = fs3_get_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector);
-		if (tempc == NULL){
-			cmdblock = makeCmdBlock(FS3_OP_RDSECT, files[fd].ts[files[fd].index].sector, 0, 0); //reads the sector
-			ret = network_fs3_syscall(cmdblock, resizedBuff);
-			int validity = deconstCmdBlock(ret, &vals);
-			if(validity != 0) return -1;
-			fs3_put_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector, resizedBuff);
-		} else{
-			resizedBuff = (char *)tempc;
-		}
-
-		//logMessage(LOG_INFO_LEVEL, "BUFF? %s", (char *)resizedBuff); 
-		memcpy(buf + offset, resizedBuff + files[fd].position % FS3_SECTOR_SIZE, count); //copies the read bytes into the buffer
-		logMessage(LOG_INFO_LEVEL, "FS3 DRVR: read on fh %d (%d bytes)\n", fd, count);
-		
-		byteCount += count; //updating bytecount and file pointer
-		files[fd].position += count; //updates file pointer
-
-		if(tempc == NULL) free(resizedBuff);
-		logMessage(LOG_INFO_LEVEL, "BYTECOUNT: %d (position: %d)\n", byteCount, files[fd].position);
-
-		return byteCount;
-
-	} 
-	// if the amount to be read is greater than the file length, then it just reads to the end of the file
-	else if (files[fd].position + count > files[fd].length && files[fd].position != files[fd].length){ //DEBUG: (a: it doesn't) i dont think this ever gets invoked, test later
-		byteCount = files[fd].length - files[fd].position;
-
-		cmdblock = makeCmdBlock(FS3_OP_TSEEK, 0, files[fd].ts[files[fd].index].track, 0);
-		FS3CmdBlk ret = network_fs3_syscall(cmdblock, NULL);
-		int validity = deconstCmdBlock(ret, &vals);
-		if(validity != 0) return -1;
-
-		cmdblock = makeCmdBlock(FS3_OP_RDSECT, files[fd].ts[files[fd].index].sector, 0, 0);
-		ret = network_fs3_syscall(cmdblock, resizedBuff);
-		validity = deconstCmdBlock(ret, &vals);
-		if(validity != 0) return -1;
-
-		memcpy(buf, resizedBuff + files[fd].position, byteCount); //copies the read bytes into the buffer
-
-		files[fd].position += files[fd].length; //sets file pointer to eof
-
-		free(resizedBuff);
-
-		return byteCount; 
+	//if the amount to be read is greater than the file length, then it just reads to the end of the file
+	if (files[fd].position + count > files[fd].length){
+		count = files[fd].length - files[fd].position;
 	}
-	else if (files[fd].position == files[fd].length){
+	if (count <= 0){
 		logMessage(LOG_INFO_LEVEL, "File length eqauls its file position!");
 		return 0;
 	}
 
-	return -1;
+	//reads that pick up where the last one stopped (or start the file) keep the stream going
+	if (files[fd].advice == FS3_ADV_RANDOM){
+		files[fd].raWindow = 0;
+	} else if (files[fd].advice == FS3_ADV_SEQUENTIAL){
+		if (files[fd].raWindow < fs3_readahead_max) files[fd].raWindow = fs3_readahead_max;
+	} else if (files[fd].position == files[fd].raPos || files[fd].position == 0){
+		if (files[fd].raWindow < FS3_READAHEAD_MIN) files[fd].raWindow = FS3_READAHEAD_MIN;
+	} else{
+		files[fd].raWindow /= 2;
+		files[fd].raEnd = 0;
+	}
+	first = loaded = files[fd].position / FS3_SECTOR_SIZE;
+	last = (files[fd].position + count - 1) / FS3_SECTOR_SIZE;
+	chunk = fs3_cache_size() / 2;
+	if (chunk < 1) chunk = 1;
+
+	while (count > 0){
+		int index = files[fd].position / FS3_SECTOR_SIZE;
+		int secoff = files[fd].position % FS3_SECTOR_SIZE;
+		int adjSectorRead = FS3_SECTOR_SIZE - secoff;
+		if (adjSectorRead > count) adjSectorRead = count;
+
+		//the missing sectors of the span go out together, in pieces the cache can hold until they are copied
+		if (index >= loaded){
+			loaded = (index + chunk > last + 1) ? last + 1 : index + chunk;
+			if (queueFileSectors(fd, index, loaded, FS3_SCHED_CACHE) != 0 || fs3_sched_run() != 0) return -1;
+		}
+
+		if (index > first && files[fd].raWindow < FS3_READAHEAD_MIN && files[fd].advice != FS3_ADV_RANDOM){
+			files[fd].raWindow = FS3_READAHEAD_MIN; //a read spanning sectors is sequential by itself
+		}
+		if (readFileSector(fd, index, secoff, (char *)buf + byteCount, adjSectorRead) != 0) return -1;
+		if (fs3_readahead_max > 0) readaheadFile(fd, index);
+
+		count -= adjSectorRead;
+		byteCount += adjSectorRead;
+		files[fd].position += adjSectorRead; //updates file pointer
+	}
+
+	files[fd].index = files[fd].position / FS3_SECTOR_SIZE;
+	files[fd].raPos = files[fd].position;
+	logMessage(LOG_INFO_LEVEL, "FS3 DRVR: read on fh %d (%d bytes)\n", fd, byteCount);
+	logMessage(LOG_INFO_LEVEL, "BYTECOUNT: %d (position: %d)\n", byteCount, files[fd].position);
+	return byteCount;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_write
-// Description  : Writes "count" bytes to the file handle "fh" from the 
+// Description  : Writes "count" bytes to the file handle "fh" from the
 //                buffer  "buf"
 //
 // Inputs       : fd - filename of the file to write to
@@ -394,134 +791,61 @@ int32_t fs3_read(int16_t fd, void *buf, int32_t count) {
 // Outputs      : bytes written if successful, -1 if failure
 
 int32_t fs3_write(int16_t fd, void *buf, int32_t count) {
+	int byteCount = 0;
+	int first, last;
 
-	void *resizedBuff;
-	resizedBuff = (char *)malloc(sizeof(char) * 1024 + 1); //FS3_SECTOR_SIZE //NOTE: source of a ton of memory leaks
-	byteCount = 0;
-	int offset = 0;
+	//null value for isOpen indicates the file handle is bad
+	if (fd < 0 || fd >= FILE_TRACK_CAP || files[fd].isOpen != 1){
+		return (-1);
+	}
 
-	deconstVals vals;
+	logMessage(LOG_INFO_LEVEL, "LENGTH: %d || COUNT: %d", files[fd].length, count);
 
-	if((files[fd].ts[files[fd].index].track == 0 && files[fd].ts[files[fd].index].sector == 0) || 0){
-		files[fd].ts[files[fd].index] = findEmptySector();
+	if (files[fd].position + count > FS3_SECTOR_SIZE * FS3_MAX_FILE_SECTORS){
+		logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: write on fh %d past maximum file size", fd);
+		return (-1);
 	}
 
-	logMessage(LOG_INFO_LEVEL, "LENGTH: %d || COUNT: %d", files[fd].length, count);
-	//null value for isOpen indicates the file handle is bad
-	if (files[fd].isOpen != NULL && files[fd].isOpen == 1){
-		if(files[fd].length == 0){
-			files[fd].ts[files[fd].index] = findEmptySector();
-			logMessage(FS3DriverLLevel, "FS3 driver: allocated fs3 track %d, sector 0 for fh/index %d/%d", files[fd].ts[files[fd].index].track, files[fd].fileHandle, files[fd].index);
+	//sectors only partly overwritten are merged, so fetch both ends of the span in one go (not
+	//needed when the server merges partial writes itself)
+	first = files[fd].position / FS3_SECTOR_SIZE;
+	last = (files[fd].position + count - 1) / FS3_SECTOR_SIZE;
+	if (!fs3_network_patch || fs3_dedup_enabled){
+		if (count > 0 && files[fd].position % FS3_SECTOR_SIZE + count < FS3_SECTOR_SIZE * (last - first + 1)){
+			if (queueFileSectors(fd, last, last + 1, FS3_SCHED_CACHE) != 0) return (-1);
 		}
-		if(files[fd].length >= files[fd].position + count && !((files[fd].position % FS3_SECTOR_SIZE) + count > FS3_SECTOR_SIZE)){ //if there is enough space in file for bytes to be written, than don't change its length
-			files[fd].length += 0;
-		} else if((files[fd].position % FS3_SECTOR_SIZE) + count > FS3_SECTOR_SIZE){ //if read amount exceeds sector length
-			//TODO: done ... update similar to how read function works with write span calculations and such (side NOTE: sector utilization is poor, update track and sector allocation process)
-			
-			int span = (int)((files[fd].position + count) / FS3_SECTOR_SIZE) - (int)(files[fd].position / FS3_SECTOR_SIZE);
-
-			logMessage(LOG_INFO_LEVEL, "WRITE Spanning %d sectors ", span);
-			
-			for (int i = 0; i < span; i++){
-				//[1] seek to current track
-				logMessage(LOG_INFO_LEVEL, "WRITE Spanning 2 Tracks... LENGTH: %d || POSITION: %d", files[fd].length, files[fd].position);
-				cmdblock = makeCmdBlock(FS3_OP_TSEEK, 0, files[fd].ts[files[fd].index].track, 0); //seeks to appropriate track
-				FS3CmdBlk ret = network_fs3_syscall(cmdblock, NULL);
-				int validity = deconstCmdBlock(ret, &vals);
-				if(validity != 0) return -1;
-
-				//[2] read in file to resized buff
-				void *tempc = fs3_get_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector);
-				if (tempc == NULL){
-					cmdblock = makeCmdBlock(FS3_OP_RDSECT, files[fd].ts[files[fd].index].sector, files[fd].ts[files[fd].index].track, 0); //reads the sector into the resized buffer || ? need 'files[fd].track[files[fd].index]'
-					ret = network_fs3_syscall(cmdblock, resizedBuff);
-					int validity = deconstCmdBlock(ret, &vals);
-					if(validity != 0) return -1;
-				} else{
-						resizedBuff = (char *)tempc;
-				}
-				//[3] write only up to sector length
-				int adjustedCount = FS3_SECTOR_SIZE - files[fd].position % FS3_SECTOR_SIZE;
-				offset = adjustedCount;
-				//logMessage(LOG_INFO_LEVEL, "[track %d sector %d] Before: %s", files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector, (void*)resizedBuff); //prints out buffers, debugging purposes
-				memcpy(resizedBuff + files[fd].position % FS3_SECTOR_SIZE, buf, adjustedCount);
-				if (tempc == NULL) fs3_put_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector, resizedBuff);
-				
-				cmdblock = makeCmdBlock(FS3_OP_WRSECT, files[fd].ts[files[fd].index].sector, files[fd].ts[files[fd].index].track, 0); //writes buffer with new data into the correct sector
-				ret = network_fs3_syscall(cmdblock, resizedBuff);
-				validity = deconstCmdBlock(ret, &vals);
-				if(validity != 0) return -1;
-				
-				//[4] update position
-				count -= adjustedCount;
-				byteCount += adjustedCount;
-				files[fd].position += adjustedCount;
-
-				//[5] free and reinit resized buf
-				if(tempc == NULL) free(resizedBuff);
-				resizedBuff  = (char *)malloc(FS3_SECTOR_SIZE + 1); //FS3_SECTOR_SIZE
-
-				//REVIEW: new code additions for ts tuple implementation
-					files[fd].index += 1;
-					if((files[fd].ts[files[fd].index].track == 0 && files[fd].ts[files[fd].index].sector == 0) || 0){
-						files[fd].ts[files[fd].index] = findEmptySector();
-					}
-				
-
-				/* REVIEW: Old code
-				if(files[fd].sector + 1 == FS3_TRACK_SIZE){
-					files[fd].index += 1;
-					files[fd].track[files[fd].index] = findEmptyTrack();
-				} else{
-					files[fd].sector += 1;
-				} */
-				if(files[fd].length >= files[fd].position + count){
-					files[fd].length += 0;
-				} else{
-					files[fd].length += (files[fd].position - files[fd].length + count);
-					//files[fd].ts[files[fd].index] = findEmptySector();
-				}		
-				logMessage(FS3DriverLLevel, "FS3 driver: allocated fs3 track %d, sector 0 for fh/index %d/%d", files[fd].ts[files[fd].index].track, files[fd].fileHandle, files[fd].index);
-			}
-		}
-		else {
-			files[fd].length += (files[fd].position - files[fd].length + count); //updates length to provide enough room for bytes to be written
+		if (count > 0 && (files[fd].position % FS3_SECTOR_SIZE != 0 || count < FS3_SECTOR_SIZE)){
+			if (last != first && queueFileSectors(fd, first, first + 1, FS3_SCHED_CACHE) != 0) return (-1);
 		}
+		if (fs3_sched_run() != 0) return (-1);
+	}
 
-		logMessage(LOG_INFO_LEVEL, "LENGTH: %d || POSITION: %d", files[fd].length, files[fd].position);
-		cmdblock = makeCmdBlock(FS3_OP_TSEEK, 0, files[fd].ts[files[fd].index].track, 0); //seeks to appropriate track
-		FS3CmdBlk ret = network_fs3_syscall(cmdblock, NULL);
-		int validity = deconstCmdBlock(ret, &vals);
-		if(validity != 0) return -1;
-
-		void *tempc = fs3_get_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector);
-		if (tempc == NULL){
-			cmdblock = makeCmdBlock(FS3_OP_RDSECT, files[fd].ts[files[fd].index].sector, files[fd].ts[files[fd].index].track, 0); //reads the sector into the resized buffer || ? need 'files[fd].track[files[fd].index]'
-			ret = network_fs3_syscall(cmdblock, resizedBuff);
-			int validity = deconstCmdBlock(ret, &vals);
-			if(validity != 0) return -1;
-		} else{
-			resizedBuff = (char *)tempc;
+	while (count > 0){
+		int index = files[fd].position / FS3_SECTOR_SIZE;
+		int secoff = files[fd].position % FS3_SECTOR_SIZE;
+		int adjustedCount = FS3_SECTOR_SIZE - secoff;
+		if (adjustedCount > count) adjustedCount = count;
+
+		if (writeFileSector(fd, index, secoff, (char *)buf + byteCount, adjustedCount) != 0){
+			fs3_sched_run();
+			return -1;
 		}
-		//logMessage(LOG_INFO_LEVEL, "Before: %s", (void*)resizedBuff);
-		memcpy(resizedBuff + files[fd].position % FS3_SECTOR_SIZE, buf + offset, count); 
-		if (tempc == NULL) fs3_put_cache(files[fd].ts[files[fd].index].track, files[fd].ts[files[fd].index].sector, resizedBuff);
-		//copies the bytes to be written over into the resized buffer 
-		//logMessage(LOG_INFO_LEVEL, "Dest: %s || Src: %s", (void*)resizedBuff, (void*)buf); //debug purposes
-		
-		cmdblock = makeCmdBlock(FS3_OP_WRSECT, files[fd].ts[files[fd].index].sector, files[fd].ts[files[fd].index].track, 0); //writes buffer with new data into the correct sector
-		ret = network_fs3_syscall(cmdblock, resizedBuff);
-		validity = deconstCmdBlock(ret, &vals);
-		if(validity != 0) return -1;
 
-		byteCount += count; //updating bytecount and file pointer
-		files[fd].position += count;
+		count -= adjustedCount;
+		byteCount += adjustedCount;
+		files[fd].position += adjustedCount;
+		if (files[fd].position > files[fd].length){
+			files[fd].length = files[fd].position; //updates length to provide enough room for bytes written
+		}
+	}
 
-		if(tempc == NULL) free(resizedBuff);
+	//the sectors of one write go out together, ordered by track, or wait for the group commit
+	if (fs3_sched_run() != 0) return -1;
+	if (fs3_journal_group > 0 && fs3_journal_written() != 0) return -1;
 
-		return byteCount;
-	}
-	return (-1);
+	files[fd].index = files[fd].position / FS3_SECTOR_SIZE;
+	logMessage(LOG_INFO_LEVEL, "LENGTH: %d || POSITION: %d", files[fd].length, files[fd].position);
+	return byteCount;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -534,16 +858,189 @@ int32_t fs3_write(int16_t fd, void *buf, int32_t count) {
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t fs3_seek(int16_t fd, uint32_t loc) {
-	if(files[fd].isOpen == 1){
+	if(fd >= 0 && fd < FILE_TRACK_CAP && files[fd].isOpen == 1){
+		if (loc > FS3_SECTOR_SIZE * FS3_MAX_FILE_SECTORS){
+			logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: seek on fh %d past maximum file size", fd);
+			return -1;
+		}
 		if (loc > files[fd].length){
+			//a packed tail that the new length no longer fits in has to move first
+			int index = files[fd].length / FS3_SECTOR_SIZE;
+			int grown = (loc / FS3_SECTOR_SIZE > index) ? FS3_SECTOR_SIZE : (int)(loc % FS3_SECTOR_SIZE);
+			if (files[fd].ts[index].slot != 0 && (writeFileSector(fd, index, grown, NULL, 0) != 0 || fs3_sched_run() != 0)) return -1;
 			files[fd].length = loc; //if the location is outside of the files current length, update its size appropriatley
-
 		}
 		files[fd].position = loc;
-		files[fd].index = (int)(files[fd].position / FS3_SECTOR_SIZE); //TODO: this should be index
-		//DEBUG: Is this working properly
-		logMessage(LOG_INFO_LEVEL, "Updated position: %d (length: %d).. sect: %d", files[fd].position, files[fd].length, files[fd].ts[files[fd].index].sector); //update the file pointer to the location specified	
+		files[fd].index = (int)(files[fd].position / FS3_SECTOR_SIZE);
+		logMessage(LOG_INFO_LEVEL, "Updated position: %d (length: %d).. sect: %d", files[fd].position, files[fd].length, files[fd].ts[files[fd].index].sector); //update the file pointer to the location specified
 		return 0;
 	}
 	return -1;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_advise
+// Description  : Tell the driver how a range of the file is about to be used
+//
+// Inputs       : fd - the file descriptor
+//                offset - start of the range in the file
+//                len - length of the range (0 means to the end of the file)
+//                advice - one of the FS3Advice values
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t fs3_advise(int16_t fd, uint32_t offset, uint32_t len, int advice) {
+	uint32_t end;
+	int from, to, i;
+
+	if(fd < 0 || fd >= FILE_TRACK_CAP || files[fd].isOpen != 1){
+		return -1;
+	}
+
+	end = (len == 0 || offset + len > files[fd].length) ? files[fd].length : offset + len;
+	from = offset / FS3_SECTOR_SIZE;
+	to = (end + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+
+	switch(advice){
+		case FS3_ADV_NORMAL:
+		case FS3_ADV_RANDOM:
+			files[fd].advice = advice;
+			files[fd].raWindow = 0;
+			files[fd].raEnd = 0;
+			break;
+		case FS3_ADV_SEQUENTIAL:
+			files[fd].advice = advice;
+			files[fd].raWindow = fs3_readahead_max;
+			break;
+		case FS3_ADV_WILLNEED:
+			//more than the cache holds would only evict the front of the range again
+			if(to - from > fs3_cache_size()) to = from + fs3_cache_size();
+			if(from < to && prefetchSectors(fd, from, to) != 0) return -1;
+			break;
+		case FS3_ADV_DONTNEED:
+			for(i = from; i < to; i++){
+				tsTuple loc = files[fd].ts[i];
+				if(loc.track == 0 && loc.sector == 0) continue;
+				fs3_demote_cache(loc.track, loc.sector);
+			}
+			break;
+		default:
+			logMessage(LOG_ERROR_LEVEL, "FS3 DRVR: unknown advice %d on fh %d", advice, fd);
+			return -1;
+	}
+
+	logMessage(FS3DriverLLevel, "FS3 DRVR: advice %d on fh %d, bytes %u-%u", advice, fd, offset, end);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_copy
+// Description  : Make the file "dst" a copy of the file "src", contents and
+//                length, without moving the data through the client where
+//                the server or the dedup index can do without
+//
+// Inputs       : src - the file descriptor copied from
+//                dst - the file descriptor copied to
+// Outputs      : bytes copied if successful, -1 if failure
+
+int32_t fs3_copy(int16_t src, int16_t dst) {
+	char sbuf[FS3_SECTOR_SIZE];
+	int count, chunk, i, k, run, n;
+	tsTuple from, to;
+
+	if(src < 0 || src >= FILE_TRACK_CAP || files[src].isOpen != 1 || dst < 0 || dst >= FILE_TRACK_CAP ||
+			files[dst].isOpen != 1 || src == dst){
+		return -1;
+	}
+	count = (files[src].length + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+	chunk = (fs3_cache_size() / 4 > 0) ? fs3_cache_size() / 4 : 1;
+
+	//queued writes to either file land before anything is copied, journaled ones included when
+	//the server reads the homes
+	if(fs3_sched_run() != 0) return -1;
+	if(fs3_journal_group > 0 && fs3_network_copy && !fs3_dedup_enabled && fs3_journal_checkpoint() != 0) return -1;
+
+	//dst gives up what it had, last sector first so the free list hands them back in order
+	for(i = FS3_MAX_FILE_SECTORS - 1; i >= 0; i--){
+		to = files[dst].ts[i];
+		if(to.track != 0 || to.sector != 0) dropSector(to);
+	}
+	memset(files[dst].ts, 0, sizeof(files[dst].ts));
+	files[dst].raEnd = 0;
+
+	/*
+	in dedup mode dst maps the very sectors of src and the first write to either file copies the
+	sector it changes; otherwise each sector gets a home of its own that the server fills below.
+	Packed slots, and everything when the server does not copy, go through the client.
+	*/
+	for(i = 0; i < count; i++){
+		from = files[src].ts[i];
+		if(!fs3_network_copy && i % chunk == 0 && prefetchSectors(src, i, (i + chunk < count) ? i + chunk : count) != 0) return -1;
+		if(from.track == 0 && from.sector == 0) continue;
+
+		if(fs3_dedup_enabled && from.slot == 0){
+			fs3_dedup_ref(from.track, from.sector, 1);
+			fs3_dedup_account(FS3_SECTOR_SIZE, 1, 0);
+			files[dst].ts[i] = from;
+		} else if(fs3_network_copy && from.slot == 0){
+			to = findEmptySector();
+			if(to.track < 0){
+				fs3_sched_run();
+				return -1;
+			}
+			files[dst].ts[i] = to;
+		} else{
+			n = sectorBytesUsed(src, i);
+			files[dst].length = i * FS3_SECTOR_SIZE;
+			if(readFileSector(src, i, 0, sbuf, n) != 0 || writeFileSector(dst, i, 0, sbuf, n) != 0){
+				fs3_sched_run();
+				return -1;
+			}
+		}
+	}
+
+	//every run of sectors consecutive on both sides is a single copy on the server
+	for(i = 0; fs3_network_copy && !fs3_dedup_enabled && i < count; i = run){
+		from = files[src].ts[i];
+		to = files[dst].ts[i];
+		run = i + 1;
+		if(from.slot != 0 || (from.track == 0 && from.sector == 0)) continue;
+
+		while(run < count && run - i < FS3_MAX_RANGE && files[src].ts[run].slot == 0 &&
+				files[src].ts[run].track == from.track && files[src].ts[run].sector == from.sector + run - i &&
+				files[dst].ts[run].track == to.track && files[dst].ts[run].sector == to.sector + run - i){
+			run++;
+		}
+		if(fs3_sched_copy(to.track, to.sector, from.track, from.sector, run - i) != 0) return -1;
+
+		//a reused sector may still be cached with what it held before
+		for(k = 0; k < run - i; k++) fs3_evict_cache(to.track, to.sector + k);
+		logMessage(FS3DriverLLevel, "FS3 driver: copying %d sectors of fh %d from track %d, sector %d to track %d, sector %d",
+			run - i, src, from.track, from.sector, to.track, to.sector);
+	}
+	if(fs3_sched_run() != 0) return -1;
+
+	files[dst].length = files[src].length;
+	if(files[dst].position > files[dst].length) files[dst].position = files[dst].length;
+	files[dst].index = files[dst].position / FS3_SECTOR_SIZE;
+	logMessage(FS3DriverLLevel, "FS3 DRVR: copied fh %d (%d bytes) to fh %d", src, files[src].length, dst);
+	return files[src].length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sync
+// Description  : Make every write so far durable: without the journal a
+//                write is on disk once fs3_write returns, with it the open
+//                group is committed
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t fs3_sync(void) {
+	if(isMounted != 1) return -1;
+	if(fs3_sched_run() != 0) return -1;
+	if(fs3_journal_group > 0 && fs3_journal_commit() != 0) return -1;
+	return 0;
+}
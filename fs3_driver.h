@@ -18,6 +18,25 @@
 // Defines
 #define FS3_MAX_TOTAL_FILES 1024 // Maximum number of files ever
 #define FS3_MAX_PATH_LENGTH 128 // Maximum length of filename length
+#define FS3_DEFAULT_READAHEAD 32 // Largest readahead window, in sectors
+#define FS3_READAHEAD_MIN 4 // Window a newly detected sequential stream starts with
+
+// Access pattern hints accepted by fs3_advise
+typedef enum {
+
+	FS3_ADV_NORMAL     = 0,  // Default readahead heuristics
+	FS3_ADV_SEQUENTIAL = 1,  // File will be read front to back, read ahead aggressively
+	FS3_ADV_RANDOM     = 2,  // File will be read at random, no readahead
+	FS3_ADV_WILLNEED   = 3,  // Range will be read soon, bring it into the cache now
+	FS3_ADV_DONTNEED   = 4,  // Range will not be read again, evict it first
+	FS3_ADV_MAXVAL     = 5   // Maximum advice value
+
+} FS3Advice;
+
+//
+// Global Data
+extern int fs3_readahead_max;  // Largest readahead window in sectors (0 disables readahead)
+extern int fs3_load_image;     // Load the file table of a disk image built by fs3_mkimage at mount
 
 //
 // Interface functions
@@ -43,7 +62,22 @@ int32_t fs3_write(int16_t fd, void *buf, int32_t count);
 int32_t fs3_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int32_t fs3_advise(int16_t fd, uint32_t offset, uint32_t len, int advice);
+	// Tell the driver how a range of the file (len 0 = to the end) is about to be used
+
+int32_t fs3_copy(int16_t src, int16_t dst);
+	// Make file dst a copy of file src (contents and length), copying on the server where it can
+
+int32_t fs3_sync(void);
+	// Make every write so far durable (commits the open journal group)
+
 FS3CmdBlk makeCmdBlock(uint8_t opcode, uint16_t sectorNumber, uint32_t trackNumber, uint8_t returnValue);
 	// Constructs a command block
 
+int sectorSyscall(uint8_t opcode, int track, int sector, void *buf);
+	// Sends a single controller operation and validates the returned command block
+
+int sectorBatch(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count);
+	// Sends a batch of controller operations (pipelined) and validates every reply
+
 #endif
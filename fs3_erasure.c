@@ -0,0 +1,316 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_erasure.c
+//  Description    : This is the implementation of the erasure code for FS3
+//                   volumes that keep parity. Arithmetic is over GF(2^8)
+//                   with log/exp tables; the hot loops multiply whole
+//                   regions by a constant with the split nibble tables of
+//                   the constant and PSHUFB (16 bytes per step) where the
+//                   CPU has SSSE3, and byte by byte through the tables
+//                   elsewhere. A coefficient of 1 is a plain XOR.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cmpsc311_log.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ERASURE_X86 1
+#endif
+
+// Project Includes
+#include <fs3_erasure.h>
+
+//
+// Support Macros/Data
+
+#define ERASURE_POLY 0x11d       // x^8 + x^4 + x^3 + x^2 + 1
+#define ERASURE_BENCH_NSEC 20000000LL // How long the benchmark runs each of its loops
+
+//
+// Global data
+long long fs3_erasure_encoded = 0;     // Data bytes encoded
+long long fs3_erasure_decoded = 0;     // Data bytes rebuilt
+long long fs3_erasure_encode_nsec = 0; // Time spent encoding
+long long fs3_erasure_decode_nsec = 0; // Time spent rebuilding
+
+uint8_t gfExp[512], gfLog[256];
+uint8_t erasureMatrix[FS3_ERASURE_MAX_SHARDS][FS3_ERASURE_MAX_SHARDS]; // coefficient of data shard d in parity shard j
+int erasureData, erasureParity;
+int erasureSimd;                 // the CPU has SSSE3
+
+//
+// Implementation
+
+//nanoseconds on the monotonic clock
+long long erasureNanos(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+uint8_t gfMul(uint8_t a, uint8_t b){
+    return (a == 0 || b == 0) ? 0 : gfExp[gfLog[a] + gfLog[b]];
+}
+
+uint8_t gfInv(uint8_t a){
+    return gfExp[255 - gfLog[a]];
+}
+
+//dst ^= src
+void xorRegion(uint8_t *dst, const uint8_t *src, int len){
+    int i = 0;
+    uint64_t a, b;
+
+#if defined(ERASURE_X86) && defined(__SSE2__)
+    for (; i + 16 <= len; i += 16){
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(dst + i)), _mm_loadu_si128((const __m128i *)(src + i))));
+    }
+#endif
+    for (; i + 8 <= len; i += 8){
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; i++) dst[i] ^= src[i];
+}
+
+//dst ^= c * src, byte by byte
+void mulAddScalar(uint8_t *dst, const uint8_t *src, uint8_t c, int i, int len){
+    int lc = gfLog[c];
+
+    for (; i < len; i++){
+        if (src[i]) dst[i] ^= gfExp[lc + gfLog[src[i]]];
+    }
+}
+
+#ifdef ERASURE_X86
+//dst ^= c * src, 16 bytes at a time: c * x is c * (low nibble of x) ^ c * (high nibble << 4),
+//and PSHUFB looks both up in 16 entry tables at once
+__attribute__((target("ssse3")))
+int mulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t c, int len){
+    uint8_t lo[16], hi[16];
+    __m128i tlo, thi, mask = _mm_set1_epi8(0x0f), x, r;
+    int i;
+
+    for (i = 0; i < 16; i++){
+        lo[i] = gfMul(c, i);
+        hi[i] = gfMul(c, i << 4);
+    }
+    tlo = _mm_loadu_si128((const __m128i *)lo);
+    thi = _mm_loadu_si128((const __m128i *)hi);
+    for (i = 0; i + 16 <= len; i += 16){
+        x = _mm_loadu_si128((const __m128i *)(src + i));
+        r = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(x, mask)), _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(dst + i)), r));
+    }
+    return i;
+}
+#endif
+
+//dst ^= c * src
+void mulAddRegion(uint8_t *dst, const uint8_t *src, uint8_t c, int len){
+    int i = 0;
+
+    if (c == 0) return;
+    if (c == 1){
+        xorRegion(dst, src, len);
+        return;
+    }
+#ifdef ERASURE_X86
+    if (erasureSimd) i = mulAddSsse3(dst, src, c, len);
+#endif
+    mulAddScalar(dst, src, c, i, len);
+}
+
+//inverts the n x n matrix m in place, -1 if it is singular (which a Cauchy code never gives)
+int gfInvert(uint8_t m[FS3_ERASURE_MAX_SHARDS][FS3_ERASURE_MAX_SHARDS], uint8_t inv[FS3_ERASURE_MAX_SHARDS][FS3_ERASURE_MAX_SHARDS], int n){
+    uint8_t t, f;
+    int r, c, k;
+
+    for (r = 0; r < n; r++){
+        for (c = 0; c < n; c++) inv[r][c] = (r == c);
+    }
+    for (c = 0; c < n; c++){
+        for (r = c; r < n && m[r][c] == 0; r++);
+        if (r == n) return -1;
+        for (k = 0; k < n; k++){
+            t = m[r][k]; m[r][k] = m[c][k]; m[c][k] = t;
+            t = inv[r][k]; inv[r][k] = inv[c][k]; inv[c][k] = t;
+        }
+        f = gfInv(m[c][c]);
+        for (k = 0; k < n; k++){
+            m[c][k] = gfMul(m[c][k], f);
+            inv[c][k] = gfMul(inv[c][k], f);
+        }
+        for (r = 0; r < n; r++){
+            if (r == c || (f = m[r][c]) == 0) continue;
+            for (k = 0; k < n; k++){
+                m[r][k] ^= gfMul(f, m[c][k]);
+                inv[r][k] ^= gfMul(f, inv[c][k]);
+            }
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_init
+// Description  : Set up the code for stripes of data + parity shards
+//
+// Inputs       : data - data shards of a stripe
+//                parity - parity shards of a stripe
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_erasure_init(int data, int parity) {
+    int i, j, d, x = 1;
+
+    if (data < 1 || parity < 1 || data + parity > FS3_ERASURE_MAX_SHARDS){
+        logMessage(LOG_ERROR_LEVEL, "FS3 erasure: no code for %d data and %d parity shards", data, parity);
+        return(-1);
+    }
+    for (i = 0; i < 255; i++){
+        gfExp[i] = gfExp[i + 255] = (uint8_t)x;
+        gfLog[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100) x ^= ERASURE_POLY;
+    }
+
+    //parity j, data d is 1 / (j ^ (parity + d)), then every column is scaled so row 0 is all ones
+    for (j = 0; j < parity; j++){
+        for (d = 0; d < data; d++) erasureMatrix[j][d] = gfInv((uint8_t)(j ^ (parity + d)));
+    }
+    for (d = 0; d < data; d++){
+        x = gfInv(erasureMatrix[0][d]);
+        for (j = 0; j < parity; j++) erasureMatrix[j][d] = gfMul(erasureMatrix[j][d], x);
+    }
+    erasureData = data;
+    erasureParity = parity;
+#ifdef ERASURE_X86
+    __builtin_cpu_init();
+    erasureSimd = __builtin_cpu_supports("ssse3");
+#endif
+    logMessage(LOG_INFO_LEVEL, "FS3 erasure: %d data + %d parity shards, %s kernel", data, parity, fs3_erasure_kernel());
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_encode
+// Description  : Compute the parity shards of a stripe
+//
+// Inputs       : data - the data shards
+//                parity - receive the parity shards
+//                len - bytes in every shard
+// Outputs      : 0 if successful
+
+int fs3_erasure_encode(uint8_t **data, uint8_t **parity, int len) {
+    long long start = erasureNanos();
+    int j, d;
+
+    for (j = 0; j < erasureParity; j++){
+        memset(parity[j], 0, len);
+        for (d = 0; d < erasureData; d++) mulAddRegion(parity[j], data[d], erasureMatrix[j][d], len);
+    }
+    fs3_erasure_encoded += (long long)erasureData * len;
+    fs3_erasure_encode_nsec += erasureNanos() - start;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_decode
+// Description  : Rebuild the data shards of a stripe that are missing
+//
+// Inputs       : shards - the data shards, then the parity shards
+//                present - which of them hold what was stored
+//                len - bytes in every shard
+// Outputs      : 0 if successful, -1 if too few shards are present
+
+int fs3_erasure_decode(uint8_t **shards, const int *present, int len) {
+    uint8_t m[FS3_ERASURE_MAX_SHARDS][FS3_ERASURE_MAX_SHARDS], inv[FS3_ERASURE_MAX_SHARDS][FS3_ERASURE_MAX_SHARDS];
+    int rows[FS3_ERASURE_MAX_SHARDS], n = 0, r, k, d, lost = 0;
+    long long start = erasureNanos();
+
+    //the first data many present shards, each the row of the generator that made it
+    for (r = 0; r < erasureData + erasureParity && n < erasureData; r++){
+        if (!present[r]) continue;
+        for (k = 0; k < erasureData; k++) m[n][k] = (r < erasureData) ? (r == k) : erasureMatrix[r - erasureData][k];
+        rows[n++] = r;
+    }
+    if (n < erasureData || gfInvert(m, inv, n) != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 erasure: %d of %d shards left, cannot rebuild the stripe", n, erasureData);
+        return(-1);
+    }
+    for (d = 0; d < erasureData; d++){
+        if (present[d]) continue;
+        memset(shards[d], 0, len);
+        for (k = 0; k < n; k++) mulAddRegion(shards[d], shards[rows[k]], inv[d][k], len);
+        lost++;
+    }
+    fs3_erasure_decoded += (long long)lost * len;
+    fs3_erasure_decode_nsec += erasureNanos() - start;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_kernel
+// Description  : Name the GF(2^8) kernel in use
+//
+// Inputs       : none
+// Outputs      : "ssse3" or "scalar"
+
+const char *fs3_erasure_kernel(void) {
+    return(erasureSimd ? "ssse3" : "scalar");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_bench
+// Description  : Measure the code on random stripes, the run's own counts are left alone
+//
+// Inputs       : len - bytes in every shard
+//                encode - receives the encoding rate in GB/s of data
+//                decode - receives the rate of rebuilding as many data shards as there
+//                         are parity shards, in GB/s of data rebuilt
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_erasure_bench(int len, double *encode, double *decode) {
+    long long saved[4] = { fs3_erasure_encoded, fs3_erasure_decoded, fs3_erasure_encode_nsec, fs3_erasure_decode_nsec };
+    uint8_t *shards[FS3_ERASURE_MAX_SHARDS], *mem;
+    int present[FS3_ERASURE_MAX_SHARDS], total = erasureData + erasureParity, i, ret = 0;
+    long long start;
+
+    if (erasureData == 0 || (mem = malloc((size_t)total * len)) == NULL) return(-1);
+    for (i = 0; i < total * len; i++) mem[i] = (uint8_t)rand();
+    for (i = 0; i < total; i++){
+        shards[i] = mem + (size_t)i * len;
+        present[i] = (i >= erasureParity || i >= erasureData);
+    }
+
+    fs3_erasure_encoded = fs3_erasure_decoded = fs3_erasure_encode_nsec = fs3_erasure_decode_nsec = 0;
+    for (start = erasureNanos(); erasureNanos() - start < ERASURE_BENCH_NSEC; ){
+        fs3_erasure_encode(shards, shards + erasureData, len);
+    }
+    for (start = erasureNanos(); ret == 0 && erasureNanos() - start < ERASURE_BENCH_NSEC; ){
+        ret = fs3_erasure_decode(shards, present, len);
+    }
+    *encode = (double)fs3_erasure_encoded / (fs3_erasure_encode_nsec ? fs3_erasure_encode_nsec : 1);
+    *decode = (double)fs3_erasure_decoded / (fs3_erasure_decode_nsec ? fs3_erasure_decode_nsec : 1);
+    fs3_erasure_encoded = saved[0];
+    fs3_erasure_decoded = saved[1];
+    fs3_erasure_encode_nsec = saved[2];
+    fs3_erasure_decode_nsec = saved[3];
+    free(mem);
+    return(ret);
+}
@@ -0,0 +1,56 @@
+#ifndef FS3_ERASURE_INCLUDED
+#define FS3_ERASURE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_erasure.h
+//  Description    : This is the interface for the erasure code that lets a
+//                   volume keep parity sectors on some of its servers and
+//                   rebuild what any of the others held.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+
+// Defines
+#define FS3_ERASURE_MAX_SHARDS 16  // Most data plus parity shards of a stripe
+
+//
+// The code
+//
+//   A stripe has data shards d0..dn-1 and parity shards p0..pm-1 of the
+//   same length. Parity shard j is the sum over GF(2^8) (polynomial 0x11d)
+//   of every data shard times a coefficient of a Cauchy matrix whose
+//   columns are scaled so that p0 is the plain XOR of the data. With a
+//   Cauchy matrix any n of the n+m shards are enough to get the data back.
+
+//
+// Global data
+extern long long fs3_erasure_encoded;     // Data bytes encoded
+extern long long fs3_erasure_decoded;     // Data bytes rebuilt
+extern long long fs3_erasure_encode_nsec; // Time spent encoding
+extern long long fs3_erasure_decode_nsec; // Time spent rebuilding
+
+//
+// Erasure Code Functions
+
+int fs3_erasure_init(int data, int parity);
+    // Set up the code for stripes of data + parity shards, 0 if successful
+
+int fs3_erasure_encode(uint8_t **data, uint8_t **parity, int len);
+    // Compute the parity shards of len bytes from the data shards
+
+int fs3_erasure_decode(uint8_t **shards, const int *present, int len);
+    // Rebuild every data shard (shards[0..data-1]) not present from any data of the present shards
+    // (data shards first, then parity), returns 0 if successful, -1 if too few are present
+
+const char *fs3_erasure_kernel(void);
+    // Name of the GF(2^8) kernel in use ("ssse3" or "scalar")
+
+int fs3_erasure_bench(int len, double *encode, double *decode);
+    // Measure encoding and rebuilding stripes of len byte shards, in GB/s of data
+
+#endif
@@ -0,0 +1,506 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_event.c
+//  Description    : This is the implementation of the event engine for the
+//                   FS3 network layer. It owns the client's server
+//                   connections while a batch is in flight: each connection
+//                   has a queue of requests, gathered into sendmsg calls as far
+//                   as its window and the socket allow, and a queue of
+//                   expected replies, scattered by recvmsg straight into the
+//                   callers' buffers. One epoll loop on the calling thread drives all
+//                   of them, so any number of connections overlap without a
+//                   thread per connection. The sockets stay blocking for the
+//                   rest of the network layer; the engine asks for
+//                   non-blocking transfers per call (MSG_DONTWAIT), and when a
+//                   single connection is all it waits on it simply blocks in
+//                   recvmsg instead of going through epoll. On a connection
+//                   with packed payloads a reply's length is in its block, so
+//                   no read goes past a block whose payload length is unknown.
+//                   A batch may give up on the rest of a connection's
+//                   requests (a hedged read answered elsewhere); replies
+//                   already owed for them are read into scratch space, in
+//                   later batches if need be, so the stream stays in step.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Project Includes
+#include <fs3_event.h>
+#include <fs3_network.h>
+#include <fs3_codec.h>
+
+//
+// Support Macros/Data
+
+typedef struct{
+    FS3CmdBlk cmd;           // the request (host order), it sizes both payloads
+    FS3CmdBlk blk;           // the request block as it goes on the wire
+    void *buf;               // request payload, or where the reply payload lands
+    FS3CmdBlk *ret;          // where the reply block lands
+    char *scratch;           // block and payload of a dropped request's reply, NULL if the caller's
+} EventOp;
+
+typedef struct{
+    int fd;
+    int quickack;            // TCP connection whose server may hold replies for an ack
+    int packed;              // the session packs payloads (replies say how long theirs are)
+    EventOp *ops;
+    int cap, count;          // ops[0 .. count) are queued
+    int sent, recvd;         // ops[0 .. sent) are written, ops[0 .. recvd) are answered
+    int stale;               // ops[0 .. stale) were dropped by earlier batches, their replies are still owed
+    int live;                // the batch waits for ops[0 .. live), the rest were dropped
+    size_t sendOff, recvOff; // bytes already moved of ops[sent] and ops[recvd]
+    int blocked;             // the last write would have blocked, wait for EPOLLOUT
+    uint32_t interest;       // epoll events asked for
+} EventConn;
+
+EventConn eventConns[FS3_EVENT_MAX_CONNECTIONS];
+int eventCount, eventFd = -1;
+long fs3_event_syscalls, fs3_event_wakeups, fs3_event_stalls;
+
+//
+// Implementation
+
+//microseconds on the monotonic clock
+uint64_t fs3_event_micros(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//drops the first off bytes of an iovec array, returns the entries left
+int skipVector(struct iovec *iov, int cnt, size_t off){
+    int i = 0;
+
+    while (i < cnt && off >= iov[i].iov_len){
+        off -= iov[i].iov_len;
+        i++;
+    }
+    if (i < cnt){
+        iov[i].iov_base = (char *)iov[i].iov_base + off;
+        iov[i].iov_len -= off;
+    }
+    memmove(iov, iov + i, (cnt - i) * sizeof(struct iovec));
+    return cnt - i;
+}
+
+//one sendmsg/recvmsg over an iovec array
+ssize_t moveVector(int fd, struct iovec *iov, int cnt, int out, int flags){
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+    fs3_event_syscalls++;
+    return out ? sendmsg(fd, &msg, flags | MSG_NOSIGNAL) : recvmsg(fd, &msg, flags);
+}
+
+//adds a block and its payload to an iovec array
+int addVector(struct iovec *iov, void *blk, void *buf, int len){
+    iov[0].iov_base = blk;
+    iov[0].iov_len = sizeof(FS3CmdBlk);
+    if (len == 0) return 1;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = len;
+    return 2;
+}
+
+//writes queued requests until the window is full, the queue is empty or the socket
+//would block; 0 if the connection is fine, -1 if it failed
+int pumpWrites(EventConn *conn, int window){
+    struct iovec iov[FS3_MAX_IOV];
+    EventOp *op;
+    ssize_t r;
+    int i, n, one = 1;
+
+    while (conn->sent < conn->count && conn->sent - conn->recvd < window){
+        for (i = conn->sent, n = 0; i < conn->count && i - conn->recvd < window && n + 2 <= FS3_MAX_IOV; i++){
+            n += addVector(&iov[n], &conn->ops[i].blk, conn->ops[i].buf, FS3_REQUEST_WIRE(conn->ops[i].cmd));
+        }
+        n = skipVector(iov, n, conn->sendOff);
+        r = moveVector(conn->fd, iov, n, 1, MSG_DONTWAIT);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            conn->blocked = 1;
+            return 0;
+        }
+        if (r <= 0) return -1;
+        conn->blocked = 0;
+
+        for (r += conn->sendOff, conn->sendOff = 0; r > 0; ){
+            op = &conn->ops[conn->sent];
+            if ((size_t)r < sizeof(FS3CmdBlk) + FS3_REQUEST_WIRE(op->cmd)){
+                conn->sendOff = r;
+                break;
+            }
+            r -= sizeof(FS3CmdBlk) + FS3_REQUEST_WIRE(op->cmd);
+            conn->sent++;
+        }
+
+        //a server that writes a reply as header then payload without TCP_NODELAY holds the
+        //payload until the header is acked, ack at once while more replies are due
+        if (conn->quickack && conn->sent - conn->recvd > 1){
+            setsockopt(conn->fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+            fs3_event_syscalls++;
+        }
+    }
+    if (conn->sent < conn->count) fs3_event_stalls++;
+    return 0;
+}
+
+//payload bytes of the reply to op given the first have bytes of it, -1 while they do not
+//include the block that says how long a packed payload is
+int replyWire(EventConn *conn, EventOp *op, size_t have){
+    if (!conn->packed || FS3_REPLY_PAYLOAD(op->cmd) == 0) return FS3_REPLY_PAYLOAD(op->cmd);
+    if (have < sizeof(FS3CmdBlk)) return -1;
+    return FS3_REPLY_WIRE(op->cmd, ntohll64(*op->ret));
+}
+
+//reads every reply that has arrived, or with block set waits for the next bytes and takes
+//what came; 0 if the connection is fine, -1 if it failed or closed
+int pumpReads(EventConn *conn, int block){
+    struct iovec iov[FS3_MAX_IOV];
+    EventOp *op;
+    ssize_t r;
+    int i, n, len;
+
+    while (conn->recvd < conn->sent){
+        for (i = conn->recvd, n = 0; i < conn->sent && n + 2 <= FS3_MAX_IOV; i++){
+            len = replyWire(conn, &conn->ops[i], (i == conn->recvd) ? conn->recvOff : 0);
+            n += addVector(&iov[n], conn->ops[i].ret, conn->ops[i].buf, (len < 0) ? 0 : len);
+            if (len < 0) break;
+        }
+        n = skipVector(iov, n, conn->recvOff);
+        r = moveVector(conn->fd, iov, n, 0, block ? 0 : MSG_DONTWAIT);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (r <= 0) return -1;
+
+        for (r += conn->recvOff, conn->recvOff = 0; r > 0; ){
+            op = &conn->ops[conn->recvd];
+            len = replyWire(conn, op, r);
+            if (len > 0 && !FS3_CODEC_FITS(len, FS3_REPLY_PAYLOAD(op->cmd))) return -1;
+            if (len < 0 || (size_t)r < sizeof(FS3CmdBlk) + len){
+                conn->recvOff = r;
+                break;
+            }
+            r -= sizeof(FS3CmdBlk) + len;
+            *op->ret = ntohll64(*op->ret);
+            free(op->scratch);
+            op->scratch = NULL;
+            conn->recvd++;
+        }
+        if (block) break;
+    }
+    return 0;
+}
+
+//asks epoll for what the connection is waiting on, replies are always of interest
+int watchConn(int slot){
+    EventConn *conn = &eventConns[slot];
+    struct epoll_event ev;
+    uint32_t want = EPOLLIN;
+
+    if (conn->blocked) want |= EPOLLOUT;
+    if (want == conn->interest) return 0;
+    ev.events = want;
+    ev.data.u32 = slot;
+    fs3_event_syscalls++;
+    if (epoll_ctl(eventFd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) return -1;
+    conn->interest = want;
+    return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_init
+// Description  : Create the epoll instance
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_event_init(void) {
+    if (eventFd != -1) fs3_event_close();
+    eventFd = epoll_create1(0);
+    if (eventFd == -1){
+        logMessage(LOG_ERROR_LEVEL, "FS3 event engine: cannot create the epoll instance");
+        return(-1);
+    }
+    eventCount = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_add
+// Description  : Hand a connected socket to the engine
+//
+// Inputs       : fd - the socket, -1 for a slot of a server that is down
+//                quickack - set for a TCP connection
+//                packed - set if the session packs payloads
+// Outputs      : the slot of the connection, -1 if failure
+
+int fs3_event_add(int fd, int quickack, int packed) {
+    EventConn *conn;
+    struct epoll_event ev;
+
+    if (eventFd == -1 || eventCount == FS3_EVENT_MAX_CONNECTIONS) return(-1);
+    ev.events = EPOLLIN;
+    ev.data.u32 = eventCount;
+    //a connection that is down (fd -1) only holds its slot, nothing is ever queued on it
+    if (fd != -1 && epoll_ctl(eventFd, EPOLL_CTL_ADD, fd, &ev) != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 event engine: cannot watch connection %d", eventCount);
+        return(-1);
+    }
+    conn = &eventConns[eventCount];
+    memset(conn, 0, sizeof(EventConn));
+    conn->fd = fd;
+    conn->quickack = quickack;
+    conn->packed = packed;
+    conn->interest = EPOLLIN;
+    return(eventCount++);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_submit
+// Description  : Queue a request on a connection, it goes out at the next wait
+//
+// Inputs       : conn - the slot of the connection
+//                cmd - the request (host byte order)
+//                buf - request payload / reply payload destination (as it goes on the wire)
+//                ret - receives the reply block (host byte order)
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_event_submit(int conn, FS3CmdBlk cmd, void *buf, FS3CmdBlk *ret) {
+    EventConn *c = &eventConns[conn];
+    EventOp *grown;
+
+    if (conn < 0 || conn >= eventCount) return(-1);
+    if (c->count == c->cap){
+        if ((grown = realloc(c->ops, (c->cap ? c->cap * 2 : 64) * sizeof(EventOp))) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "FS3 event engine: out of memory queueing a request");
+            return(-1);
+        }
+        c->ops = grown;
+        c->cap = c->cap ? c->cap * 2 : 64;
+    }
+    c->ops[c->count].cmd = cmd;
+    c->ops[c->count].blk = htonll64(cmd);
+    c->ops[c->count].buf = buf;
+    c->ops[c->count].scratch = NULL;
+    c->ops[c->count++].ret = ret;
+    c->live = c->count;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_run
+// Description  : Run the event loop until every queued request is answered,
+//                the time is up, or one connection got all of its replies
+//                while others still wait. Each connection answers in order,
+//                so its replies are matched to its requests by position.
+//
+// Inputs       : window - most requests in flight on one connection
+//                usec - longest time to run (milliseconds granularity), -1 for no limit
+// Outputs      : 0 if every request was answered, 1 if the loop stopped early,
+//                -1 if a connection failed
+
+int fs3_event_run(int window, long usec) {
+    struct epoll_event evs[FS3_EVENT_MAX_CONNECTIONS];
+    EventConn *conn;
+    int i, n, pending, waiting, last = 0, ret = 0;
+    uint64_t deadline = (usec >= 0) ? fs3_event_micros() + usec : 0, now;
+
+    for (i = 0; i < eventCount && ret == 0; i++){
+        if (pumpWrites(&eventConns[i], window) != 0) ret = -1;
+    }
+    for (i = 0, waiting = 0; i < eventCount; i++){
+        if (eventConns[i].recvd < eventConns[i].live) waiting++;
+    }
+
+    while (ret == 0){
+        for (i = 0, pending = 0; i < eventCount; i++){
+            if (eventConns[i].recvd < eventConns[i].live){
+                pending++;
+                last = i;
+            }
+        }
+        if (pending == 0) break;
+        if (pending < waiting) return(1);
+
+        //one connection with nothing it could write yet needs no epoll, it just waits for its replies
+        conn = &eventConns[last];
+        if (pending == 1 && !conn->blocked && usec < 0){
+            if (pumpReads(conn, 1) != 0 || pumpWrites(conn, window) != 0) ret = -1;
+            continue;
+        }
+
+        for (i = 0; i < eventCount && ret == 0; i++){
+            if (watchConn(i) != 0) ret = -1;
+        }
+        if (ret != 0) break;
+
+        now = fs3_event_micros();
+        if (usec >= 0 && now >= deadline) return(1);
+        n = epoll_wait(eventFd, evs, FS3_EVENT_MAX_CONNECTIONS, (usec < 0) ? -1 : (int)((deadline - now + 999) / 1000));
+        fs3_event_syscalls++;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0){
+            ret = -1;
+            break;
+        }
+        if (n > 0) fs3_event_wakeups++;
+        for (i = 0; i < n && ret == 0; i++){
+            conn = &eventConns[evs[i].data.u32];
+            if ((evs[i].events & (EPOLLERR | EPOLLHUP)) && !(evs[i].events & EPOLLIN)) ret = -1;
+            else if ((evs[i].events & EPOLLIN) && conn->recvd == conn->sent) ret = -1; //nothing is due, so a close
+            else if ((evs[i].events & EPOLLIN) && pumpReads(conn, 0) != 0) ret = -1;
+            else if (pumpWrites(conn, window) != 0) ret = -1; //answered requests free the window
+        }
+    }
+    if (ret != 0) logMessage(LOG_ERROR_LEVEL, "FS3 event engine: a server connection failed");
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_answered
+// Description  : Count the requests of this batch a connection has answered
+//
+// Inputs       : conn - the slot of the connection
+// Outputs      : the count, in the order they were queued
+
+int fs3_event_answered(int conn) {
+    EventConn *c = &eventConns[conn];
+    return((c->recvd > c->stale) ? c->recvd - c->stale : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_drop
+// Description  : Give up on the unanswered requests of this batch on a
+//                connection. Those not written yet never go out (one written
+//                in part is finished), the replies owed for the rest land in
+//                scratch space instead of the callers' buffers. Only requests
+//                without a payload (seeks and reads) may be dropped.
+//
+// Inputs       : conn - the slot of the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_event_drop(int conn) {
+    EventConn *c = &eventConns[conn];
+    EventOp *op;
+    size_t got;
+    int i;
+
+    c->count = c->sent + (c->sendOff > 0 ? 1 : 0);
+    c->live = c->recvd;
+    for (i = c->recvd; i < c->count; i++){
+        op = &c->ops[i];
+        if (op->scratch != NULL) continue;
+        if ((op->scratch = malloc(sizeof(FS3CmdBlk) + FS3_REPLY_PAYLOAD(op->cmd))) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "FS3 event engine: out of memory dropping a request");
+            return(-1);
+        }
+
+        //a reply already coming in moves to the scratch space with the bytes it has so far
+        got = (i == c->recvd) ? c->recvOff : 0;
+        if (got > 0) memcpy(op->scratch, op->ret, sizeof(FS3CmdBlk));
+        if (got > sizeof(FS3CmdBlk)) memcpy(op->scratch + sizeof(FS3CmdBlk), op->buf, got - sizeof(FS3CmdBlk));
+        op->ret = (FS3CmdBlk *)op->scratch;
+        op->buf = op->scratch + sizeof(FS3CmdBlk);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_wait
+// Description  : Run the event loop until every queued request is answered
+//                and end the batch; what earlier batches dropped but is still
+//                owed carries over to the next one
+//
+// Inputs       : window - most requests in flight on one connection
+// Outputs      : 0 if every request was answered, -1 if a connection failed
+
+int fs3_event_wait(int window) {
+    int ret;
+
+    while ((ret = fs3_event_run(window, -1)) == 1);
+    fs3_event_end(ret);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_end
+// Description  : End the batch, the queues start over with only the dropped
+//                requests still owed a reply
+//
+// Inputs       : failed - the batch failed, nothing carries over
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_event_end(int failed) {
+    EventConn *conn;
+    int i, n;
+
+    for (i = 0; i < eventCount; i++){
+        conn = &eventConns[i];
+        if (failed || conn->recvd < conn->live){
+            //after a failure nothing is owed any more, the connections are given up
+            for (n = conn->recvd; n < conn->count; n++) free(conn->ops[n].scratch);
+            conn->count = conn->sent = conn->recvd = 0;
+            conn->sendOff = conn->recvOff = 0;
+        } else{
+            memmove(conn->ops, conn->ops + conn->recvd, (conn->count - conn->recvd) * sizeof(EventOp));
+            conn->count -= conn->recvd;
+            conn->sent -= conn->recvd;
+            conn->recvd = 0;
+        }
+        conn->stale = conn->count;
+        conn->live = 0;
+        conn->blocked = 0;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_event_close
+// Description  : Drop every connection and the epoll instance
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_event_close(void) {
+    int i, n;
+
+    for (i = 0; i < eventCount; i++){
+        for (n = eventConns[i].recvd; n < eventConns[i].count; n++) free(eventConns[i].ops[n].scratch);
+        free(eventConns[i].ops);
+        memset(&eventConns[i], 0, sizeof(EventConn));
+    }
+    eventCount = 0;
+    if (eventFd != -1) close(eventFd);
+    eventFd = -1;
+    return(0);
+}
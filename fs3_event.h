@@ -0,0 +1,62 @@
+#ifndef FS3_EVENT_INCLUDED
+#define FS3_EVENT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_event.h
+//  Description    : This is the interface for the single-threaded, epoll
+//                   driven engine that moves pipelined FS3 requests over all
+//                   of the client's server connections at once.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_EVENT_MAX_CONNECTIONS 16 // Connections the engine can own
+
+//
+// Global Data
+extern long fs3_event_syscalls;  // Socket and epoll calls the engine made
+extern long fs3_event_wakeups;   // epoll_wait calls that returned events
+extern long fs3_event_stalls;    // Times a connection had requests held back by its window
+
+//
+// Event Engine Functions
+
+int fs3_event_init(void);
+    // Create the epoll instance (called once the connections are open)
+
+int fs3_event_add(int fd, int quickack, int packed);
+    // Hand a connected socket (-1 to only take a slot) to the engine (packed if its session packs payloads),
+    // returns its slot or -1
+
+int fs3_event_submit(int conn, FS3CmdBlk cmd, void *buf, FS3CmdBlk *ret);
+    // Queue a request on a connection, its reply block goes to ret and any payload to buf
+    // (payloads are moved as they are, packing them is up to the caller)
+
+int fs3_event_wait(int window);
+    // Run the loop until every queued request has its reply, at most window in flight per connection
+
+int fs3_event_run(int window, long usec);
+    // Run the loop for at most usec (-1 for no limit), returns 1 early when a connection has all its replies
+
+int fs3_event_answered(int conn);
+    // Requests of this batch a connection has answered so far
+
+int fs3_event_drop(int conn);
+    // Stop waiting for the rest of a connection's batch (seeks and reads only), their replies go to scratch
+
+int fs3_event_end(int failed);
+    // End a batch driven with fs3_event_run, only dropped requests still owed a reply carry over
+
+uint64_t fs3_event_micros(void);
+    // Microseconds on the monotonic clock
+
+int fs3_event_close(void);
+    // Drop every connection (the sockets stay open) and the epoll instance
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef FS3_IMAGE_INCLUDED
+#define FS3_IMAGE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_image.h
+//  Description    : This is the layout of a preloaded FS3 disk image, as
+//                   fs3_mkimage writes it and the driver reads it back at
+//                   mount.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_IMAGE_MAGIC 0x31474d4933534653ULL   // "SFS3IMG1" in little-endian byte order
+#define FS3_IMAGE_MAX_FILES 256                 // Most files an image holds (the driver keeps 300)
+#define FS3_IMAGE_NAME_LENGTH 128               // Path length, the driver's FS3_MAX_PATH_LENGTH
+#define FS3_IMAGE_FILE_SECTORS (FS3_TRACK_SIZE * 2) // Most sectors of one file, the driver's limit
+#define FS3_IMAGE_ENTRIES_PER_SECTOR ((int)(FS3_SECTOR_SIZE / sizeof(FS3ImageEntry)))
+#define FS3_IMAGE_TABLE_SECTORS ((FS3_IMAGE_MAX_FILES + FS3_IMAGE_ENTRIES_PER_SECTOR - 1) / FS3_IMAGE_ENTRIES_PER_SECTOR)
+
+//
+// The layout
+//
+//   Sectors are numbered in disk order, track * FS3_TRACK_SIZE + sector.
+//   Sector 0, which the driver never hands out, holds the header. The file
+//   table follows from sector 1, FS3_IMAGE_ENTRIES_PER_SECTOR entries to a
+//   sector, and then the files, each in consecutive sectors. The driver
+//   hands out new sectors from the header's next on, and the last track
+//   stays free for the write journal.
+
+// Type definitions
+typedef struct {
+    uint64_t magic;
+    uint32_t files;     // entries in the file table
+    uint32_t table;     // sectors the file table takes, from sector 1
+    uint32_t next;      // first sector past the files
+    uint32_t bytes;     // file bytes the image holds
+} FS3ImageHeader;
+
+typedef struct {
+    char name[FS3_IMAGE_NAME_LENGTH]; // the path workload lines name the file by
+    uint32_t length;    // bytes
+    uint32_t first;     // first sector of the file
+} FS3ImageEntry;
+
+#endif
@@ -0,0 +1,386 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_journal.c
+//  Description    : This is the implementation of the group-commit write
+//                   journal for the FS3 filesystem interface. The driver
+//                   hands it the sector images its writes produce; they
+//                   collect in an open group that goes to the journal area
+//                   as one record per group commit. The newest image of
+//                   every journaled sector stays in memory until a
+//                   checkpoint writes it home, so a sector rewritten by
+//                   many small appends reaches its home once.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Includes
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_journal.h>
+#include <fs3_sched.h>
+#include <fs3_network.h>
+#include <fs3_common.h>
+
+//
+// Support Macros/Data
+
+#define FS3_JOURNAL_FNV_BASIS 0xcbf29ce484222325ULL
+#define FS3_JOURNAL_FNV_PRIME 0x100000001b3ULL
+
+typedef struct{
+    uint64_t magic;
+    uint64_t epoch;          // the mount that wrote the record
+    uint64_t seq;            // one more than the record before it
+    uint64_t sum;            // FNV-1a of the header (sum 0) and the images
+    uint32_t count;          // images after the header
+    uint32_t writes;         // writes of the group
+    uint16_t home[FS3_JOURNAL_RECORD_MAX][2]; // track and sector of every image
+}JournalHeader;
+
+typedef struct{
+    uint16_t track;
+    uint16_t sector;
+    int open;                // changed since the last commit
+    char image[FS3_SECTOR_SIZE];
+}JournalEntry;
+
+int fs3_journal_group;
+
+//sectors the journal holds, journalMap gives entry + 1 of a volume sector (0 when not held)
+JournalEntry journalEntries[FS3_JOURNAL_SECTORS];
+int journalMap[FS3_VOLUME_TRACKS][FS3_TRACK_SIZE];
+int journalCount;
+
+//the open group: entries changed since the last commit and the writes that changed them
+int openEntries[FS3_JOURNAL_RECORD_MAX];
+int openCount, openWrites;
+
+//where the next record goes and what it is called
+FS3TrackIndex journalTrack;
+int journalHead;
+uint64_t journalEpoch, journalSeq;
+
+//a record on its way out or coming back in: header then images
+union{
+    JournalHeader header;
+    char sector[FS3_SECTOR_SIZE];
+}journalRecord;
+char journalImages[FS3_JOURNAL_RECORD_MAX][FS3_SECTOR_SIZE];
+
+long journalRecords, journalSectors, journalWrites, journalStores;
+long journalCheckpoints, journalHomeWrites, journalReplayed;
+
+//
+// Implementation
+
+//sum of a record, taken with its sum field at 0
+uint64_t recordSum(JournalHeader *hdr, int count){
+    uint64_t saved = hdr->sum, h = FS3_JOURNAL_FNV_BASIS;
+    const uint8_t *p;
+    int i, k;
+
+    hdr->sum = 0;
+    p = (const uint8_t *)hdr;
+    for(k = 0; k < FS3_SECTOR_SIZE; k++) h = (h ^ p[k]) * FS3_JOURNAL_FNV_PRIME;
+    for(i = 0; i < count; i++){
+        p = (const uint8_t *)journalImages[i];
+        for(k = 0; k < FS3_SECTOR_SIZE; k++) h = (h ^ p[k]) * FS3_JOURNAL_FNV_PRIME;
+    }
+    hdr->sum = saved;
+    return h;
+}
+
+//queues the transfer of the header sector at journal position pos (with header set) and of count images after it
+int queueJournal(uint8_t op, int pos, int header, int count){
+    int i;
+
+    for(i = header ? 0 : 1; i <= count; i++){
+        void *buf = (i == 0) ? journalRecord.sector : journalImages[i - 1];
+        if(fs3_sched_submit(op, journalTrack + (pos + i) / FS3_TRACK_SIZE, (pos + i) % FS3_TRACK_SIZE, buf, 0) != 0) return -1;
+    }
+    return 0;
+}
+
+//forgets every sector the journal holds and starts the next record at its first sector
+void resetJournal(void){
+    int i;
+
+    for(i = 0; i < journalCount; i++) journalMap[journalEntries[i].track][journalEntries[i].sector] = 0;
+    journalCount = openCount = 0;
+    journalHead = 0;
+}
+
+//writes every held image home, the caller has committed them all. Once they are there the header at
+//the start of the journal is zeroed, so a crash before the next commit does not replay the old chain
+//over sectors written outside the journal since (such as the homes of a server-side copy)
+int writeHome(void){
+    int i;
+
+    if(journalCount == 0) return 0;
+    for(i = 0; i < journalCount; i++){
+        if(fs3_sched_submit(FS3_OP_WRSECT, journalEntries[i].track, journalEntries[i].sector, journalEntries[i].image, 0) != 0) return -1;
+    }
+    if(fs3_sched_run() != 0) return -1;
+    memset(journalRecord.sector, 0, FS3_SECTOR_SIZE);
+    if(queueJournal(FS3_OP_WRSECT, 0, 1, 0) != 0 || fs3_sched_run() != 0) return -1;
+    journalCheckpoints++;
+    journalHomeWrites += journalCount;
+    logMessage(FS3DriverLLevel, "FS3 journal: checkpoint wrote %d sectors home", journalCount);
+    resetJournal();
+    return 0;
+}
+
+//reads the record at pos into journalRecord/journalImages, its image count if it follows prev, else -1
+int readRecord(int pos, int first, uint64_t prevEpoch, uint64_t prevSeq){
+    JournalHeader *hdr = &journalRecord.header;
+
+    if(queueJournal(FS3_OP_RDSECT, pos, 1, 0) != 0 || fs3_sched_run() != 0) return -1;
+    if(hdr->magic != FS3_JOURNAL_MAGIC || hdr->count < 1 || hdr->count > FS3_JOURNAL_RECORD_MAX ||
+            pos + 1 + (int)hdr->count > FS3_JOURNAL_SECTORS){
+        return -1;
+    }
+    if(!first && (hdr->epoch != prevEpoch || hdr->seq != prevSeq + 1)) return -1;
+
+    if(queueJournal(FS3_OP_RDSECT, pos, 0, hdr->count) != 0 || fs3_sched_run() != 0) return -1;
+    if(recordSum(hdr, hdr->count) != hdr->sum) return -1;
+    return hdr->count;
+}
+
+//the entry holding a sector, a new one if there is none
+int entryOf(FS3TrackIndex trk, FS3SectorIndex sct){
+    int e = journalMap[trk][sct] - 1;
+
+    if(e >= 0) return e;
+    e = journalCount++;
+    journalEntries[e].track = trk;
+    journalEntries[e].sector = sct;
+    journalEntries[e].open = 0;
+    journalMap[trk][sct] = e + 1;
+    return e;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_init
+// Description  : Find the journal, replay the records a crash left in it and
+//                start it empty
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_init(void) {
+    JournalHeader *hdr = &journalRecord.header;
+    uint64_t epoch = 0, seq = 0;
+    struct timespec ts;
+    int pos = 0, count, i, e, records = 0;
+
+    journalTrack = network_volume_tracks() - FS3_JOURNAL_TRACKS;
+    resetJournal();
+
+    //the chain starts at the first sector and ends at the first record that does not follow on
+    while(pos < FS3_JOURNAL_SECTORS && (count = readRecord(pos, records == 0, epoch, seq)) > 0){
+        for(i = 0; i < count; i++){
+            if(hdr->home[i][0] >= journalTrack || hdr->home[i][1] >= FS3_TRACK_SIZE) break;
+            e = entryOf(hdr->home[i][0], hdr->home[i][1]);
+            memcpy(journalEntries[e].image, journalImages[i], FS3_SECTOR_SIZE);
+        }
+        if(i < count){
+            logMessage(LOG_ERROR_LEVEL, "FS3 journal: record %lu at %d names a sector outside the volume", (unsigned long)hdr->seq, pos);
+            return(-1);
+        }
+        epoch = hdr->epoch;
+        seq = hdr->seq;
+        records++;
+        pos += 1 + count;
+    }
+    journalReplayed += records;
+
+    //what was replayed goes home, then the old chain is cut so it is not replayed again
+    if(records > 0){
+        logMessage(LOG_OUTPUT_LEVEL, "FS3 journal: replaying records %lu-%lu (%d sectors) left at track %d",
+                (unsigned long)(seq - records + 1), (unsigned long)seq, journalCount, journalTrack);
+        if(writeHome() != 0 || fs3_journal_close() != 0) return(-1);
+    }
+
+    //a fresh epoch keeps the records of earlier mounts out of this mount's chain
+    clock_gettime(CLOCK_REALTIME, &ts);
+    journalEpoch = ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec) ^ ((uint64_t)getpid() << 40);
+    journalSeq = 1;
+    openWrites = 0;
+    logMessage(FS3DriverLLevel, "FS3 journal: %d sectors at track %d, group commit every %d writes",
+            FS3_JOURNAL_SECTORS, journalTrack, fs3_journal_group);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_store
+// Description  : Take the new image of a sector into the open group
+//
+// Inputs       : trk - the track of the sector
+//                sct - the sector
+//                buf - the new contents (copied)
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_store(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    int e;
+
+    if(trk >= journalTrack || sct >= FS3_TRACK_SIZE){
+        logMessage(LOG_ERROR_LEVEL, "FS3 journal: sector %d/%d is not below the journal", trk, sct);
+        return(-1);
+    }
+    journalStores++;
+
+    //a sector the open group already has just takes the newer image
+    e = journalMap[trk][sct] - 1;
+    if(e >= 0 && journalEntries[e].open){
+        memcpy(journalEntries[e].image, buf, FS3_SECTOR_SIZE);
+        return(0);
+    }
+
+    //a full header closes the group early
+    if(openCount == FS3_JOURNAL_RECORD_MAX && fs3_journal_commit() != 0) return(-1);
+
+    e = entryOf(trk, sct);
+    memcpy(journalEntries[e].image, buf, FS3_SECTOR_SIZE);
+    journalEntries[e].open = 1;
+    openEntries[openCount++] = e;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_lookup
+// Description  : Newest image of a sector not written home yet
+//
+// Inputs       : trk - the track of the sector
+//                sct - the sector
+// Outputs      : pointer to the image, NULL if the journal does not hold it
+
+void * fs3_journal_lookup(FS3TrackIndex trk, FS3SectorIndex sct) {
+    int e;
+
+    if(trk >= FS3_VOLUME_TRACKS || sct >= FS3_TRACK_SIZE) return(NULL);
+    e = journalMap[trk][sct] - 1;
+    return (e >= 0) ? journalEntries[e].image : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_written
+// Description  : Count a finished write, commit the open group once it is full
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_written(void) {
+    openWrites++;
+    journalWrites++;
+    if(openWrites >= fs3_journal_group) return(fs3_journal_commit());
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_commit
+// Description  : Write the open group to the journal as one record
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_commit(void) {
+    JournalHeader *hdr = &journalRecord.header;
+    int i;
+
+    if(openCount == 0){
+        openWrites = 0;
+        return(0);
+    }
+
+    memset(journalRecord.sector, 0, FS3_SECTOR_SIZE);
+    hdr->magic = FS3_JOURNAL_MAGIC;
+    hdr->epoch = journalEpoch;
+    hdr->seq = journalSeq;
+    hdr->count = openCount;
+    hdr->writes = openWrites;
+    for(i = 0; i < openCount; i++){
+        JournalEntry *ent = &journalEntries[openEntries[i]];
+        hdr->home[i][0] = ent->track;
+        hdr->home[i][1] = ent->sector;
+        memcpy(journalImages[i], ent->image, FS3_SECTOR_SIZE);
+    }
+    hdr->sum = recordSum(hdr, openCount);
+
+    //header and images go out together, the sum tells a torn record from a whole one
+    if(queueJournal(FS3_OP_WRSECT, journalHead, 1, openCount) != 0 || fs3_sched_run() != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 journal: failed writing record %lu", (unsigned long)journalSeq);
+        return(-1);
+    }
+    for(i = 0; i < openCount; i++) journalEntries[openEntries[i]].open = 0;
+    logMessage(FS3DriverLLevel, "FS3 journal: record %lu at %d, %d sectors for %d writes",
+            (unsigned long)journalSeq, journalHead, openCount, openWrites);
+
+    journalRecords++;
+    journalSectors += openCount;
+    journalHead += 1 + openCount;
+    journalSeq++;
+    openCount = openWrites = 0;
+
+    //the next record must always fit, so the sectors go home while there is room for one more
+    if(FS3_JOURNAL_SECTORS - journalHead < 1 + FS3_JOURNAL_RECORD_MAX) return(writeHome());
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_checkpoint
+// Description  : Commit, then write every sector the journal holds home
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_checkpoint(void) {
+    if(fs3_journal_commit() != 0) return(-1);
+    return(writeHome());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_close
+// Description  : Checkpoint and mark the journal empty on disk
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_close(void) {
+    if(fs3_journal_checkpoint() != 0) return(-1);
+    memset(journalRecord.sector, 0, FS3_SECTOR_SIZE);
+    if(queueJournal(FS3_OP_WRSECT, 0, 1, 0) != 0) return(-1);
+    return(fs3_sched_run());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_journal_metrics
+// Description  : Log the metrics for the journal
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_journal_metrics(void) {
+    logMessage(LOG_OUTPUT_LEVEL, "Journal records  [     %ld]", journalRecords);
+    logMessage(LOG_OUTPUT_LEVEL, "Writes per group [     %.2f]", journalRecords ? journalWrites / (float)journalRecords : 0.0);
+    logMessage(LOG_OUTPUT_LEVEL, "Journal sectors  [     %ld]", journalSectors);
+    logMessage(LOG_OUTPUT_LEVEL, "Images coalesced [     %ld]", journalStores - journalSectors - openCount);
+    logMessage(LOG_OUTPUT_LEVEL, "Checkpoints      [     %ld]", journalCheckpoints);
+    logMessage(LOG_OUTPUT_LEVEL, "Home writes      [     %ld]", journalHomeWrites);
+    logMessage(LOG_OUTPUT_LEVEL, "Replayed records [     %ld]", journalReplayed);
+    return(0);
+}
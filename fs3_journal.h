@@ -0,0 +1,81 @@
+#ifndef FS3_JOURNAL_INCLUDED
+#define FS3_JOURNAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_journal.h
+//  Description    : This is the interface for the write journal that makes
+//                   the sectors of many small writes durable together and
+//                   moves them to their homes later.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_JOURNAL_TRACKS 1                    // Tracks at the end of the volume the journal takes
+#define FS3_JOURNAL_SECTORS (FS3_JOURNAL_TRACKS * FS3_TRACK_SIZE)
+#define FS3_JOURNAL_MAGIC 0x314c4e524a334653ULL // "SF3JRNL1" in little-endian byte order
+#define FS3_JOURNAL_RECORD_MAX ((FS3_SECTOR_SIZE - 40) / 4) // Sectors a record carries (its header lists their homes)
+#define FS3_JOURNAL_MAX_GROUP 1024              // Most writes a group commit can be asked to wait for
+
+//
+// The journal
+//
+//   The journal is an append-only run of records on the last track(s) of
+//   the volume. A record is a header sector followed by the images of the
+//   sectors a group of writes changed:
+//
+//     magic | epoch | seq | sum | count | writes | count x (track, sector)
+//
+//   epoch is drawn at mount, seq counts the records of a mount up from the
+//   one at the start of the journal, and sum is an FNV-1a hash over the
+//   header (sum 0) and the images, so a torn record does not check out.
+//   Records of a group go out in one batch; once it is back, the writes of
+//   the group are durable. Their homes are only written at a checkpoint,
+//   when the journal runs short of space, before a server-side copy and at
+//   unmount, after which the journal starts over at its first sector. At
+//   mount the chain of records that check out, starting at the first
+//   sector, is applied in order, so after a crash the disk holds the
+//   writes up to some group commit and none after it.
+//
+//   Only sector images are journaled. The file table (names, lengths and
+//   sector maps) lives in the driver's memory and is neither journaled nor
+//   written to the disk, so after a crash only replayed writes into the
+//   sectors of files of an image loaded with -M can be reached by name.
+
+//
+// Global data
+extern int fs3_journal_group;    // Writes a group commit waits for, 0 when the journal is off
+
+//
+// Journal Functions
+
+int fs3_journal_init(void);
+    // Find the journal, replay the records a crash left in it and start it empty (called at mount)
+
+int fs3_journal_store(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+    // Take the new image of a sector into the open group (buf is copied)
+
+void * fs3_journal_lookup(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Newest image of a sector not written home yet (NULL if the journal does not hold it)
+
+int fs3_journal_written(void);
+    // Count a finished write, commits the open group once it holds fs3_journal_group of them
+
+int fs3_journal_commit(void);
+    // Write the open group to the journal, its writes are durable once this returns 0
+
+int fs3_journal_checkpoint(void);
+    // Commit, write every sector the journal holds home and empty the journal
+
+int fs3_journal_close(void);
+    // Checkpoint and mark the journal empty on disk (called at unmount)
+
+int fs3_log_journal_metrics(void);
+    // Log the metrics for the journal
+
+#endif
@@ -0,0 +1,562 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_loadgen.c
+//  Description    : This is the main program of a load generator for FS3
+//                   servers. It opens one session per simulated client,
+//                   each on its own connection and thread, and has every
+//                   client send a mix of TSEEK, RDSECT and WRSECT requests,
+//                   either as fast as the replies come back (closed loop)
+//                   or at a fixed rate (open loop). It runs one step per
+//                   client count and reports the throughput of all clients,
+//                   the latency percentiles of every opcode and how evenly
+//                   the server shared itself among the clients.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define FS3_LOADGEN_ARGUMENTS "hvl:i:p:u:c:d:m:r:s:"
+#define FS3_LOADGEN_MAX_CLIENTS 256       // Most clients one step runs
+#define FS3_LOADGEN_MAX_STEPS 32          // Most client counts one run steps through
+#define FS3_LOADGEN_DEFAULT_STEPS "1,2,4,8,16,32,64,128,256"
+#define FS3_LOADGEN_KINDS 3               // The opcodes sent: TSEEK, RDSECT, WRSECT
+#define FS3_LOADGEN_SUBBUCKETS 8          // Latency buckets per octave
+#define FS3_LOADGEN_BUCKETS (27 * FS3_LOADGEN_SUBBUCKETS) // From 1 usec to about a minute
+#define USAGE \
+	"USAGE: fs3_loadgen [-h] [-v] [-l <logfile>] [-i <server ip>] [-p <port>] [-u <path>] [-c <clients>[,<clients>...]]\n" \
+	"                   [-d <seconds>] [-m <seek>:<read>:<write>] [-r <ops/s>] [-s <seed>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -i - IP address of the server (127.0.0.1 by default)\n" \
+	"    -p - port number of the server (22887 by default)\n" \
+	"    -u - connect to the server's Unix domain socket <path> instead\n" \
+	"    -c - client counts to step through (" FS3_LOADGEN_DEFAULT_STEPS " by default, at most 256)\n" \
+	"    -d - seconds every step runs for (2 by default)\n" \
+	"    -m - relative weights of seeks, sector reads and sector writes (10:60:30 by default)\n" \
+	"    -r - send <ops/s> requests per client on a fixed schedule (0, the default, sends the next once the reply is in)\n" \
+	"    -s - seed of the random tracks, sectors and opcodes\n" \
+	"\n" \
+
+// One simulated client: its session, the requests it sent and their latencies
+typedef struct {
+	int id;
+	int fd;
+	int mounted;                  // the session is up, the client takes part in the step
+	int track;                    // the track its head is on
+	unsigned int seed;
+	long ops[FS3_LOADGEN_KINDS];  // requests answered in the step
+	long errors;                  // replies with the return bit set
+	long late;                    // open loop: requests sent more than an interval behind schedule
+	long hist[FS3_LOADGEN_KINDS][FS3_LOADGEN_BUCKETS]; // latencies, bucket b below loadBound(b) microseconds
+	pthread_t thread;
+} FS3LoadClient;
+
+// What a step measured, kept for the summary at the end
+typedef struct {
+	int clients;
+	long ops;
+	double rate;                  // ops/s of all clients
+	uint64_t p99[FS3_LOADGEN_KINDS];
+	double jain;                  // Jain's fairness index over the clients' ops
+} FS3LoadStep;
+
+//
+// Global Data
+char *fs3LoadAddress = FS3_DEFAULT_IP;
+unsigned short fs3LoadPort = FS3_DEFAULT_PORT;
+char *fs3LoadUnixPath = NULL;             // connect here instead of over TCP
+long fs3LoadSeconds = 2;                  // length of a step
+long fs3LoadRate = 0;                     // requests per second per client, 0 for closed loop
+int fs3LoadMix[FS3_LOADGEN_KINDS] = { 10, 60, 30 };
+unsigned int fs3LoadSeed = 0;
+volatile int fs3LoadStop = 0;             // the step is over, clients unmount
+pthread_barrier_t fs3LoadStart;           // clients are mounted, the step starts
+int fs3LoadOps[FS3_LOADGEN_KINDS] = { FS3_OP_TSEEK, FS3_OP_RDSECT, FS3_OP_WRSECT };
+char *fs3LoadNames[FS3_LOADGEN_KINDS] = { "seek", "read", "write" };
+FS3LoadClient fs3LoadClients[FS3_LOADGEN_MAX_CLIENTS];
+
+//
+// Functional Prototypes
+
+int mount_client(FS3LoadClient *cl); // Connect a client and mount its session
+void *client_thread(void *arg);      // Send requests until the step is over, then unmount
+int run_step(int clients, FS3LoadStep *step);
+	// Run one step with this many clients and log what it measured
+
+//
+// Functions
+
+//current time in microseconds
+uint64_t nowMicros(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//upper end of latency bucket b in microseconds, FS3_LOADGEN_SUBBUCKETS buckets to an octave
+uint64_t loadBound(int b) {
+	int octave = b / FS3_LOADGEN_SUBBUCKETS, sub = b % FS3_LOADGEN_SUBBUCKETS;
+	return (((uint64_t)1 << octave) * (FS3_LOADGEN_SUBBUCKETS + sub + 1)) / FS3_LOADGEN_SUBBUCKETS;
+}
+
+//the bucket of a latency of us microseconds
+int loadBucket(uint64_t us) {
+	int b = 0;
+	while (b < FS3_LOADGEN_BUCKETS - 1 && us >= loadBound(b)) b++;
+	return(b);
+}
+
+//the latency below which permille thousandths of the total counts of hist fall
+uint64_t loadPercentile(long *hist, long total, int permille) {
+	long seen = 0;
+	int b;
+
+	if (total == 0) return(0);
+	for (b = 0; b < FS3_LOADGEN_BUCKETS - 1; b++) {
+		seen += hist[b];
+		if (seen * 1000 >= total * permille) break;
+	}
+	return(loadBound(b));
+}
+
+//reads exactly len bytes, 0 on success, -1 on error or end of stream
+int readExactly(int fd, void *buf, int len) {
+	int got = 0, r;
+	while (got < len) {
+		r = read(fd, (char *)buf + got, len - got);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return(-1);
+		got += r;
+	}
+	return(0);
+}
+
+//writes exactly len bytes, 0 on success, -1 on error
+int writeExactly(int fd, void *buf, int len) {
+	int put = 0, w;
+	while (put < len) {
+		w = write(fd, (char *)buf + put, len - put);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) return(-1);
+		put += w;
+	}
+	return(0);
+}
+
+//opens a connection to the server, over its Unix domain socket with -u; -1 on failure
+int openServer(void) {
+	struct sockaddr_in v4;
+	struct sockaddr_un un;
+	int fd, one = 1;
+
+	if (fs3LoadUnixPath != NULL) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strncpy(un.sun_path, fs3LoadUnixPath, sizeof(un.sun_path) - 1);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) return(-1);
+		if (connect(fd, (struct sockaddr *)&un, sizeof(un)) != 0) {
+			close(fd);
+			return(-1);
+		}
+		return(fd);
+	}
+	memset(&v4, 0, sizeof(v4));
+	v4.sin_family = AF_INET;
+	v4.sin_port = htons(fs3LoadPort);
+	v4.sin_addr.s_addr = inet_addr(fs3LoadAddress);
+	if ((fd = socket(PF_INET, SOCK_STREAM, 0)) == -1) return(-1);
+	if (connect(fd, (struct sockaddr *)&v4, sizeof(v4)) != 0) {
+		close(fd);
+		return(-1);
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return(fd);
+}
+
+//sends one request (a WRSECT carries buf) and reads its reply (a RDSECT's sector into buf);
+//the reply block in host order, or -1 if the connection is gone
+int64_t sendRequest(int fd, int op, int trk, int sct, char *buf) {
+	FS3CmdBlk cmd, wire;
+	char msg[sizeof(FS3CmdBlk) + FS3_SECTOR_SIZE];
+	int len = sizeof(FS3CmdBlk);
+
+	cmd = ((FS3CmdBlk)op << 60) | ((FS3CmdBlk)sct << 44) | ((FS3CmdBlk)trk << 12);
+	wire = htonll64(cmd);
+	memcpy(msg, &wire, sizeof(FS3CmdBlk));
+	if (FS3_REQUEST_PAYLOAD(cmd)) {
+		memcpy(msg + len, buf, FS3_SECTOR_SIZE);
+		len += FS3_SECTOR_SIZE;
+	}
+	if (writeExactly(fd, msg, len) != 0) return(-1);
+	if (op == FS3_OP_UMOUNT) return(0);
+	if (readExactly(fd, &wire, sizeof(FS3CmdBlk)) != 0) return(-1);
+	wire = ntohll64(wire);
+	if (FS3_REPLY_PAYLOAD(cmd) && readExactly(fd, buf, FS3_SECTOR_SIZE) != 0) return(-1);
+	return((int64_t)(wire & ~FS3_CMD_WIRE_MASK));
+}
+
+//picks the next opcode by the weights of the mix
+int pickKind(unsigned int *seed) {
+	int total = fs3LoadMix[0] + fs3LoadMix[1] + fs3LoadMix[2], r, k;
+
+	r = rand_r(seed) % total;
+	for (k = 0; k < FS3_LOADGEN_KINDS - 1; k++) {
+		if (r < fs3LoadMix[k]) break;
+		r -= fs3LoadMix[k];
+	}
+	return(k);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 load generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, steps = 0, i;
+	int counts[FS3_LOADGEN_MAX_STEPS];
+	char *list = FS3_LOADGEN_DEFAULT_STEPS, *tok, *save, *copy;
+	FS3LoadStep results[FS3_LOADGEN_MAX_STEPS];
+
+	// Process the command line parameters
+	fs3LoadSeed = (unsigned int)nowMicros();
+	while ((ch = getopt(argc, argv, FS3_LOADGEN_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'i': // Set the server address
+			if ( inet_addr(optarg) == INADDR_NONE ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", optarg );
+				return(-1);
+			}
+			fs3LoadAddress = optarg;
+			break;
+
+		case 'p': // Set the server port
+			if ( sscanf(optarg, "%hu", &fs3LoadPort) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'u': // Set the Unix domain socket
+			fs3LoadUnixPath = optarg;
+			break;
+
+		case 'c': // Set the client counts
+			list = optarg;
+			break;
+
+		case 'd': // Set the length of a step
+			if ( sscanf(optarg, "%ld", &fs3LoadSeconds) != 1 || fs3LoadSeconds < 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad step length [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'm': // Set the mix of opcodes
+			if ( sscanf(optarg, "%d:%d:%d", &fs3LoadMix[0], &fs3LoadMix[1], &fs3LoadMix[2]) != 3 ||
+					fs3LoadMix[0] < 0 || fs3LoadMix[1] < 0 || fs3LoadMix[2] < 0 ||
+					fs3LoadMix[1] + fs3LoadMix[2] == 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad mix [%s], must be <seek>:<read>:<write> with some reads or writes", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'r': // Set the rate of every client
+			if ( sscanf(optarg, "%ld", &fs3LoadRate) != 1 || fs3LoadRate < 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad rate [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 's': // Set the seed
+			if ( sscanf(optarg, "%u", &fs3LoadSeed) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad seed [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel);
+	}
+
+	// The client counts to step through
+	if ( (copy = strdup(list)) == NULL ) return( -1 );
+	for ( tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save) ) {
+		if ( steps == FS3_LOADGEN_MAX_STEPS || sscanf(tok, "%d", &counts[steps]) != 1 ||
+				counts[steps] < 1 || counts[steps] > FS3_LOADGEN_MAX_CLIENTS ) {
+			logMessage( LOG_ERROR_LEVEL, "Bad client counts [%s], must be up to %d counts of 1-%d",
+				list, FS3_LOADGEN_MAX_STEPS, FS3_LOADGEN_MAX_CLIENTS );
+			free(copy);
+			return( -1 );
+		}
+		steps++;
+	}
+	free(copy);
+	signal(SIGPIPE, SIG_IGN);
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 loadgen against %s%s%d, mix %d:%d:%d (seek:read:write), %ld s a step, %s",
+		fs3LoadUnixPath ? fs3LoadUnixPath : fs3LoadAddress, fs3LoadUnixPath ? "" : ":",
+		fs3LoadUnixPath ? -1 : fs3LoadPort, fs3LoadMix[0], fs3LoadMix[1], fs3LoadMix[2], fs3LoadSeconds,
+		fs3LoadRate ? "open loop" : "closed loop" );
+	if ( fs3LoadRate ) {
+		logMessage( LOG_OUTPUT_LEVEL, "FS3 loadgen: every client sends %ld requests/s", fs3LoadRate );
+	}
+
+	// One step per client count
+	for ( i = 0; i < steps; i++ ) {
+		if ( run_step(counts[i], &results[i]) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 loadgen: step with %d clients failed, stopping", counts[i] );
+			steps = i;
+			break;
+		}
+	}
+
+	// How throughput, tail latency and fairness scale with the clients
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 loadgen scaling:" );
+	logMessage( LOG_OUTPUT_LEVEL, "  clients        ops/s  seek p99  read p99  write p99 (usec)  fairness" );
+	for ( i = 0; i < steps; i++ ) {
+		logMessage( LOG_OUTPUT_LEVEL, "  %7d %12.0f  %8llu  %8llu  %9llu         %9.3f", results[i].clients, results[i].rate,
+			(unsigned long long)results[i].p99[0], (unsigned long long)results[i].p99[1],
+			(unsigned long long)results[i].p99[2], results[i].jain );
+	}
+	return( steps > 0 ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : run_step
+// Description  : Mount a session for each of the clients, let them all send
+//                requests for fs3LoadSeconds, then log the throughput, the
+//                latency percentiles of every opcode and the fairness
+//
+// Inputs       : clients - the number of clients
+//                step - receives what the step measured
+// Outputs      : 0 if successful, -1 if no client could mount
+
+int run_step(int clients, FS3LoadStep *step) {
+	FS3LoadClient *cl;
+	long hist[FS3_LOADGEN_KINDS][FS3_LOADGEN_BUCKETS], ops, total = 0, errors = 0, late = 0, least = -1, most = 0;
+	double sum = 0, squares = 0, elapsed;
+	uint64_t start;
+	int i, k, b, mounted;
+
+	memset(fs3LoadClients, 0, sizeof(FS3LoadClient) * clients);
+	memset(hist, 0, sizeof(hist));
+	fs3LoadStop = 0;
+
+	// The sessions are mounted one after the other, so the server's accept backlog never
+	// overflows, and a server that takes one connection at a time ends it after the first
+	for ( mounted = 0; mounted < clients; mounted++ ) {
+		cl = &fs3LoadClients[mounted];
+		cl->id = mounted;
+		cl->seed = fs3LoadSeed ^ (unsigned int)(clients * 7919 + mounted);
+		if ( mount_client(cl) != 0 ) break;
+	}
+	if ( mounted == 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 loadgen: none of %d clients could mount a session", clients );
+		return( -1 );
+	}
+	if ( mounted < clients ) {
+		logMessage( LOG_WARNING_LEVEL, "FS3 loadgen: only %d of %d clients could mount a session", mounted, clients );
+	}
+	pthread_barrier_init(&fs3LoadStart, NULL, mounted + 1);
+	for ( i = 0; i < mounted; i++ ) {
+		if ( pthread_create(&fs3LoadClients[i].thread, NULL, client_thread, &fs3LoadClients[i]) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 loadgen: cannot start a thread for client %d", i );
+			exit( -1 );
+		}
+	}
+
+	// Every client is ready before the clock starts
+	pthread_barrier_wait(&fs3LoadStart);
+	start = nowMicros();
+	usleep(fs3LoadSeconds * 1000000);
+	fs3LoadStop = 1;
+	elapsed = (nowMicros() - start) / 1000000.0;
+	for ( i = 0; i < mounted; i++ ) {
+		pthread_join(fs3LoadClients[i].thread, NULL);
+	}
+	pthread_barrier_destroy(&fs3LoadStart);
+
+	// Sum up the clients that took part
+	for ( i = 0; i < mounted; i++ ) {
+		cl = &fs3LoadClients[i];
+		for ( k = 0, ops = 0; k < FS3_LOADGEN_KINDS; k++ ) {
+			ops += cl->ops[k];
+			for ( b = 0; b < FS3_LOADGEN_BUCKETS; b++ ) hist[k][b] += cl->hist[k][b];
+		}
+		total += ops;
+		errors += cl->errors;
+		late += cl->late;
+		sum += ops;
+		squares += (double)ops * ops;
+		if ( least < 0 || ops < least ) least = ops;
+		if ( ops > most ) most = ops;
+	}
+
+	step->clients = mounted;
+	step->ops = total;
+	step->rate = total / elapsed;
+	step->jain = (squares > 0) ? (sum * sum) / (mounted * squares) : 1.0;
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 loadgen: %d clients, %ld ops in %.2f s, %.0f ops/s%s",
+		mounted, total, elapsed, step->rate, errors ? "" : ", no errors" );
+	if ( errors ) {
+		logMessage( LOG_WARNING_LEVEL, "FS3 loadgen: %ld requests failed", errors );
+	}
+	if ( fs3LoadRate ) {
+		logMessage( LOG_OUTPUT_LEVEL, "  target %ld ops/s, %ld requests went out more than an interval late", fs3LoadRate * mounted, late );
+	}
+	for ( k = 0; k < FS3_LOADGEN_KINDS; k++ ) {
+		for ( b = 0, ops = 0; b < FS3_LOADGEN_BUCKETS; b++ ) ops += hist[k][b];
+		step->p99[k] = loadPercentile(hist[k], ops, 990);
+		logMessage( LOG_OUTPUT_LEVEL, "  %-5s %9ld ops  p50 %6llu  p90 %6llu  p99 %6llu  p99.9 %6llu usec", fs3LoadNames[k], ops,
+			(unsigned long long)loadPercentile(hist[k], ops, 500), (unsigned long long)loadPercentile(hist[k], ops, 900),
+			(unsigned long long)step->p99[k], (unsigned long long)loadPercentile(hist[k], ops, 999) );
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "  fairness %.3f (Jain), per client %.0f-%.0f ops/s", step->jain, least / elapsed, most / elapsed );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mount_client
+// Description  : Connect a client to the server, mount its session and put
+//                its head on a random track
+//
+// Inputs       : cl - the client
+// Outputs      : 0 if successful, -1 if failure
+
+int mount_client(FS3LoadClient *cl) {
+	char buf[FS3_SECTOR_SIZE];
+	struct timeval wait = { FS3_POOL_MOUNT_WAIT, 0 }, forever = { 0, 0 };
+	int64_t reply;
+
+	// A server that takes one connection at a time never answers the MOUNT of a second one
+	cl->track = rand_r(&cl->seed) % FS3_MAX_TRACKS;
+	if ( (cl->fd = openServer()) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 loadgen: client %d cannot reach the server [%s]", cl->id, strerror(errno) );
+		return( -1 );
+	}
+	setsockopt(cl->fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+	cl->mounted = ((reply = sendRequest(cl->fd, FS3_OP_MOUNT, 0, 0, buf)) != -1) && !FS3_CMD_RETURN(reply) &&
+		((reply = sendRequest(cl->fd, FS3_OP_TSEEK, cl->track, 0, buf)) != -1) && !FS3_CMD_RETURN(reply);
+	setsockopt(cl->fd, SOL_SOCKET, SO_RCVTIMEO, &forever, sizeof(forever));
+	if ( !cl->mounted ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 loadgen: client %d cannot mount a session", cl->id );
+		close(cl->fd);
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_thread
+// Description  : Wait for the step to start, then send requests of the mix
+//                until it is over and unmount. Closed loop sends the next
+//                request once the reply is in; open loop sends them on a
+//                fixed schedule, and a request's latency counts from when
+//                it was due, so time spent behind schedule is not lost.
+//
+// Inputs       : arg - the client, mounted
+// Outputs      : NULL
+
+void *client_thread(void *arg) {
+	FS3LoadClient *cl = arg;
+	char buf[FS3_SECTOR_SIZE];
+	uint64_t due = 0, now, interval = fs3LoadRate ? 1000000 / fs3LoadRate : 0;
+	int64_t reply;
+	int i, k, trk = cl->track, sct;
+
+	for ( i = 0; i < FS3_SECTOR_SIZE; i++ ) buf[i] = (char)rand_r(&cl->seed);
+	pthread_barrier_wait(&fs3LoadStart);
+
+	// Spread the clients' schedules over one interval so they do not all send at once
+	if ( interval ) due = nowMicros() + rand_r(&cl->seed) % interval;
+	while ( !fs3LoadStop ) {
+		if ( interval ) {
+			now = nowMicros();
+			if ( due > now ) usleep(due - now);
+			else if ( now - due > interval ) cl->late++;
+		} else {
+			due = nowMicros();
+		}
+		k = pickKind(&cl->seed);
+		if ( fs3LoadOps[k] == FS3_OP_TSEEK ) {
+			trk = rand_r(&cl->seed) % FS3_MAX_TRACKS;
+			sct = 0;
+		} else {
+			sct = rand_r(&cl->seed) % FS3_TRACK_SIZE;
+		}
+		if ( (reply = sendRequest(cl->fd, fs3LoadOps[k], trk, sct, buf)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 loadgen: client %d lost its connection", cl->id );
+			break;
+		}
+		if ( FS3_CMD_RETURN(reply) ) cl->errors++;
+		cl->hist[k][loadBucket(nowMicros() - due)]++;
+		cl->ops[k]++;
+		due += interval;
+	}
+
+	sendRequest(cl->fd, FS3_OP_UMOUNT, 0, 0, buf);
+	close(cl->fd);
+	return(NULL);
+}
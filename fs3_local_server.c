@@ -0,0 +1,601 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_local_server.c
+//  Description    : This is the main program of a local stand-in for the FS3
+//                   server. It speaks the same protocol as fs3_server plus
+//                   compound frames, accepts any number of pipelined requests
+//                   on a connection, serves each connection on its own thread
+//                   against the one shared disk, and can hold every reply
+//                   back by a fixed link delay so that round trip costs show
+//                   up when testing on loopback, and can hold the link to a
+//                   fixed bandwidth as well. Clients on the same host can
+//                   skip TCP and connect over a Unix domain socket. A client
+//                   that asks for it at mount gets packed payloads, may
+//                   write parts of sectors and may copy sectors on the disk.
+//                   The disk can be mapped onto an image file, so it keeps
+//                   what was written when the server is stopped (SIGINT or
+//                   SIGTERM) and started again.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include Files
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_network.h>
+#include <fs3_codec.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define FS3_SERVER_ARGUMENTS "hvl:p:d:b:u:i:"
+#define FS3_SERVER_MAX_INFLIGHT 1024
+#define USAGE \
+	"USAGE: fs3_local_server [-h] [-v] [-l <logfile>] [-p <port>] [-u <path>] [-d <usec>] [-b <Mbit/s>] [-i <image>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on\n" \
+	"    -u - Unix domain socket to listen on as well (\"\" for TCP only)\n" \
+	"    -d - delay every reply by <usec> microseconds (simulated link latency)\n" \
+	"    -b - limit the link to <Mbit/s> each way, shared by all connections\n" \
+	"    -i - keep the disk in the image file <image> (created if missing)\n" \
+	"\n" \
+
+// A reply waiting out the link delay
+typedef struct {
+	char *msg;
+	int len;
+	uint64_t due; // microseconds
+} FS3PendingReply;
+
+// A reply being assembled
+typedef struct {
+	char *msg;
+	int len;
+	int cap;
+} FS3ReplyBuffer;
+
+// One connection and the state it keeps on the server
+typedef struct FS3ServerClient {
+	int fd;           // -1 once the connection is closed
+	int id;
+	pthread_t thread;
+	int done;         // the thread has finished and waits to be joined
+	struct FS3ServerClient *next;
+	FS3ControllerSession sess;
+	FS3PendingReply replies[FS3_SERVER_MAX_INFLIGHT];
+	int replyHead, replyCount;
+	long ops[FS3_OP_MAXVAL];
+	int packed;       // the client asked for packed payloads at mount
+	long received;    // bytes read of the request being served
+	long long bytesIn, bytesOut;
+	FS3Track payload; // request/reply payload, a range moves at most one track
+	char wire[FS3_CODEC_WIRE_MAX(FS3_TRACK_SIZE)]; // the payload as packed on the wire
+} FS3ServerClient;
+
+//
+// Global Data
+long fs3ServerDelay = 0;
+long fs3ServerBandwidth = 0;    // Mbit/s each way, 0 for no limit
+uint64_t linkUp, linkDown;      // nanosecond times the uplink / downlink next fall idle
+pthread_mutex_t linkLock = PTHREAD_MUTEX_INITIALIZER;
+volatile sig_atomic_t fs3ServerStop = 0; // SIGINT/SIGTERM seen, shut down
+FS3ServerClient *fs3ServerClients = NULL; // connections whose threads are not joined yet
+pthread_mutex_t clientsLock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Functional Prototypes
+
+void *client_thread(void *arg);    // Serve a connection, then log its counts and release it
+int serve_client(FS3ServerClient *client); // Serve one connection until it unmounts or closes
+int run_request(FS3ServerClient *client, FS3CmdBlk cmd, FS3ReplyBuffer *out);
+	// Execute one plain request, append its reply to out
+void reap_clients(int all);        // Join the threads of finished connections, or of all of them
+
+//
+// Functions
+
+//asks the accept loop to stop, the disk image is synced on the way out
+void stopServer(int sig) {
+	fs3ServerStop = 1;
+}
+
+//current time in microseconds
+uint64_t nowMicros(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//when a reply of outLen bytes to a request of inLen bytes that arrived at now (microseconds)
+//is through the link: the request crosses the uplink and the reply the downlink, each
+//behind whatever is already on its way, then both wait out the link delay
+uint64_t linkDue(uint64_t now, long inLen, long outLen) {
+	uint64_t due;
+
+	if (fs3ServerBandwidth == 0) return(now + fs3ServerDelay);
+	pthread_mutex_lock(&linkLock);
+	linkUp = ((linkUp > now * 1000) ? linkUp : now * 1000) + (uint64_t)inLen * 8000 / fs3ServerBandwidth;
+	linkDown = ((linkDown > linkUp) ? linkDown : linkUp) + (uint64_t)outLen * 8000 / fs3ServerBandwidth;
+	due = linkDown / 1000 + fs3ServerDelay;
+	pthread_mutex_unlock(&linkLock);
+	return(due);
+}
+
+//reads exactly len bytes, 0 on success, -1 on error or end of stream
+int readExactly(int fd, void *buf, int len) {
+	int got = 0, r;
+	while (got < len) {
+		r = read(fd, (char *)buf + got, len - got);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return(-1);
+		got += r;
+	}
+	return(0);
+}
+
+//writes exactly len bytes, 0 on success, -1 on error
+int writeExactly(int fd, void *buf, int len) {
+	int put = 0, r;
+	while (put < len) {
+		r = write(fd, (char *)buf + put, len - put);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return(-1);
+		put += r;
+	}
+	return(0);
+}
+
+//appends len bytes to a reply being assembled
+int appendReply(FS3ReplyBuffer *out, void *data, int len) {
+	char *grown;
+
+	if (out->len + len > out->cap) {
+		out->cap = (out->len + len) * 2;
+		if ((grown = realloc(out->msg, out->cap)) == NULL) return(-1);
+		out->msg = grown;
+	}
+	memcpy(out->msg + out->len, data, len);
+	out->len += len;
+	return(0);
+}
+
+//sends every queued reply whose delay has passed, or all of them if flushAll is set
+int flushReplies(FS3ServerClient *client, int flushAll) {
+	uint64_t now = nowMicros();
+	FS3PendingReply *rep;
+
+	while (client->replyCount > 0) {
+		rep = &client->replies[client->replyHead];
+		if (!flushAll && rep->due > now) break;
+		if (rep->due > now) usleep(rep->due - now);
+		if (writeExactly(client->fd, rep->msg, rep->len) != 0) return(-1);
+		free(rep->msg);
+		client->replyHead = (client->replyHead + 1) % FS3_SERVER_MAX_INFLIGHT;
+		client->replyCount--;
+		now = nowMicros();
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 local server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, fd, clients = 0, one = 1;
+	FS3ServerClient *client;
+	unsigned short port = FS3_DEFAULT_PORT;
+	char *path = NULL, *image = NULL, defpath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	struct sockaddr_in v4;
+	struct sockaddr_un un;
+	struct pollfd listeners[2] = { { -1, POLLIN, 0 }, { -1, POLLIN, 0 } };
+	struct sigaction stop;
+	sigset_t stopSignals, mask;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_SERVER_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'u': // Set the Unix domain socket path
+			if ( strlen(optarg) >= sizeof(un.sun_path) ) {
+				logMessage( LOG_ERROR_LEVEL, "Unix socket path too long [%s]", optarg );
+				return(-1);
+			}
+			path = optarg;
+			break;
+
+		case 'd': // Set the link delay
+			if ( sscanf(optarg, "%ld", &fs3ServerDelay) != 1 || fs3ServerDelay < 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad link delay [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'b': // Set the link bandwidth
+			if ( sscanf(optarg, "%ld", &fs3ServerBandwidth) != 1 || fs3ServerBandwidth < 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad link bandwidth [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'i': // Set the disk image file
+			image = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel);
+	}
+
+	// Setup the disk and the listening socket, a signal stops the server (poll is not restarted)
+	if ( fs3_controller_init(image) != 0 ) {
+		return( -1 );
+	}
+	memset(&stop, 0, sizeof(stop));
+	stop.sa_handler = stopServer;
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&stopSignals);
+	sigaddset(&stopSignals, SIGINT);
+	sigaddset(&stopSignals, SIGTERM);
+	v4.sin_family = AF_INET;
+	v4.sin_port = htons(port);
+	v4.sin_addr.s_addr = htonl(INADDR_ANY);
+	listeners[0].fd = socket(PF_INET, SOCK_STREAM, 0);
+	if ( (listeners[0].fd == -1) ||
+			(setsockopt(listeners[0].fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0) ||
+			(bind(listeners[0].fd, (struct sockaddr *)&v4, sizeof(v4)) != 0) ||
+			(listen(listeners[0].fd, FS3_MAX_BACKLOG) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 local server: cannot listen on port %d [%s]", port, strerror(errno) );
+		return( -1 );
+	}
+
+	// The Unix domain socket is optional, a stale one left by an earlier server is replaced
+	if ( path == NULL ) {
+		snprintf(defpath, sizeof(defpath), FS3_UNIX_PATH_FORMAT, port);
+		path = defpath;
+	}
+	if ( path[0] != '\0' ) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strcpy(un.sun_path, path);
+		unlink(path);
+		listeners[1].fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ( (listeners[1].fd == -1) ||
+				(bind(listeners[1].fd, (struct sockaddr *)&un, sizeof(un)) != 0) ||
+				(listen(listeners[1].fd, FS3_MAX_BACKLOG) != 0) ) {
+			logMessage( LOG_WARNING_LEVEL, "FS3 local server: cannot listen on %s [%s], TCP only", path, strerror(errno) );
+			if ( listeners[1].fd != -1 ) close(listeners[1].fd);
+			listeners[1].fd = -1;
+		}
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 local server listening on port %d%s%s, link delay %ld usec, bandwidth %ld Mbit/s%s", port,
+		(listeners[1].fd != -1) ? " and " : "", (listeners[1].fd != -1) ? path : "", fs3ServerDelay, fs3ServerBandwidth,
+		fs3ServerBandwidth ? "" : " (unlimited)" );
+
+	// Every connection gets its own thread and session, the disk is shared and carries over between them
+	while ( !fs3ServerStop && (poll(listeners, 2, -1) >= 0 || errno == EINTR) ) {
+		reap_clients(0);
+		fd = -1;
+		if ( listeners[0].revents & POLLIN ) {
+			if ( (fd = accept(listeners[0].fd, NULL, NULL)) != -1 ) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		} else if ( listeners[1].revents & POLLIN ) {
+			fd = accept(listeners[1].fd, NULL, NULL);
+		}
+		if ( fd == -1 || fs3ServerStop ) {
+			if ( fd != -1 ) close(fd);
+			continue;
+		}
+		if ( (client = calloc(1, sizeof(FS3ServerClient))) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 local server: out of memory for a connection" );
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		client->id = clients++;
+		client->sess.track = FS3_NO_TRACK;
+		// The stop signals are left to the main thread, whose poll they interrupt
+		pthread_sigmask(SIG_BLOCK, &stopSignals, &mask);
+		ch = pthread_create(&client->thread, NULL, client_thread, client);
+		pthread_sigmask(SIG_SETMASK, &mask, NULL);
+		if ( ch != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 local server: cannot start a thread for the connection" );
+			close(fd);
+			free(client);
+			continue;
+		}
+		pthread_mutex_lock(&clientsLock);
+		client->next = fs3ServerClients;
+		fs3ServerClients = client;
+		pthread_mutex_unlock(&clientsLock);
+	}
+
+	close(listeners[0].fd);
+	if ( listeners[1].fd != -1 ) {
+		close(listeners[1].fd);
+		unlink(path);
+	}
+	// No thread may still be using the disk when it is unmapped
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 local server: stopping after %d connections", clients );
+	reap_clients(1);
+	return( fs3_controller_close() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reap_clients
+// Description  : Join the threads of the connections that have finished. With
+//                all set, first shut every open connection down, which ends
+//                its thread at the next request, and join them all.
+//
+// Inputs       : all - non-zero to end and join every connection
+// Outputs      : none
+
+void reap_clients(int all) {
+	FS3ServerClient **link, *client;
+
+	// Only the main thread changes the list, the threads only mark themselves done
+	if ( all ) {
+		pthread_mutex_lock(&clientsLock);
+		for ( client = fs3ServerClients; client != NULL; client = client->next ) {
+			if ( client->fd != -1 ) shutdown(client->fd, SHUT_RDWR);
+		}
+		pthread_mutex_unlock(&clientsLock);
+	}
+	link = &fs3ServerClients;
+	while ( (client = *link) != NULL ) {
+		pthread_mutex_lock(&clientsLock);
+		if ( !all && !client->done ) {
+			pthread_mutex_unlock(&clientsLock);
+			link = &client->next;
+			continue;
+		}
+		*link = client->next;
+		pthread_mutex_unlock(&clientsLock);
+		pthread_join(client->thread, NULL);
+		free(client);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_thread
+// Description  : Serve a connection, then log what it did and close it; the
+//                main thread joins the thread and frees the client
+//
+// Inputs       : arg - the FS3ServerClient of the connection
+// Outputs      : NULL
+
+void *client_thread(void *arg) {
+	FS3ServerClient *client = arg;
+
+	serve_client(client);
+	pthread_mutex_lock(&clientsLock);
+	close(client->fd);
+	client->fd = -1;
+	pthread_mutex_unlock(&clientsLock);
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 local server: client %d done [mount %ld, seek %ld, read %ld, write %ld, "
+		"compound %ld, rdrange %ld, wrrange %ld, wrpart %ld, copy %ld; %s, %lld bytes in, %lld out]", client->id, client->ops[FS3_OP_MOUNT],
+		client->ops[FS3_OP_TSEEK], client->ops[FS3_OP_RDSECT], client->ops[FS3_OP_WRSECT], client->ops[FS3_OP_COMPOUND],
+		client->ops[FS3_OP_RDRANGE], client->ops[FS3_OP_WRRANGE], client->ops[FS3_OP_WRPART], client->ops[FS3_OP_COPY],
+		client->packed ? "packed" : "raw",
+		client->bytesIn, client->bytesOut );
+	while (client->replyCount > 0) {
+		free(client->replies[client->replyHead].msg);
+		client->replyHead = (client->replyHead + 1) % FS3_SERVER_MAX_INFLIGHT;
+		client->replyCount--;
+	}
+	pthread_mutex_lock(&clientsLock);
+	client->done = 1;
+	pthread_mutex_unlock(&clientsLock);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serve_client
+// Description  : Serve one connection until it unmounts or closes. Requests
+//                are executed as they arrive; replies go out in order once
+//                their link delay has passed, so a client may have many
+//                requests in flight.
+//
+// Inputs       : client - the connection
+// Outputs      : 0 if the client unmounted, -1 on error or disconnect
+
+int serve_client(FS3ServerClient *client) {
+
+	// Local variables
+	FS3CmdBlk cmd, reply;
+	FS3PendingReply *rep;
+	struct pollfd pfd = { client->fd, POLLIN, 0 };
+	struct timespec wait, *timeout;
+	FS3ReplyBuffer out;
+	int count, start, i, failed;
+	uint64_t now;
+	uint8_t op;
+
+	while (1) {
+
+		// Wait for the next request or for the oldest reply to come due
+		timeout = NULL;
+		if (client->replyCount > 0) {
+			now = nowMicros();
+			rep = &client->replies[client->replyHead];
+			now = (rep->due > now) ? rep->due - now : 0;
+			wait.tv_sec = now / 1000000;
+			wait.tv_nsec = (now % 1000000) * 1000;
+			timeout = &wait;
+		}
+		if (ppoll(&pfd, 1, timeout, NULL) < 0 && errno != EINTR) return(-1);
+		if (flushReplies(client, 0) != 0) return(-1);
+		if (!(pfd.revents & (POLLIN | POLLHUP))) continue;
+
+		// Read and execute the request, a compound frame runs all of its operations in order
+		if (readExactly(client->fd, &cmd, sizeof(cmd)) != 0) return(-1);
+		cmd = ntohll64(cmd);
+		op = FS3_CMD_OPCODE(cmd);
+		out.msg = NULL;
+		out.len = out.cap = 0;
+		client->received = sizeof(cmd);
+		if (op == FS3_OP_COMPOUND) {
+			count = FS3_CMD_SECTOR(cmd);
+			failed = 0;
+			if (appendReply(&out, &cmd, sizeof(cmd)) != 0) return(-1); //header, filled in below
+			for (i = 0; i < count; i++) {
+				if (readExactly(client->fd, &cmd, sizeof(cmd)) != 0 || (start = out.len, client->received += sizeof(cmd),
+						run_request(client, ntohll64(cmd), &out)) != 0) {
+					free(out.msg);
+					return(-1);
+				}
+				memcpy(&reply, out.msg + start, sizeof(reply));
+				failed |= FS3_CMD_RETURN(ntohll64(reply));
+			}
+			client->ops[FS3_OP_COMPOUND]++;
+			reply = htonll64(((FS3CmdBlk)FS3_OP_COMPOUND << 60) | ((FS3CmdBlk)count << 44) | ((FS3CmdBlk)failed << 11));
+			memcpy(out.msg, &reply, sizeof(reply));
+		} else if (run_request(client, cmd, &out) != 0) {
+			free(out.msg);
+			return(-1);
+		}
+
+		// The client does not wait for a reply to UMOUNT
+		client->bytesIn += client->received;
+		if (op == FS3_OP_UMOUNT) {
+			free(out.msg);
+			flushReplies(client, 1);
+			return(0);
+		}
+
+		// Queue the reply behind the link delay (and the bandwidth)
+		if (client->replyCount == FS3_SERVER_MAX_INFLIGHT && flushReplies(client, 1) != 0) return(-1);
+		rep = &client->replies[(client->replyHead + client->replyCount) % FS3_SERVER_MAX_INFLIGHT];
+		rep->msg = out.msg;
+		rep->len = out.len;
+		rep->due = linkDue(nowMicros(), client->received, out.len);
+		client->bytesOut += out.len;
+		client->replyCount++;
+		if (flushReplies(client, 0) != 0) return(-1);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : run_request
+// Description  : Execute one plain (non-compound) request, reading its
+//                payload from the client, and append the reply to out.
+//                Payloads of a packed session are unpacked on the way in,
+//                and packed on the way out when that makes them smaller.
+//
+// Inputs       : client - the connection, its session runs the command
+//                cmd - the command block (host byte order)
+//                out - receives the reply block and any read payload
+// Outputs      : bytes appended to out, -1 on a connection error
+
+int run_request(FS3ServerClient *client, FS3CmdBlk cmd, FS3ReplyBuffer *out) {
+	FS3CmdBlk reply;
+	uint8_t op = FS3_CMD_OPCODE(cmd);
+	int len = FS3_REQUEST_WIRE(cmd), packedIn = (FS3_REQUEST_PAYLOAD(cmd) && FS3_CMD_WIRE(cmd)), opts = 0, packed = 0;
+
+	if ((FS3_REQUEST_PAYLOAD(cmd) > sizeof(client->payload)) || (FS3_REPLY_PAYLOAD(cmd) > sizeof(client->payload))) {
+		logMessage(LOG_ERROR_LEVEL, "FS3 local server: range of %d sectors is larger than a track", FS3_CMD_COUNT(cmd));
+		return(-1);
+	}
+	if (packedIn && (!client->packed || !FS3_CODEC_FITS(len, FS3_REQUEST_PAYLOAD(cmd)))) {
+		logMessage(LOG_ERROR_LEVEL, "FS3 local server: unexpected packed payload of %d bytes", len);
+		return(-1);
+	}
+	if (readExactly(client->fd, packedIn ? client->wire : (char *)client->payload, len) != 0) return(-1);
+	client->received += len;
+	if (packedIn && fs3_codec_unpack(client->wire, len, client->payload, FS3_REQUEST_PAYLOAD(cmd) / FS3_SECTOR_SIZE, NULL) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "FS3 local server: malformed packed payload");
+		return(-1);
+	}
+	cmd &= ~FS3_CMD_WIRE_MASK;
+
+	//options (packed payloads, partial writes, copies) are asked for with bits of the MOUNT and granted
+	//by keeping them in the reply, this server grants all it knows
+	if (op == FS3_OP_MOUNT) {
+		opts = FS3_CMD_COUNT(cmd) & (FS3_MOUNT_PACK | FS3_MOUNT_PATCH | FS3_MOUNT_COPY);
+		cmd &= ~(FS3CmdBlk)opts;
+	}
+	reply = (op == FS3_OP_COMPOUND) ? cmd | ((FS3CmdBlk)1 << 11) : fs3_controller_execute(&client->sess, cmd, client->payload);
+	if (opts && !FS3_CMD_RETURN(reply)) {
+		client->packed = (opts & FS3_MOUNT_PACK) != 0;
+		reply |= opts;
+	}
+	if (op < FS3_OP_MAXVAL) client->ops[op]++;
+	logMessage(FS3ControllerLLevel, "FS3 local server: op %d track %d sector %d -> %d",
+		op, FS3_CMD_TRACK(cmd), FS3_CMD_SECTOR(cmd), FS3_CMD_RETURN(reply));
+
+	//a failed read still sends its payload, the client always expects it
+	len = FS3_REPLY_PAYLOAD(cmd);
+	if (client->packed && len > 0) {
+		len = fs3_codec_pack(client->payload, len / FS3_SECTOR_SIZE, client->wire, &packed);
+		if (packed == 0 || len >= FS3_REPLY_PAYLOAD(cmd)) len = FS3_REPLY_PAYLOAD(cmd);
+		else reply |= (FS3CmdBlk)len << 22;
+	}
+	reply = htonll64(reply);
+	if (appendReply(out, &reply, sizeof(reply)) != 0) return(-1);
+	return(appendReply(out, FS3_CMD_WIRE(ntohll64(reply)) ? client->wire : (char *)client->payload, len));
+}
@@ -0,0 +1,329 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_mkimage.c
+//  Description    : This is the main program of the FS3 disk image builder.
+//                   It lays the files of workload directories out on a
+//                   fresh disk image, each in consecutive sectors, together
+//                   with a file table the driver loads at mount (see
+//                   fs3_image.h). A server started on the image (or a
+//                   client running the controller on it) then starts with
+//                   every file already in place, so read benchmarks need
+//                   not replay the writes that would fill the disk.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_image.h>
+#include <fs3_journal.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define FS3_MKIMAGE_ARGUMENTS "hvl:w:o:"
+#define FS3_MKIMAGE_WORKLOAD_DIR "workload"
+#define FS3_MKIMAGE_LAST_SECTOR ((FS3_MAX_TRACKS - FS3_JOURNAL_TRACKS) * FS3_TRACK_SIZE)
+#define USAGE \
+	"USAGE: fs3_mkimage [-h] [-v] [-l <logfile>] [-w <dir>] -o <image> <directory>...\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -w - directory the workload files are in (\"workload\" by default)\n" \
+	"    -o - write the disk image to <image> (replaced if it exists)\n" \
+	"\n" \
+	"    <directory> - directory under the workload directory whose files go on the disk, e.g. assign4-small\n" \
+	"\n" \
+
+//
+// Global Data
+FS3ImageEntry fs3ImageFiles[FS3_IMAGE_MAX_FILES];
+int fs3ImageCount;
+FS3Sector fs3ImageStage[FS3_IMAGE_FILE_SECTORS];
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addDirectory
+// Description  : Add the regular files of a directory to the file table
+//
+// Inputs       : workdir - the workload directory
+//                dir - the directory under it, the prefix of every name
+// Outputs      : 0 if successful, -1 if failure
+
+int addDirectory( char *workdir, char *dir ) {
+
+	// Local variables
+	char path[PATH_MAX];
+	struct dirent *ent;
+	struct stat st;
+	DIR *dp;
+	int n;
+
+	if ( snprintf(path, sizeof(path), "%s/%s", workdir, dir) >= (int)sizeof(path) ) {
+		logMessage( LOG_ERROR_LEVEL, "Path too long [%s/%s]", workdir, dir );
+		return( -1 );
+	}
+	if ( (dp = opendir(path)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Cannot open directory [%s]: %s", path, strerror(errno) );
+		return( -1 );
+	}
+
+	while ( (ent = readdir(dp)) != NULL ) {
+		// The .cmm copies the simulator leaves behind when it validates a file are not workload files
+		n = strlen( ent->d_name );
+		if ( (n > 4) && (strcmp(ent->d_name + n - 4, ".cmm") == 0) ) {
+			continue;
+		}
+		if ( snprintf(path, sizeof(path), "%s/%s/%s", workdir, dir, ent->d_name) >= (int)sizeof(path) ) {
+			logMessage( LOG_ERROR_LEVEL, "Path too long [%s/%s/%s]", workdir, dir, ent->d_name );
+			closedir( dp );
+			return( -1 );
+		}
+		if ( (stat(path, &st) != 0) || !S_ISREG(st.st_mode) ) {
+			continue;
+		}
+
+		// The name is what workload lines call the file
+		if ( fs3ImageCount == FS3_IMAGE_MAX_FILES ) {
+			logMessage( LOG_ERROR_LEVEL, "More than %d files, aborting", FS3_IMAGE_MAX_FILES );
+			closedir( dp );
+			return( -1 );
+		}
+		n = snprintf( fs3ImageFiles[fs3ImageCount].name, FS3_IMAGE_NAME_LENGTH, "%s/%s", dir, ent->d_name );
+		if ( n >= FS3_IMAGE_NAME_LENGTH ) {
+			logMessage( LOG_ERROR_LEVEL, "File name too long [%s/%s]", dir, ent->d_name );
+			closedir( dp );
+			return( -1 );
+		}
+		if ( st.st_size > (off_t)FS3_IMAGE_FILE_SECTORS * FS3_SECTOR_SIZE ) {
+			logMessage( LOG_ERROR_LEVEL, "File [%s] is larger than an FS3 file can be (%d bytes)", path,
+					FS3_IMAGE_FILE_SECTORS * FS3_SECTOR_SIZE );
+			closedir( dp );
+			return( -1 );
+		}
+		fs3ImageFiles[fs3ImageCount].length = st.st_size;
+		fs3ImageCount++;
+	}
+
+	closedir( dp );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareEntries
+// Description  : Order file table entries by name (qsort)
+//
+// Inputs       : a, b - the entries
+// Outputs      : <0, 0, >0 as strcmp
+
+int compareEntries( const void *a, const void *b ) {
+	return( strcmp(((const FS3ImageEntry *)a)->name, ((const FS3ImageEntry *)b)->name) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeSectors
+// Description  : Write count sectors from first on through the controller,
+//                a range per track
+//
+// Inputs       : sess - the controller session
+//                first - first sector, in disk order
+//                buf - the sectors
+//                count - number of sectors
+// Outputs      : 0 if successful, -1 if failure
+
+int writeSectors( FS3ControllerSession *sess, uint32_t first, char *buf, uint32_t count ) {
+
+	// Local variables
+	FS3CmdBlk seek, write;
+	uint32_t trk, sct, n;
+
+	while ( count > 0 ) {
+		trk = first / FS3_TRACK_SIZE;
+		sct = first % FS3_TRACK_SIZE;
+		n = (count < FS3_TRACK_SIZE - sct) ? count : FS3_TRACK_SIZE - sct;
+		seek = ((FS3CmdBlk)FS3_OP_TSEEK << 60) | ((FS3CmdBlk)trk << 12);
+		write = ((FS3CmdBlk)FS3_OP_WRRANGE << 60) | ((FS3CmdBlk)sct << 44) | ((FS3CmdBlk)trk << 12) | n;
+		if ( FS3_CMD_RETURN(fs3_controller_execute(sess, seek, NULL)) ||
+				FS3_CMD_RETURN(fs3_controller_execute(sess, write, buf)) ) {
+			logMessage( LOG_ERROR_LEVEL, "Writing %u sectors at track %u, sector %u failed", n, trk, sct );
+			return( -1 );
+		}
+		first += n;
+		buf += n * FS3_SECTOR_SIZE;
+		count -= n;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 disk image builder
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, i;
+	char *workdir = FS3_MKIMAGE_WORKLOAD_DIR, *image = NULL, path[PATH_MAX];
+	FS3ControllerSession sess = { 0, FS3_NO_TRACK };
+	FS3ImageHeader *hdr = (FS3ImageHeader *)fs3ImageStage[0];
+	uint32_t table, next, bytes = 0, sectors;
+	struct timeval start, end;
+	FILE *fp;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_MKIMAGE_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'w': // Set the workload directory
+			workdir = optarg;
+			break;
+
+		case 'o': // Set the disk image file
+			image = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel);
+	}
+	if ( (image == NULL) || (optind >= argc) ) {
+		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+	gettimeofday( &start, NULL );
+
+	// Collect the files, in name order so the same directories always give the same image
+	for ( i = optind; i < argc; i++ ) {
+		while ( (strlen(argv[i]) > 1) && (argv[i][strlen(argv[i]) - 1] == '/') ) {
+			argv[i][strlen(argv[i]) - 1] = 0x0;
+		}
+		if ( addDirectory(workdir, argv[i]) != 0 ) {
+			return( -1 );
+		}
+	}
+	qsort( fs3ImageFiles, fs3ImageCount, sizeof(FS3ImageEntry), compareEntries );
+
+	// Lay them out after the header and the file table, below the journal track
+	table = (fs3ImageCount + FS3_IMAGE_ENTRIES_PER_SECTOR - 1) / FS3_IMAGE_ENTRIES_PER_SECTOR;
+	next = 1 + table;
+	for ( i = 0; i < fs3ImageCount; i++ ) {
+		fs3ImageFiles[i].first = next;
+		next += (fs3ImageFiles[i].length + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+		bytes += fs3ImageFiles[i].length;
+	}
+	if ( next > FS3_MKIMAGE_LAST_SECTOR ) {
+		logMessage( LOG_ERROR_LEVEL, "The files need %u sectors, the disk has %d below the journal", next,
+				FS3_MKIMAGE_LAST_SECTOR );
+		return( -1 );
+	}
+
+	// A fresh disk, so nothing of an old image survives between the files
+	if ( (unlink(image) != 0) && (errno != ENOENT) ) {
+		logMessage( LOG_ERROR_LEVEL, "Cannot replace disk image [%s]: %s", image, strerror(errno) );
+		return( -1 );
+	}
+	if ( (fs3_controller_init(image) != 0) ||
+			FS3_CMD_RETURN(fs3_controller_execute(&sess, (FS3CmdBlk)FS3_OP_MOUNT << 60, NULL)) ) {
+		return( -1 );
+	}
+
+	// The header and the file table
+	memset( fs3ImageStage, 0x0, (1 + table) * FS3_SECTOR_SIZE );
+	hdr->magic = FS3_IMAGE_MAGIC;
+	hdr->files = fs3ImageCount;
+	hdr->table = table;
+	hdr->next = next;
+	hdr->bytes = bytes;
+	for ( i = 0; i < fs3ImageCount; i++ ) {
+		memcpy( fs3ImageStage[1 + i / FS3_IMAGE_ENTRIES_PER_SECTOR] + (i % FS3_IMAGE_ENTRIES_PER_SECTOR) * sizeof(FS3ImageEntry),
+				&fs3ImageFiles[i], sizeof(FS3ImageEntry) );
+	}
+	if ( writeSectors(&sess, 0, fs3ImageStage[0], 1 + table) != 0 ) {
+		fs3_controller_close();
+		return( -1 );
+	}
+
+	// Then every file, padded with zeros to whole sectors
+	for ( i = 0; i < fs3ImageCount; i++ ) {
+		sectors = (fs3ImageFiles[i].length + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+		memset( fs3ImageStage, 0x0, sectors * FS3_SECTOR_SIZE );
+		if ( snprintf(path, sizeof(path), "%s/%s", workdir, fs3ImageFiles[i].name) >= (int)sizeof(path) ) {
+			logMessage( LOG_ERROR_LEVEL, "Path too long [%s/%s]", workdir, fs3ImageFiles[i].name );
+			fs3_controller_close();
+			return( -1 );
+		}
+		if ( ((fp = fopen(path, "r")) == NULL) ||
+				(fread(fs3ImageStage, 1, fs3ImageFiles[i].length, fp) != fs3ImageFiles[i].length) ) {
+			logMessage( LOG_ERROR_LEVEL, "Cannot read file [%s]: %s", path, strerror(errno) );
+			if ( fp != NULL ) fclose( fp );
+			fs3_controller_close();
+			return( -1 );
+		}
+		fclose( fp );
+		if ( writeSectors(&sess, fs3ImageFiles[i].first, fs3ImageStage[0], sectors) != 0 ) {
+			fs3_controller_close();
+			return( -1 );
+		}
+		logMessage( FS3ControllerLLevel, "FS3 image: [%s], %u bytes at sector %u", fs3ImageFiles[i].name,
+				fs3ImageFiles[i].length, fs3ImageFiles[i].first );
+	}
+
+	fs3_controller_execute( &sess, (FS3CmdBlk)FS3_OP_UMOUNT << 60, NULL );
+	if ( fs3_controller_close() != 0 ) {
+		return( -1 );
+	}
+	gettimeofday( &end, NULL );
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 image: %d files, %u bytes in %u sectors (%.1f%% of the disk) written to %s in %.2f s",
+			fs3ImageCount, bytes, next, 100.0 * next / (FS3_MAX_TRACKS * FS3_TRACK_SIZE), image,
+			(end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6 );
+	return( 0 );
+}
@@ -9,24 +9,61 @@
 //
 
 // Includes
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <cmpsc311_log.h>
 
 // Project Includes
 #include <fs3_network.h>
 #include <fs3_driver.h>
+#include <fs3_event.h>
+#include <fs3_codec.h>
+#include <fs3_erasure.h>
 #include <cmpsc311_util.h>
 
 //
 //  Global data
 unsigned char     *fs3_network_address = NULL; // Address of FS3 server
 unsigned short     fs3_network_port = 0;       // Port of FS3 serve
+int                fs3_network_window = 1;     // Requests in flight per batch
+int                fs3_network_compound = 0;   // Batches go out as compound frames
+int                fs3_network_ranges = 0;     // Range opcodes may be used
+int                fs3_network_connections = 1; // Connections in the pool
+int                fs3_network_local = 1;      // Use the Unix domain socket of a server on this host
+char              *fs3_network_unix_path = NULL; // Path of that socket
+int                fs3_network_compress = 0;   // Ask the server to pack sector payloads
+int                fs3_network_patch = 0;      // Partial sector writes (FS3_OP_WRPART) may be used
+int                fs3_network_copy = 1;       // Copies on the server (FS3_OP_COPY) may be used
+char              *fs3_network_loopback = NULL; // Image of the in-process controller ("" for memory), NULL for a server
+int                fs3_network_servers = 0;    // Servers the volume is striped over
+int                fs3_network_stripe = FS3_DEFAULT_STRIPE; // Sectors per stripe unit
+int                fs3_network_mirrors = 1;    // Servers in every mirror set
+int                fs3_network_hedge = FS3_DEFAULT_HEDGE; // Percentile of read latency after which a read is hedged, 0 never
+int                fs3_network_parity = 0;     // Servers of every row holding parity
 int sock;
+int netLocal;                                 // the connections are all Unix domain sockets
+char *netServerAddr[FS3_MAX_SERVERS];         // address of every server of the volume
+unsigned short netServerPort[FS3_MAX_SERVERS]; // and its port, 0 for fs3_network_port
+int netPacked;                                // the server agreed to packed payloads at mount
+FS3ControllerSession netLoopback;             // the session of the in-process controller
+long netRequests, netBatches, netMaxInflight, netFrames, netRoundTrips, netRanges, netSyscalls, netOperations;
+long netOpcodes[FS3_OP_MAXVAL];                // operations the driver asked for, by opcode (compound frames are netFrames)
+long netFanouts, netPoolSeeks, netPoolSplits, netStripeSplits, netPackedSectors, netRawSectors, netHedges, netHedgeWins;
+long long netBytesOut, netBytesIn, netPayloadBytes, netWireBytes;
+long long netDataWritten, netStoredBytes, netWriteMicros; // payload the caller wrote, payload sent to servers, time of batches that wrote
+int netDown[FS3_MAX_SERVERS], netDownCount;   // servers of a volume with parity that were not there at mount
+long netParityWrites, netColumnReads, netDegraded, netRebuilt;
+char *netArena;                               // packed payloads of the exchange or batch in flight
+size_t netArenaSize;
 typedef struct{
 	uint8_t opcode;
 	uint16_t sectorNumber;
@@ -34,96 +71,1255 @@ typedef struct{
 	uint8_t returnVal;
 } deconstVals;
 
+//the share of a batch one pooled connection carries
+typedef struct{
+    int count, cap, sent, done;
+    FS3CmdBlk *cmds, *rets;
+    void **bufs;
+    void **io;               // what moves on the wire for each entry: its buffer or a packed copy
+    int *owner;              // the caller's command each entry answers, -1 for a seek the pool added
+    FS3TrackIndex track;     // where the connection's head is once its entries have run
+    FS3TrackIndex from;      // and where it was before them
+    long load;               // sectors (at least one per command) given to it this batch
+    int reads;               // nothing but seeks and reads, so another replica may answer instead
+    int finished, dropped;   // every entry answered / the rest given up on, done entries are answered
+    int hedgedBy, hedgeAt;   // connection repeating entries hedgeAt on elsewhere, -1 if none
+    int hedgeOf;             // connection whose entries this one repeats, -1 if none
+    uint64_t start;          // microsecond time the entries (or the repeats) went out
+} PoolLane;
+
+//what the client has seen of one server's replies
+typedef struct{
+    long hist[FS3_NET_HIST_BUCKETS];  // read batch latencies, bucket b below netBound(b) microseconds
+    long reads, hedged, won;          // read batches answered, read batches hedged away from it, hedges it won
+    uint64_t ewma;                    // recent batch latency (reads and writes), microseconds
+} NetReplica;
+
+int poolSocks[FS3_MAX_CONNECTIONS];           // sock is poolSocks[0] outside of a fan-out
+int poolCount;                                // connections over all servers, those of server s start at s * fs3_network_connections
+FS3TrackIndex poolTrack[FS3_MAX_CONNECTIONS]; // head position of each connection
+FS3TrackIndex poolHead = FS3_NO_TRACK;        // track of the caller's last seek
+PoolLane poolLanes[FS3_MAX_CONNECTIONS];
+int poolReader[FS3_MAX_SERVERS];              // replica of every mirror set the reads of the batch go to
+NetReplica netReplicas[FS3_MAX_SERVERS];
+long netRecent[FS3_NET_HIST_BUCKETS], netRecentCount; // recent read batch latencies of all replicas, hedging follows them
+FS3CmdBlk *poolRets;                          // the caller's return blocks during a fan-out
+
+//what a batch does to one column of a volume with parity, the sectors at the same place on every
+//server of a stripe row
+typedef struct{
+    long at;                          // that place, track * FS3_TRACK_SIZE + sector
+    int row;                          // the stripe row, which turns the positions over the servers
+    int slot;                         // the column's place in at order, where its scratch sectors are
+    char *data[FS3_MAX_SERVERS];      // what the batch leaves in each data position, NULL if it writes none
+    int written;                      // the batch writes to some data position
+    int old;                          // a read of a server that is down needs the column as it was
+    int degraded;                     // so the data of a server that is down has to be rebuilt
+} EcColumn;
+
+//a read of a sector on a server that is down
+typedef struct{
+    int col, pos;                     // the column and data position
+    char *dst, *src;                  // where it goes, and what the batch wrote there before it (NULL if nothing)
+} EcRebuild;
+
+EcColumn *ecCols;                             // the columns of the batch, in the order it touches them
+int *ecOrder, ecCount, ecCap;                 // and their indices in at order
+int ecMap[FS3_MAX_TRACKS * FS3_TRACK_SIZE];   // column at every place of a server plus one, 0 if none
+EcRebuild *ecRebuilds;
+int ecRebuildCount, ecRebuildCap;
+char *ecArena;                                // the columns' scratch sectors, every position's side by side
+size_t ecArenaSize;
+EcColumn *ecSort;                             // the columns qsort compares
+
 //
 // Network functions
 
 
-int mountoperations(FS3CmdBlk *cmdBlk, FS3CmdBlk *ret){
-    if (fs3_network_address == NULL) fs3_network_address = (char *)FS3_DEFAULT_IP;
-    if (fs3_network_port == 0) fs3_network_port = FS3_DEFAULT_PORT;
+//moves every byte described by iov over the socket, one writev/readv per pass, resuming
+//after short transfers and interrupted calls; the iovec array is consumed as it goes
+int transferVector(struct iovec *iov, int cnt, int out){
+    ssize_t r;
+
+    while (cnt > 0){
+        r = out ? writev(sock, iov, cnt > FS3_MAX_IOV ? FS3_MAX_IOV : cnt)
+                : readv(sock, iov, cnt > FS3_MAX_IOV ? FS3_MAX_IOV : cnt);
+        netSyscalls++;
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        while (cnt > 0 && (size_t)r >= iov->iov_len){
+            r -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0){
+            iov->iov_base = (char *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return 0;
+}
+
+//counts the bytes a request puts on the wire, and the payload bytes they stand for
+void countRequest(FS3CmdBlk cmd){
+    netBytesOut += sizeof(FS3CmdBlk) + FS3_REQUEST_WIRE(cmd);
+    netPayloadBytes += FS3_REQUEST_PAYLOAD(cmd);
+    netStoredBytes += FS3_REQUEST_PAYLOAD(cmd);
+    netWireBytes += FS3_REQUEST_WIRE(cmd);
+}
+
+//counts the bytes the reply ret to cmd put on the wire
+void countReply(FS3CmdBlk cmd, FS3CmdBlk ret){
+    netBytesIn += sizeof(FS3CmdBlk) + FS3_REPLY_WIRE(cmd, ret);
+    netPayloadBytes += FS3_REPLY_PAYLOAD(cmd);
+    netWireBytes += FS3_REPLY_WIRE(cmd, ret);
+}
+
+//makes the arena hold at least size bytes
+int growArena(size_t size){
+    char *grown;
+
+    if (size <= netArenaSize) return 0;
+    if ((grown = realloc(netArena, size)) == NULL){
+        logMessage(LOG_ERROR_LEVEL, "FS3 network: out of memory for packed payloads");
+        return -1;
+    }
+    netArena = grown;
+    netArenaSize = size;
+    return 0;
+}
+
+//packs the payload of a request into wire when the session packs payloads and that makes it
+//smaller, returns the command with the packed length set (0 if buf goes out as it is)
+FS3CmdBlk packRequest(FS3CmdBlk cmd, void *buf, void *wire){
+    int count = FS3_REQUEST_PAYLOAD(cmd) / FS3_SECTOR_SIZE, len, packed;
+
+    if (!netPacked || count == 0 || FS3_CMD_OPCODE(cmd) == FS3_OP_WRPART) return cmd;
+    len = fs3_codec_pack(buf, count, wire, &packed);
+    if (packed == 0 || len >= FS3_REQUEST_PAYLOAD(cmd)){
+        netRawSectors += count;
+        return cmd;
+    }
+    netPackedSectors += packed;
+    netRawSectors += count - packed;
+    return cmd | ((FS3CmdBlk)len << 22);
+}
+
+//moves the payload of the reply ret to cmd from where it arrived (wire) into buf, and clears
+//the packed length from ret; -1 if the payload is malformed
+int unpackReply(FS3CmdBlk cmd, FS3CmdBlk *ret, void *wire, void *buf){
+    int count = FS3_REPLY_PAYLOAD(cmd) / FS3_SECTOR_SIZE, packed = 0;
+
+    if (wire != buf && count > 0){
+        if (FS3_CMD_WIRE(*ret) == 0) memcpy(buf, wire, FS3_REPLY_PAYLOAD(cmd));
+        else if (fs3_codec_unpack(wire, FS3_CMD_WIRE(*ret), buf, count, &packed) != 0){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: malformed packed payload from the server");
+            return -1;
+        }
+        netPackedSectors += packed;
+        netRawSectors += count - packed;
+    }
+    *ret &= ~FS3_CMD_WIRE_MASK;
+    return 0;
+}
+
+//adds a request (its block, already in network order, and payload) to an outgoing vector
+int addRequest(struct iovec *iov, FS3CmdBlk *blk, FS3CmdBlk cmd, void *buf){
+    *blk = htonll64(cmd);
+    iov[0].iov_base = blk;
+    iov[0].iov_len = sizeof(FS3CmdBlk);
+    countRequest(cmd);
+    if (FS3_REQUEST_WIRE(cmd) == 0) return 1;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = FS3_REQUEST_WIRE(cmd);
+    return 2;
+}
+
+//adds the reply to cmd to an incoming vector, the payload lands straight in buf; a packed
+//payload's length is only known once the block is in, so it is left out
+int addReply(struct iovec *iov, FS3CmdBlk *ret, FS3CmdBlk cmd, void *buf){
+    iov[0].iov_base = ret;
+    iov[0].iov_len = sizeof(FS3CmdBlk);
+    if (FS3_REPLY_PAYLOAD(cmd) == 0 || netPacked) return 1;
+    iov[1].iov_base = buf;
+    iov[1].iov_len = FS3_REPLY_PAYLOAD(cmd);
+    return 2;
+}
+
+//sends one request with its payload in a single writev
+int sendRequest(FS3CmdBlk cmd, void *buf){
+    struct iovec iov[2];
+    FS3CmdBlk blk;
+    return transferVector(iov, addRequest(iov, &blk, cmd, buf), 1);
+}
+
+//collects the reply to the oldest request still in flight with a single readv (two when
+//the payload is packed: the block says how much follows)
+int receiveReply(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf){
+    struct iovec iov[2];
+    if (transferVector(iov, addReply(iov, ret, cmd, buf), 0) != 0) return -1;
+    *ret = ntohll64(*ret);
+    if (netPacked && FS3_REPLY_PAYLOAD(cmd) > 0){
+        if (!FS3_CODEC_FITS(FS3_REPLY_WIRE(cmd, *ret), FS3_REPLY_PAYLOAD(cmd))) return -1;
+        iov[0].iov_base = buf;
+        iov[0].iov_len = FS3_REPLY_WIRE(cmd, *ret);
+        if (transferVector(iov, 1, 0) != 0) return -1;
+    }
+    countReply(cmd, *ret);
+    return 0;
+}
+
+//one request and its reply, packing the payloads both ways when the session does
+int exchangeRequest(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf){
+    void *io = buf;
+
+    if (netPacked && FS3_REQUEST_PAYLOAD(cmd) + FS3_REPLY_PAYLOAD(cmd) > 0){
+        if (growArena(FS3_CODEC_WIRE_MAX((FS3_REQUEST_PAYLOAD(cmd) + FS3_REPLY_PAYLOAD(cmd)) / FS3_SECTOR_SIZE)) != 0) return -1;
+        cmd = packRequest(cmd, buf, netArena);
+        if (FS3_CMD_WIRE(cmd) || FS3_REPLY_PAYLOAD(cmd) > 0) io = netArena;
+    }
+    if (sendRequest(cmd, io) != 0 || receiveReply(cmd, ret, io) != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 network: lost the connection to the server");
+        return -1;
+    }
+    return unpackReply(cmd, ret, io, buf);
+}
+
+//connects to the Unix domain socket of a server on this host, -1 if there is none listening;
+//-u names the socket of the first server, the others have the one of their port
+int openLocalConnection(int srv, unsigned short port){
+    struct sockaddr_un un;
+    int fd;
+
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    if (fs3_network_unix_path != NULL && srv == 0) strncpy(un.sun_path, fs3_network_unix_path, sizeof(un.sun_path) - 1);
+    else snprintf(un.sun_path, sizeof(un.sun_path), FS3_UNIX_PATH_FORMAT, port);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (const struct sockaddr *)&un, sizeof(un)) == -1){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//opens a connection to server srv, over its Unix domain socket when the server is on
+//this host and has one (skipping the TCP/IP stack), over TCP otherwise; -1 on failure
+int openConnection(int srv, int *local){
+    unsigned short port = netServerPort[srv] ? netServerPort[srv] : fs3_network_port;
     struct sockaddr_in v4;
+    int fd, one = 1;
 
     v4.sin_family = AF_INET;
-    v4.sin_port = htons(fs3_network_port);
-
-    int returnvaleualsd = inet_aton(fs3_network_address, &(v4.sin_addr));
-    if (returnvaleualsd == 0){
+    v4.sin_port = htons(port);
+    if (inet_aton(netServerAddr[srv], &(v4.sin_addr)) == 0){
         logMessage(LOG_ERROR_LEVEL, "Invalid address specified");
-        kill(getpid(), SIGUSR1);
-        //return -1;
-    } 
-    sock = socket(PF_INET, SOCK_STREAM, 0);
-    if (sock == -1){
+        return -1;
+    }
+    *local = 0;
+    if (fs3_network_local && (ntohl(v4.sin_addr.s_addr) >> 24) == 127 && (fd = openLocalConnection(srv, port)) != -1){
+        *local = 1;
+        return fd;
+    }
+    fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (fd == -1){
         logMessage(LOG_ERROR_LEVEL, "Could not create socket");
-        kill(getpid(), SIGUSR1);
-        //return -1;
-    } 
+        return -1;
+    }
 
-    if (connect(sock, (const struct sockaddr *)&v4, sizeof(v4)) == -1){
+    //requests are small and each one waits on its reply, so never let Nagle hold them back
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (const struct sockaddr *)&v4, sizeof(v4)) == -1){
         logMessage(LOG_ERROR_LEVEL, "Could not connect to server... might not be running");
-        kill(getpid(), SIGUSR1);
-        //return -1;
-    } 
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-    printCmdBlock(*cmdBlk, 1);
+//leaves server s of a volume with parity out, its connections keep their slots but no socket
+void serverDown(int s, int socks[FS3_MAX_SERVERS][FS3_MAX_CONNECTIONS], int local[FS3_MAX_SERVERS][FS3_MAX_CONNECTIONS]){
+    int c;
 
-    write(sock, cmdBlk, sizeof(cmdBlk));
-    read(sock, ret, sizeof(FS3CmdBlk));
+    logMessage(LOG_WARNING_LEVEL, "FS3 network: server %d of the volume (%s) is down, its sectors are rebuilt from parity", s, netServerAddr[s]);
+    for (c = 0; c < FS3_MAX_CONNECTIONS; c++){
+        socks[s][c] = -1;
+        local[s][c] = 1;
+    }
+    netDown[s] = 1;
+    netDownCount++;
+}
 
-    *ret = ntohll64(*ret);
+//mounts a session on a newly opened extra connection, asking for the options the first one
+//got; a server that only serves one connection at a time never answers
+int mountExtra(int fd, FS3CmdBlk mount, int granted){
+    struct timeval wait = { FS3_POOL_MOUNT_WAIT, 0 }, forever = { 0, 0 };
+    FS3CmdBlk extra;
 
+    sock = fd;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+    if (sendRequest(mount, NULL) != 0 || receiveReply(mount, &extra, NULL) != 0 || FS3_CMD_RETURN(extra) ||
+            (FS3_CMD_COUNT(extra) & FS3_CMD_COUNT(mount)) != granted) return -1;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &forever, sizeof(forever));
     return 0;
 }
 
-int seekoperations(FS3CmdBlk *cmdBlk, FS3CmdBlk *ret){
+int mountoperations(FS3CmdBlk *cmdBlk, FS3CmdBlk *ret){
+    if (fs3_network_address == NULL) fs3_network_address = (char *)FS3_DEFAULT_IP;
+    if (fs3_network_port == 0) fs3_network_port = FS3_DEFAULT_PORT;
+    if (fs3_network_servers == 0){
+        netServerAddr[0] = (char *)fs3_network_address;
+        netServerPort[0] = 0;
+        fs3_network_servers = 1;
+    }
+    if (fs3_network_servers % fs3_network_mirrors != 0){
+        logMessage(LOG_ERROR_LEVEL, "FS3 network: %d servers do not make mirror sets of %d", fs3_network_servers, fs3_network_mirrors);
+        return -1;
+    }
+    if (fs3_network_parity > 0){
+        if (fs3_network_mirrors > 1 || fs3_network_parity >= fs3_network_servers){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: %d parity servers need more servers than that (%d) and no mirrors", fs3_network_parity, fs3_network_servers);
+            return -1;
+        }
+        if (fs3_erasure_init(fs3_network_servers - fs3_network_parity, fs3_network_parity) != 0) return -1;
+        if (fs3_network_patch){
+            logMessage(LOG_INFO_LEVEL, "FS3 network: parity covers whole sectors, no partial writes");
+            fs3_network_patch = 0;
+        }
+    }
+    if (fs3_network_servers > 1 && fs3_network_copy){
+        logMessage(LOG_INFO_LEVEL, "FS3 network: striping over %d servers, copies go through the client", fs3_network_servers);
+        fs3_network_copy = 0;
+    }
+    FS3CmdBlk mount = *cmdBlk | (fs3_network_compress ? FS3_MOUNT_PACK : 0) | (fs3_network_patch ? FS3_MOUNT_PATCH : 0) |
+        (fs3_network_copy ? FS3_MOUNT_COPY : 0);
+    int socks[FS3_MAX_SERVERS][FS3_MAX_CONNECTIONS], local[FS3_MAX_SERVERS][FS3_MAX_CONNECTIONS];
+    int c, s, first, granted, wanted = fs3_network_connections;
 
-    //printCmdBlock(*cmdBlk, 1);
-    *cmdBlk = htonll64(*cmdBlk);
-    write(sock, cmdBlk, sizeof(FS3CmdBlk));
-    //write(sock, cmdBlk, sizeof(FS3CmdBlk));
-    read(sock, ret, sizeof(FS3CmdBlk));
+    //a volume with parity does without up to fs3_network_parity of its servers
+    memset(netDown, 0, sizeof(netDown));
+    netDownCount = 0;
+    for (first = 0; (sock = openConnection(first, &local[first][0])) == -1; first++){
+        if (netDownCount == fs3_network_parity || first + 1 == fs3_network_servers){
+            kill(getpid(), SIGUSR1);
+            return -1;
+        }
+        serverDown(first, socks, local);
+    }
+    socks[first][0] = sock;
+    printCmdBlock(*cmdBlk, 1);
 
-    *ret = ntohll64(*ret);
+    //options are asked for with bits of the MOUNT, a server that knows one keeps its bit in
+    //the reply, fs3_server clears them all
+    netPacked = 0;
+    if (exchangeRequest(mount, ret, NULL) != 0) return -1;
+    granted = FS3_CMD_COUNT(*ret) & FS3_CMD_COUNT(mount);
+    *ret &= ~(FS3CmdBlk)FS3_CMD_COUNT(mount);
+    netPacked = (granted & FS3_MOUNT_PACK) != 0;
+    if (fs3_network_compress && !netPacked) logMessage(LOG_WARNING_LEVEL, "FS3 network: server does not pack payloads, they go raw");
+    if (fs3_network_patch && !(granted & FS3_MOUNT_PATCH)){
+        logMessage(LOG_WARNING_LEVEL, "FS3 network: server does not take partial writes, whole sectors go instead");
+        fs3_network_patch = 0;
+    }
+    if (fs3_network_copy && !(granted & FS3_MOUNT_COPY)){
+        logMessage(LOG_INFO_LEVEL, "FS3 network: server does not copy sectors, copies go through the client");
+        fs3_network_copy = 0;
+    }
+    mount = (mount & ~(FS3CmdBlk)FS3_CMD_COUNT(mount)) | granted;
 
+    //every other server of a striped volume mounts the same options, the volume needs all of them
+    //(or all but fs3_network_parity)
+    for (s = first + 1; s < fs3_network_servers; s++){
+        if ((socks[s][0] = openConnection(s, &local[s][0])) != -1 && mountExtra(socks[s][0], mount, granted) == 0) continue;
+        if (socks[s][0] != -1) close(socks[s][0]);
+        if (netDownCount == fs3_network_parity){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: server %d of the volume (%s) did not mount like the first", s, netServerAddr[s]);
+            return -1;
+        }
+        serverDown(s, socks, local);
+    }
+
+    //every other connection of the pool mounts a session of its own, each server gets as many,
+    //so the pool shrinks to what every server took (and to what fits in the pool)
+    if (fs3_network_servers * fs3_network_connections > FS3_MAX_CONNECTIONS) fs3_network_connections = FS3_MAX_CONNECTIONS / fs3_network_servers;
+    for (c = 1; c < fs3_network_connections; c++){
+        for (s = 0; s < fs3_network_servers; s++){
+            if (netDown[s]) continue;
+            if ((socks[s][c] = openConnection(s, &local[s][c])) != -1 && mountExtra(socks[s][c], mount, granted) == 0) continue;
+            if (socks[s][c] != -1) close(socks[s][c]);
+            while (--s >= 0) if (!netDown[s]) close(socks[s][c]);
+            break;
+        }
+        if (s < fs3_network_servers) break;
+    }
+    if (c < wanted){
+        logMessage(LOG_WARNING_LEVEL, "FS3 network: server took %d of %d connections, pool shrinks to %d", c, wanted, c);
+        fs3_network_connections = c;
+    }
+
+    //from here on the event engine owns the connections, connection c is its slot c
+    poolCount = fs3_network_servers * fs3_network_connections;
+    poolHead = FS3_NO_TRACK;
+    netLocal = 1;
+    if (fs3_event_init() != 0) return -1;
+    for (c = 0; c < poolCount; c++){
+        s = c / fs3_network_connections;
+        poolSocks[c] = socks[s][c % fs3_network_connections];
+        poolTrack[c] = FS3_NO_TRACK;
+        netLocal &= local[s][c % fs3_network_connections];
+        if (fs3_event_add(poolSocks[c], !local[s][c % fs3_network_connections], netPacked) != c) return -1;
+    }
+    sock = poolSocks[first * fs3_network_connections];
     return 0;
 }
 
+int seekoperations(FS3CmdBlk *cmdBlk, FS3CmdBlk *ret){
+    poolTrack[0] = poolHead = FS3_CMD_TRACK(*cmdBlk);
+    return exchangeRequest(*cmdBlk, ret, NULL);
+}
+
 int readoperations(FS3CmdBlk *cmdBlk, FS3CmdBlk *ret, char *readbuffer){
-    
     printCmdBlock(*cmdBlk, 1);
-
-    *cmdBlk = htonll64(*cmdBlk);
-    write(sock, cmdBlk, sizeof(FS3CmdBlk));
-    read(sock, ret, sizeof(FS3CmdBlk));
-    *ret = ntohll64(*ret); 
-    read(sock, readbuffer, sizeof(char)*1024); //NOTE: maybe try padding
-    //*readbuffer = ntohll64(*readbuffer); //MAYBE: not needed
-    
-    return 0;
+    return exchangeRequest(*cmdBlk, ret, readbuffer);
 }
 
 int writeoperations(FS3CmdBlk *cmdBlk, FS3CmdBlk *ret, char *writebuffer){
-    
     printCmdBlock(*cmdBlk, 1);
-    *cmdBlk = htonll64(*cmdBlk);
-    write(sock, cmdBlk, sizeof(FS3CmdBlk));
-    //*writebuffer = htonll64(*writebuffer); //MAYBE: not needed
-    write(sock, writebuffer, sizeof(char)*1024);  //NOTE: maybe try padding
-    read(sock, ret, sizeof(FS3CmdBlk));
-    *ret = ntohll64(*ret);
-
-    return 0;
+    return exchangeRequest(*cmdBlk, ret, writebuffer);
 }
 
 int unmountoperations(FS3CmdBlk *cmdBlk){
-    *cmdBlk = htonll64(*cmdBlk);
-    write(sock, cmdBlk, sizeof(cmdBlk));
-    close(sock);
+    int opret = 0, c;
+
+    fs3_event_close();
+    for (c = 0; c < poolCount; c++){
+        sock = poolSocks[c];
+        if (sock != -1 && sendRequest(*cmdBlk, NULL) != 0) opret = -1;
+        if (sock != -1) close(sock);
+        free(poolLanes[c].cmds);
+        free(poolLanes[c].rets);
+        free(poolLanes[c].bufs);
+        free(poolLanes[c].io);
+        free(poolLanes[c].owner);
+        memset(&poolLanes[c], 0, sizeof(PoolLane));
+    }
     sock = -1;
+    free(netArena);
+    netArena = NULL;
+    netArenaSize = 0;
+
+    return opret;
+}
+
+//sends a batch as one compound frame, gathered into as few writev calls as the iovec limit allows
+int compoundSend(FS3CmdBlk *cmds, void **bufs, int count){
+    static struct iovec iov[FS3_MAX_COMPOUND * 2 + 1];
+    static FS3CmdBlk blks[FS3_MAX_COMPOUND];
+    FS3CmdBlk blk = htonll64(((FS3CmdBlk)FS3_OP_COMPOUND << 60) | ((FS3CmdBlk)count << 44));
+    int i, n = 1;
+
+    iov[0].iov_base = &blk;
+    iov[0].iov_len = sizeof(blk);
+    for (i = 0; i < count; i++) n += addRequest(&iov[n], &blks[i], cmds[i], bufs[i]);
+    return transferVector(iov, n, 1);
+}
+
+//unpacks the reply to a compound frame, the payloads land in bufs
+int compoundReceive(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count){
+    static struct iovec iov[FS3_MAX_COMPOUND * 2];
+    FS3CmdBlk blk;
+    int i, n, len;
 
+    //the frame header comes back alone so a server without compound support is caught before the rest
+    iov[0].iov_base = &blk;
+    iov[0].iov_len = sizeof(blk);
+    if (transferVector(iov, 1, 0) != 0) return -1;
+    blk = ntohll64(blk);
+    if ((uint8_t)(blk >> 60) != FS3_OP_COMPOUND){
+        logMessage(LOG_ERROR_LEVEL, "FS3 network: server did not answer the compound frame (does it support FS3_OP_COMPOUND?)");
+        return -1;
+    }
+    if (!netPacked){
+        for (i = 0, n = 0; i < count; i++) n += addReply(&iov[n], &rets[i], cmds[i], bufs[i]);
+        if (transferVector(iov, n, 0) != 0) return -1;
+        for (i = 0; i < count; i++) rets[i] = ntohll64(rets[i]);
+    } else{
+        //each block says how long its packed payload is, so it is read along with the payload before it
+        n = addReply(iov, &rets[0], cmds[0], bufs[0]);
+        for (i = 0; i < count; i++){
+            if (transferVector(iov, n, 0) != 0) return -1;
+            rets[i] = ntohll64(rets[i]);
+            len = FS3_REPLY_WIRE(cmds[i], rets[i]);
+            if (!FS3_CODEC_FITS(len, FS3_REPLY_PAYLOAD(cmds[i]))) return -1;
+            n = 0;
+            if (len > 0){
+                iov[n].iov_base = bufs[i];
+                iov[n++].iov_len = len;
+            }
+            if (i + 1 < count) n += addReply(&iov[n], &rets[i + 1], cmds[i + 1], bufs[i + 1]);
+        }
+        if (n > 0 && transferVector(iov, n, 0) != 0) return -1;
+    }
+    netFrames++;
+    netRequests += count;
     return 0;
 }
 
+//makes room for cap entries in a connection's share of the batch
+int laneGrow(PoolLane *lane, int cap){
+    if (cap > lane->cap){
+        if ((lane->cmds = realloc(lane->cmds, cap * sizeof(FS3CmdBlk))) == NULL ||
+                (lane->rets = realloc(lane->rets, cap * sizeof(FS3CmdBlk))) == NULL ||
+                (lane->bufs = realloc(lane->bufs, cap * sizeof(void *))) == NULL ||
+                (lane->io = realloc(lane->io, cap * sizeof(void *))) == NULL ||
+                (lane->owner = realloc(lane->owner, cap * sizeof(int))) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: out of memory planning a fan-out");
+            return -1;
+        }
+        lane->cap = cap;
+    }
+    return 0;
+}
+
+//appends an entry to a connection's share of the batch
+int laneAdd(PoolLane *lane, FS3CmdBlk cmd, void *buf, int owner){
+    if (lane->count == lane->cap && laneGrow(lane, lane->cap ? lane->cap * 2 : 64) != 0) return -1;
+    lane->cmds[lane->count] = cmd;
+    lane->bufs[lane->count] = buf;
+    lane->io[lane->count] = buf;
+    lane->owner[lane->count++] = owner;
+    if (FS3_CMD_OPCODE(cmd) == FS3_OP_RDRANGE || FS3_CMD_OPCODE(cmd) == FS3_OP_WRRANGE || FS3_CMD_OPCODE(cmd) == FS3_OP_COPY) lane->load += FS3_CMD_COUNT(cmd);
+    else lane->load++;
+    if (FS3_CMD_OPCODE(cmd) != FS3_OP_TSEEK && FS3_CMD_OPCODE(cmd) != FS3_OP_RDSECT && FS3_CMD_OPCODE(cmd) != FS3_OP_RDRANGE) lane->reads = 0;
+    return 0;
+}
+
+//the connection of server srv with the least work so far, one already on trk wins a tie
+PoolLane *laneFor(int srv, FS3TrackIndex trk){
+    int first = srv * fs3_network_connections, c;
+    PoolLane *best = &poolLanes[first];
+
+    for (c = first + 1; c < first + fs3_network_connections; c++){
+        if (poolLanes[c].load < best->load || (poolLanes[c].load == best->load && poolLanes[c].track == trk)) best = &poolLanes[c];
+    }
+    return best;
+}
+
+//the mirror set holding sector sct of track trk of the volume, and where it is on each of its
+//servers: the stripe units of the volume are dealt out to the sets in turn, a row of units at
+//the same place on every set. With parity the sets are the data positions of a row, and the
+//servers holding them turn by one every row
+int stripeMap(FS3TrackIndex trk, int sct, FS3TrackIndex *ptrk, int *psct){
+    int sets = (fs3_network_servers - fs3_network_parity) / fs3_network_mirrors;
+    long blk = (long)trk * FS3_TRACK_SIZE + sct, unit = blk / fs3_network_stripe;
+    long row = unit / sets, at = row * fs3_network_stripe + blk % fs3_network_stripe;
+
+    *ptrk = at / FS3_TRACK_SIZE;
+    *psct = at % FS3_TRACK_SIZE;
+    return fs3_network_parity ? (unit % sets + row) % fs3_network_servers : unit % sets;
+}
+
+//sectors from sct on that stay together on one mirror set (a stripe unit never crosses a track)
+int stripeLeft(int sct){
+    return (fs3_network_servers > fs3_network_mirrors) ? fs3_network_stripe - sct % fs3_network_stripe : FS3_TRACK_SIZE - sct;
+}
+
+//queues the sectors [sct, sct+count) of cmds[owner], which are [psct, psct+count) of track ptrk on
+//the lane's server, on lane as one sector op or a range
+int laneSectors(PoolLane *lane, FS3CmdBlk *cmds, void **bufs, int owner, int sct, FS3TrackIndex ptrk, int psct, int count){
+    uint8_t op = FS3_CMD_OPCODE(cmds[owner]);
+    int write = (op == FS3_OP_WRSECT || op == FS3_OP_WRRANGE);
+    char *buf = (char *)bufs[owner] + (sct - FS3_CMD_SECTOR(cmds[owner])) * FS3_SECTOR_SIZE;
+    FS3CmdBlk cmd;
+
+    //each connection has its own head, so it seeks wherever it is not already
+    if (lane->track != ptrk){
+        if (laneAdd(lane, makeCmdBlock(FS3_OP_TSEEK, 0, ptrk, 0), NULL, -1) != 0) return -1;
+        lane->track = ptrk;
+        netPoolSeeks++;
+    }
+    if (op == FS3_OP_WRPART || op == FS3_OP_COPY){
+        //partial writes and copies are never split, only moved to where the sector is
+        cmd = (cmds[owner] & ~(((FS3CmdBlk)0xffff << 44) | ((FS3CmdBlk)0xffffffff << 12))) | makeCmdBlock(0, psct, ptrk, 0);
+    }
+    else if (count == 1) cmd = makeCmdBlock(write ? FS3_OP_WRSECT : FS3_OP_RDSECT, psct, ptrk, 0);
+    else cmd = makeCmdBlock(write ? FS3_OP_WRRANGE : FS3_OP_RDRANGE, psct, ptrk, 0) | (FS3CmdBlk)count;
+    return laneAdd(lane, cmd, buf, owner);
+}
+
+//queues n sectors of cmds[k] on server s, on the connection it has for the run, or, once that has
+//its share, on the next
+int laneSlices(PoolLane **lane, int *taken, int *share, int s, FS3CmdBlk *cmds, void **bufs, int k, int sct,
+        FS3TrackIndex ptrk, int psct, int n){
+    int c;
+
+    while (n > 0){
+        if (lane[s] == NULL || taken[s] == share[s]){
+            lane[s] = laneFor(s, ptrk);
+            taken[s] = 0;
+        }
+        c = (n < share[s] - taken[s]) ? n : share[s] - taken[s];
+        if (c < n) netPoolSplits++;
+        if (laneSectors(lane[s], cmds, bufs, k, sct, ptrk, psct, c) != 0) return -1;
+        sct += c;
+        psct += c;
+        n -= c;
+        taken[s] += c;
+    }
+    return 0;
+}
+
+//the replica of mirror set m reads go to this batch: the fastest lately, one not heard from yet first
+int pickReader(int m){
+    int r, best = 0;
+
+    for (r = 1; r < fs3_network_mirrors; r++){
+        if (netReplicas[m * fs3_network_mirrors + r].ewma < netReplicas[m * fs3_network_mirrors + best].ewma) best = r;
+    }
+    return best;
+}
+
+//empties every connection's share of the batch, their heads are where the last batch left them
+void poolBegin(void){
+    int c;
+
+    for (c = 0; c < poolCount; c++){
+        poolLanes[c].count = poolLanes[c].sent = poolLanes[c].done = 0;
+        poolLanes[c].load = 0;
+        poolLanes[c].track = poolLanes[c].from = poolTrack[c];
+        poolLanes[c].reads = 1;
+        poolLanes[c].finished = poolLanes[c].dropped = 0;
+        poolLanes[c].hedgedBy = poolLanes[c].hedgeOf = -1;
+    }
+}
+
+//splits a batch over the connections: the commands of every run under one seek are first cut
+//at the stripe units into the share of each server, a write going to every server of its
+//mirror set and a read to the one picked for the set. A server's share either goes to a single
+//connection of it, or, when no sector in the run is touched twice (so their order cannot
+//matter), is cut into one even slice of sectors per connection, ranges included. A copy
+//reads sectors the run does not name, so a run with one stays on a single connection
+int poolPlan(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count){
+    int i, j, k, n, m, r, s, total, sct, end, psct, len, disjoint, write;
+    int share[FS3_MAX_SERVERS], taken[FS3_MAX_SERVERS];
+    PoolLane *lane[FS3_MAX_SERVERS];
+    FS3TrackIndex ptrk;
+
+    poolBegin();
+    for (m = 0; m < fs3_network_servers / fs3_network_mirrors; m++) poolReader[m] = pickReader(m);
+
+    for (i = 0; i < count; i = j){
+        rets[i] = cmds[i];
+        if (FS3_CMD_OPCODE(cmds[i]) == FS3_OP_TSEEK){
+            //the caller's seek only moves its idea of the head, the connections seek as needed
+            poolHead = FS3_CMD_TRACK(cmds[i]);
+            j = i + 1;
+            continue;
+        }
+        if (poolHead == FS3_NO_TRACK){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: sector operation before any seek");
+            return -1;
+        }
+
+        disjoint = 1;
+        total = 0;
+        end = 0; //one past the last sector of the previous command of the run
+        for (s = 0; s < fs3_network_servers; s++) share[s] = 0;
+        for (j = i; j < count && FS3_CMD_OPCODE(cmds[j]) != FS3_OP_TSEEK; j++){
+            rets[j] = cmds[j];
+            len = (FS3_CMD_OPCODE(cmds[j]) == FS3_OP_RDRANGE || FS3_CMD_OPCODE(cmds[j]) == FS3_OP_WRRANGE) ? FS3_CMD_COUNT(cmds[j]) : 1;
+            write = (FS3_CMD_OPCODE(cmds[j]) != FS3_OP_RDSECT && FS3_CMD_OPCODE(cmds[j]) != FS3_OP_RDRANGE);
+            if (FS3_CMD_SECTOR(cmds[j]) < end || FS3_CMD_OPCODE(cmds[j]) == FS3_OP_COPY) disjoint = 0;
+            for (sct = FS3_CMD_SECTOR(cmds[j]); len > 0; sct += n, len -= n){
+                n = (len < stripeLeft(sct)) ? len : stripeLeft(sct);
+                m = stripeMap(poolHead, sct, &ptrk, &psct);
+                for (r = 0; r < fs3_network_mirrors; r++){
+                    if (write || r == poolReader[m]) share[m * fs3_network_mirrors + r] += n;
+                }
+                total += n;
+            }
+            end = sct;
+        }
+        for (s = 0; s < fs3_network_servers; s++){
+            lane[s] = NULL;
+            taken[s] = 0;
+            share[s] = (!disjoint || total == 1) ? total : (share[s] + fs3_network_connections - 1) / fs3_network_connections;
+        }
+
+        for (k = i; k < j; k++){
+            sct = FS3_CMD_SECTOR(cmds[k]);
+            len = (FS3_CMD_OPCODE(cmds[k]) == FS3_OP_RDRANGE || FS3_CMD_OPCODE(cmds[k]) == FS3_OP_WRRANGE) ? FS3_CMD_COUNT(cmds[k]) : 1;
+            write = (FS3_CMD_OPCODE(cmds[k]) != FS3_OP_RDSECT && FS3_CMD_OPCODE(cmds[k]) != FS3_OP_RDRANGE);
+            while (len > 0){
+                n = (len < stripeLeft(sct)) ? len : stripeLeft(sct);
+                if (n < len) netStripeSplits++;
+                m = stripeMap(poolHead, sct, &ptrk, &psct);
+                for (r = 0; r < fs3_network_mirrors; r++){
+                    if (!write && r != poolReader[m]) continue;
+                    if (laneSlices(lane, taken, share, m * fs3_network_mirrors + r, cmds, bufs, k, sct, ptrk, psct, n) != 0) return -1;
+                }
+                sct += n;
+                len -= n;
+            }
+        }
+    }
+    return 0;
+}
+
+//gives every payload of the planned batch a packed copy (requests) or room to land packed
+//(replies) in the arena
+int poolPack(void){
+    size_t need = 0, off = 0;
+    PoolLane *lane;
+    int c, n, raw;
+
+    for (c = 0; c < poolCount; c++){
+        lane = &poolLanes[c];
+        for (n = 0; n < lane->count; n++) need += FS3_CODEC_WIRE_MAX((FS3_REQUEST_PAYLOAD(lane->cmds[n]) + FS3_REPLY_PAYLOAD(lane->cmds[n])) / FS3_SECTOR_SIZE);
+    }
+    if (growArena(need) != 0) return -1;
+    for (c = 0; c < poolCount; c++){
+        lane = &poolLanes[c];
+        for (n = 0; n < lane->count; n++){
+            raw = FS3_REQUEST_PAYLOAD(lane->cmds[n]) + FS3_REPLY_PAYLOAD(lane->cmds[n]);
+            if (raw == 0) continue;
+            lane->cmds[n] = packRequest(lane->cmds[n], lane->bufs[n], netArena + off);
+            if (FS3_CMD_WIRE(lane->cmds[n]) || FS3_REPLY_PAYLOAD(lane->cmds[n]) > 0) lane->io[n] = netArena + off;
+            off += FS3_CODEC_WIRE_MAX(raw / FS3_SECTOR_SIZE);
+        }
+    }
+    return 0;
+}
+
+//folds a connection's reply into the caller's return block
+int poolAnswer(PoolLane *lane, int e){
+    countReply(lane->cmds[e], lane->rets[e]);
+    if (unpackReply(lane->cmds[e], &lane->rets[e], lane->io[e], lane->bufs[e]) != 0) return -1;
+    if (lane->owner[e] == -1){
+        if (FS3_CMD_RETURN(lane->rets[e])){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: pool seek to track %d failed", FS3_CMD_TRACK(lane->cmds[e]));
+            return -1;
+        }
+        return 0;
+    }
+    poolRets[lane->owner[e]] |= lane->rets[e] & ((FS3CmdBlk)1 << 11);
+    return 0;
+}
+
+//upper end of latency bucket b in microseconds, the buckets grow by half an octave
+uint64_t netBound(int b){
+    return ((uint64_t)1 << (b / 2)) * ((b & 1) ? 181 : 128) / 128;
+}
+
+//the bucket of a latency of us microseconds
+int netBucket(uint64_t us){
+    int b = 0;
+    while (b < FS3_NET_HIST_BUCKETS - 1 && us >= netBound(b)) b++;
+    return b;
+}
+
+//the latency below which pct percent of the total counts of hist fall
+uint64_t netPercentile(long *hist, long total, int pct){
+    long seen = 0;
+    int b;
+
+    for (b = 0; b < FS3_NET_HIST_BUCKETS - 1; b++){
+        seen += hist[b];
+        if (seen * 100 >= total * pct) break;
+    }
+    return netBound(b);
+}
+
+//puts how long a connection's share of the batch took into the numbers of its server: every
+//batch into how fast it is lately, one that only read into the read latencies
+void laneLatency(int c, uint64_t now){
+    PoolLane *lane = &poolLanes[c];
+    NetReplica *rep = &netReplicas[c / fs3_network_connections];
+    uint64_t us = now - lane->start + 1;
+    int b;
+
+    rep->ewma = rep->ewma ? (rep->ewma * 7 + us) / 8 : us;
+    if (!lane->reads || lane->dropped) return;
+    b = netBucket(us);
+    rep->hist[b]++;
+    rep->reads++;
+    netRecent[b]++;
+
+    //the hedging threshold follows the recent reads, older ones count half every so often
+    if (++netRecentCount == FS3_NET_RECENT){
+        for (b = 0, netRecentCount = 0; b < FS3_NET_HIST_BUCKETS; b++){
+            netRecent[b] /= 2;
+            netRecentCount += netRecent[b];
+        }
+    }
+}
+
+//gives up on the rest of a connection's share of the batch
+int laneDrop(int c, uint64_t now){
+    PoolLane *lane = &poolLanes[c];
+
+    lane->done = fs3_event_answered(c);
+    lane->dropped = 1;
+    laneLatency(c, now);
+    return fs3_event_drop(c);
+}
+
+//repeats what a connection that only reads has not answered yet on an idle connection of another
+//server of its mirror set, the one fastest lately
+int poolHedge(int c, uint64_t now){
+    PoolLane *lane = &poolLanes[c], *hedge;
+    int srv = c / fs3_network_connections, first = srv - srv % fs3_network_mirrors, s, t, n, at, best;
+    FS3TrackIndex trk = lane->from;
+
+    lane->hedgedBy = -2;
+    for (s = first, best = -1; s < first + fs3_network_mirrors; s++){
+        if (s == srv || (best != -1 && netReplicas[s].ewma >= netReplicas[best / fs3_network_connections].ewma)) continue;
+        for (t = s * fs3_network_connections; t < (s + 1) * fs3_network_connections; t++){
+            if (poolLanes[t].count == 0 && poolLanes[t].hedgeOf == -1){
+                best = t;
+                break;
+            }
+        }
+    }
+    if (best == -1) return 0;
+
+    //the repeat starts on the track the connection was on at the first unanswered entry
+    t = best;
+    hedge = &poolLanes[t];
+    at = fs3_event_answered(c);
+    for (n = 0; n < at; n++){
+        if (FS3_CMD_OPCODE(lane->cmds[n]) == FS3_OP_TSEEK) trk = FS3_CMD_TRACK(lane->cmds[n]);
+    }
+    if (at < lane->count && FS3_CMD_OPCODE(lane->cmds[at]) != FS3_OP_TSEEK && hedge->track != trk){
+        if (laneAdd(hedge, makeCmdBlock(FS3_OP_TSEEK, 0, trk, 0), NULL, -1) != 0) return -1;
+        netPoolSeeks++;
+    }
+    for (n = at; n < lane->count; n++){
+        if (laneAdd(hedge, lane->cmds[n], lane->bufs[n], lane->owner[n]) != 0) return -1;
+    }
+    for (n = 0; n < hedge->count; n++){
+        if (fs3_event_submit(t, hedge->cmds[n], hedge->io[n], &hedge->rets[n]) != 0) return -1;
+        countRequest(hedge->cmds[n]);
+    }
+    netRequests += hedge->count;
+    hedge->track = lane->track;
+    hedge->start = now;
+    hedge->hedgeOf = c;
+    lane->hedgedBy = t;
+    lane->hedgeAt = at;
+    netReplicas[srv].hedged++;
+    netHedges++;
+    return 0;
+}
+
+//runs the submitted batch of a mirrored volume: a connection that only reads and is not done
+//once most reads of late would be (the fs3_network_hedge percentile) gets a repeat on another
+//server of its mirror set, and whichever of the two finishes first answers
+int poolWatch(int window){
+    long after = -1, wait;
+    PoolLane *lane, *other;
+    uint64_t now;
+    int c, ret;
+
+    if (fs3_network_hedge > 0 && !netPacked && netRecentCount >= FS3_NET_HEDGE_SAMPLES){
+        after = netPercentile(netRecent, netRecentCount, fs3_network_hedge);
+    }
+    do{
+        wait = -1;
+        now = fs3_event_micros();
+        for (c = 0; c < poolCount && after >= 0; c++){
+            lane = &poolLanes[c];
+            if (lane->count == 0 || lane->finished || lane->dropped || !lane->reads || lane->hedgedBy != -1 || lane->hedgeOf != -1) continue;
+            if (now >= lane->start + after){
+                if (poolHedge(c, now) != 0) return -1;
+            } else if (wait < 0 || (long)(lane->start + after - now) < wait) wait = lane->start + after - now;
+        }
+        if ((ret = fs3_event_run(window, wait)) < 0) return -1;
+
+        now = fs3_event_micros();
+        for (c = 0; c < poolCount; c++){
+            lane = &poolLanes[c];
+            if (lane->count == 0 || lane->finished || lane->dropped || fs3_event_answered(c) < lane->count) continue;
+            lane->finished = 1;
+            lane->done = lane->count;
+            laneLatency(c, now);
+        }
+        for (c = 0; c < poolCount; c++){
+            lane = &poolLanes[c];
+            if (lane->hedgedBy < 0) continue;
+            other = &poolLanes[lane->hedgedBy];
+            if (lane->finished && !other->finished && !other->dropped){
+                if (laneDrop(lane->hedgedBy, now) != 0) return -1;
+            } else if (other->finished && !lane->finished && !lane->dropped){
+                if (laneDrop(c, now) != 0) return -1;
+                netReplicas[lane->hedgedBy / fs3_network_connections].won++;
+                netHedgeWins++;
+            }
+        }
+    } while (ret != 0);
+    return 0;
+}
+
+//runs a planned fan-out: every connection keeps its own window (or compound frame) in flight,
+//so the server works on all of them at once
+int poolRun(int window, int compound){
+    int c, n, busy, trips = 0, rounds;
+    PoolLane *lane;
+
+    for (c = 0, busy = 0; c < poolCount; c++){
+        lane = &poolLanes[c];
+        if (lane->count > 0) busy++;
+        rounds = compound ? (lane->count + FS3_MAX_COMPOUND - 1) / FS3_MAX_COMPOUND : (lane->count + window - 1) / window;
+        if (rounds > trips) trips = rounds;
+    }
+    netRoundTrips += trips; //the connections wait out their round trips side by side
+    if (busy > 1) netFanouts++;
+    if (netPacked && poolPack() != 0) return -1;
+
+    if (compound){
+        while (busy > 0){
+            for (c = 0; c < poolCount; c++){
+                lane = &poolLanes[c];
+                if (lane->sent == lane->count) continue;
+                sock = poolSocks[c];
+                n = (lane->count - lane->sent > FS3_MAX_COMPOUND) ? FS3_MAX_COMPOUND : lane->count - lane->sent;
+                if (compoundSend(lane->cmds + lane->sent, lane->io + lane->sent, n) != 0) return -1;
+                lane->sent += n;
+            }
+            for (c = 0, busy = 0; c < poolCount; c++){
+                lane = &poolLanes[c];
+                if (lane->done == lane->sent) continue;
+                sock = poolSocks[c];
+                n = lane->sent - lane->done;
+                if (compoundReceive(lane->cmds + lane->done, lane->rets + lane->done, lane->io + lane->done, n) != 0) return -1;
+                for (; lane->done < lane->sent; lane->done++){
+                    if (poolAnswer(lane, lane->done) != 0) return -1;
+                }
+                if (lane->done < lane->count) busy++;
+            }
+        }
+        return 0;
+    }
+
+    //an idle connection of a mirrored volume may have to take the repeat of any other's share
+    //after its entries went to the engine, so it has the room for one now
+    for (c = 0, rounds = 0; c < poolCount && fs3_network_mirrors > 1; c++){
+        if (poolLanes[c].count > rounds) rounds = poolLanes[c].count;
+    }
+    for (c = 0; c < poolCount && fs3_network_mirrors > 1; c++){
+        if (poolLanes[c].count == 0 && laneGrow(&poolLanes[c], rounds + 1) != 0) return -1;
+    }
+
+    //everything is handed to the event engine, which keeps every connection's window full at once
+    for (c = 0; c < poolCount; c++){
+        lane = &poolLanes[c];
+        lane->start = fs3_event_micros();
+        lane->done = lane->count;
+        for (n = 0; n < lane->count; n++){
+            if (fs3_event_submit(c, lane->cmds[n], lane->io[n], &lane->rets[n]) != 0) return -1;
+            countRequest(lane->cmds[n]);
+        }
+        netRequests += lane->count;
+        if ((lane->count < window ? lane->count : window) > netMaxInflight) netMaxInflight = (lane->count < window) ? lane->count : window;
+    }
+    if (fs3_network_mirrors == 1){
+        if (fs3_event_wait(window) != 0) return -1;
+    } else{
+        if (poolWatch(window) != 0){
+            fs3_event_end(1);
+            return -1;
+        }
+        fs3_event_end(0);
+    }
+
+    //a share given up on was answered by its repeat, up to where it got
+    for (c = 0; c < poolCount; c++){
+        lane = &poolLanes[c];
+        for (n = 0; n < lane->done; n++){
+            if (poolAnswer(lane, n) != 0) return -1;
+        }
+    }
+    return 0;
+}
+
+//the server holding position pos (data first, then parity) of stripe row row, and back
+int ecServer(int row, int pos){
+    return (pos + row) % fs3_network_servers;
+}
+
+int ecPosition(int row, int srv){
+    return (srv - row % fs3_network_servers + fs3_network_servers) % fs3_network_servers;
+}
+
+//scratch sector of position pos of the column in slot slot
+char *ecScratch(int slot, int pos){
+    return ecArena + ((size_t)pos * ecCount + slot) * FS3_SECTOR_SIZE;
+}
+
+//the column of the batch at place at, a new one the first time the batch touches it
+EcColumn *ecColumn(long at){
+    EcColumn *col;
+
+    if (ecMap[at] > 0) return &ecCols[ecMap[at] - 1];
+    if (ecCount == ecCap){
+        ecCap = ecCap ? ecCap * 2 : 256;
+        if ((ecCols = realloc(ecCols, ecCap * sizeof(EcColumn))) == NULL || (ecOrder = realloc(ecOrder, ecCap * sizeof(int))) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: out of memory planning parity");
+            return NULL;
+        }
+    }
+    col = &ecCols[ecCount];
+    memset(col, 0, sizeof(EcColumn));
+    col->at = at;
+    col->row = at / fs3_network_stripe;
+    ecOrder[ecCount] = ecCount;
+    ecMap[at] = ++ecCount;
+    return col;
+}
+
+//notes a read of position pos of col from a server that is down
+int ecRebuild(EcColumn *col, int pos, char *dst){
+    EcRebuild *rb;
+
+    if (ecRebuildCount == ecRebuildCap){
+        ecRebuildCap = ecRebuildCap ? ecRebuildCap * 2 : 256;
+        if ((ecRebuilds = realloc(ecRebuilds, ecRebuildCap * sizeof(EcRebuild))) == NULL){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: out of memory planning parity");
+            return -1;
+        }
+    }
+    rb = &ecRebuilds[ecRebuildCount++];
+    rb->col = col - ecCols;
+    rb->pos = pos;
+    rb->dst = dst;
+    rb->src = col->data[pos];
+    if (rb->src == NULL) col->old = 1;
+    return 0;
+}
+
+//finds the columns a batch touches: the data it leaves in them and the reads it makes of
+//servers that are down
+int ecScan(FS3CmdBlk *cmds, void **bufs, int count){
+    FS3TrackIndex head = poolHead, ptrk;
+    int i, k, n, s, len, sct, psct, pos, op;
+    EcColumn *col;
+    char *buf;
+
+    for (i = 0; i < count; i++){
+        op = FS3_CMD_OPCODE(cmds[i]);
+        if (op == FS3_OP_TSEEK){
+            head = FS3_CMD_TRACK(cmds[i]);
+            continue;
+        }
+        if (head == FS3_NO_TRACK) return 0; //poolPlan says what is wrong with the batch
+        len = (op == FS3_OP_RDRANGE || op == FS3_OP_WRRANGE) ? FS3_CMD_COUNT(cmds[i]) : 1;
+        for (sct = FS3_CMD_SECTOR(cmds[i]); len > 0; sct += n, len -= n){
+            n = (len < stripeLeft(sct)) ? len : stripeLeft(sct);
+            s = stripeMap(head, sct, &ptrk, &psct);
+            if ((op == FS3_OP_RDSECT || op == FS3_OP_RDRANGE) && !netDown[s]) continue;
+            for (k = 0; k < n; k++){
+                if ((col = ecColumn((long)ptrk * FS3_TRACK_SIZE + psct + k)) == NULL) return -1;
+                pos = ecPosition(col->row, s);
+                buf = (char *)bufs[i] + (sct - FS3_CMD_SECTOR(cmds[i]) + k) * FS3_SECTOR_SIZE;
+                if (op == FS3_OP_RDSECT || op == FS3_OP_RDRANGE){
+                    if (ecRebuild(col, pos, buf) != 0) return -1;
+                } else{
+                    col->data[pos] = buf;
+                    col->written = 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+//queues a read or write of the sector at place at on server s, straight from or into buf,
+//growing the last entry of the connection into a range when it ends right before it
+int laneRaw(PoolLane **last, int s, long at, char *buf, int write){
+    FS3TrackIndex ptrk = at / FS3_TRACK_SIZE;
+    int psct = at % FS3_TRACK_SIZE, n;
+    PoolLane *lane = last[s];
+    FS3CmdBlk cmd;
+    uint8_t op;
+
+    if (lane != NULL && lane->count > 0 && fs3_network_ranges && lane->track == ptrk){
+        cmd = lane->cmds[lane->count - 1];
+        op = FS3_CMD_OPCODE(cmd);
+        n = (op == FS3_OP_RDRANGE || op == FS3_OP_WRRANGE) ? FS3_CMD_COUNT(cmd) : 1;
+        if ((write ? (op == FS3_OP_WRSECT || op == FS3_OP_WRRANGE) : (op == FS3_OP_RDSECT || op == FS3_OP_RDRANGE)) &&
+                FS3_CMD_SECTOR(cmd) + n == psct && n < FS3_MAX_RANGE && (char *)lane->bufs[lane->count - 1] + n * FS3_SECTOR_SIZE == buf){
+            lane->cmds[lane->count - 1] = makeCmdBlock(write ? FS3_OP_WRRANGE : FS3_OP_RDRANGE, FS3_CMD_SECTOR(cmd), ptrk, 0) | (FS3CmdBlk)(n + 1);
+            lane->load++;
+            return 0;
+        }
+    }
+    lane = last[s] = laneFor(s, ptrk);
+    if (lane->track != ptrk){
+        if (laneAdd(lane, makeCmdBlock(FS3_OP_TSEEK, 0, ptrk, 0), NULL, -1) != 0) return -1;
+        lane->track = ptrk;
+        netPoolSeeks++;
+    }
+    return laneAdd(lane, makeCmdBlock(write ? FS3_OP_WRSECT : FS3_OP_RDSECT, psct, ptrk, 0), buf, -1);
+}
+
+int ecCompare(const void *a, const void *b){
+    long d = ecSort[*(const int *)a].at - ecSort[*(const int *)b].at;
+    return (d > 0) - (d < 0);
+}
+
+//queues what the columns need read before their parity can be computed: the data positions
+//the batch does not write, or, when the column needs rebuilding, every data position still
+//there and as many parity positions as there are data positions down
+int ecGather(void){
+    int data = fs3_network_servers - fs3_network_parity, k, pos, down, s;
+    PoolLane *last[FS3_MAX_SERVERS] = { NULL };
+    EcColumn *col;
+
+    for (k = 0; k < ecCount; k++){
+        col = &ecCols[ecOrder[k]];
+        col->slot = k;
+        for (pos = 0, down = 0; pos < data; pos++){
+            if (netDown[ecServer(col->row, pos)]){
+                down++;
+                if (col->data[pos] == NULL) col->degraded = 1;
+            }
+        }
+        if (col->old) col->degraded = 1;
+        for (pos = 0; pos < data; pos++){
+            s = ecServer(col->row, pos);
+            if (netDown[s] || (!col->degraded && col->data[pos] != NULL)) continue;
+            if (laneRaw(last, s, col->at, ecScratch(k, pos), 0) != 0) return -1;
+            netColumnReads++;
+        }
+        for (pos = data; col->degraded && down > 0 && pos < fs3_network_servers; pos++){
+            s = ecServer(col->row, pos);
+            if (netDown[s]) continue;
+            if (laneRaw(last, s, col->at, ecScratch(k, pos), 0) != 0) return -1;
+            netColumnReads++;
+            down--;
+        }
+    }
+    return 0;
+}
+
+//rebuilds the columns that need it from what was read, then computes the parity of those the
+//batch writes into their parity positions' scratch sectors
+int ecCode(void){
+    int data = fs3_network_servers - fs3_network_parity, k, pos, down;
+    int present[FS3_MAX_SERVERS];  // what ecGather read
+    uint8_t *shards[FS3_MAX_SERVERS];
+    EcColumn *col;
+
+    for (k = 0; k < ecCount; k++){
+        col = &ecCols[ecOrder[k]];
+        for (pos = 0; pos < fs3_network_servers; pos++) shards[pos] = (uint8_t *)ecScratch(k, pos);
+        if (col->degraded){
+            for (pos = 0, down = 0; pos < data; pos++){
+                present[pos] = !netDown[ecServer(col->row, pos)];
+                down += !present[pos];
+            }
+            for (; pos < fs3_network_servers; pos++){
+                present[pos] = down > 0 && !netDown[ecServer(col->row, pos)];
+                down -= present[pos];
+            }
+            if (fs3_erasure_decode(shards, present, FS3_SECTOR_SIZE) != 0) return -1;
+            netDegraded++;
+        }
+        if (!col->written) continue;
+        for (pos = 0; pos < data; pos++){
+            if (col->data[pos] != NULL) shards[pos] = (uint8_t *)col->data[pos];
+        }
+        fs3_erasure_encode(shards, shards + data, FS3_SECTOR_SIZE);
+    }
+    return 0;
+}
+
+//runs a batch on a volume with parity: reads what the columns it writes need (and those it
+//rebuilds), then sends the batch with the new parity of its columns, and answers the reads of
+//servers that are down from the rebuilt columns
+int ecPipeline(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count, int window, int compound){
+    int data = fs3_network_servers - fs3_network_parity, c, k, pos, ret = -1;
+    PoolLane *last[FS3_MAX_SERVERS] = { NULL };
+    EcRebuild *rb;
+    EcColumn *col;
+    size_t need;
+
+    ecCount = ecRebuildCount = 0;
+    if (ecScan(cmds, bufs, count) != 0) goto done;
+    if (ecCount > 0){
+        need = (size_t)ecCount * fs3_network_servers * FS3_SECTOR_SIZE;
+        if (need > ecArenaSize){
+            if ((ecArena = realloc(ecArena, need)) == NULL){
+                ecArenaSize = 0;
+                logMessage(LOG_ERROR_LEVEL, "FS3 network: out of memory for parity");
+                goto done;
+            }
+            ecArenaSize = need;
+        }
+        ecSort = ecCols;
+        qsort(ecOrder, ecCount, sizeof(int), ecCompare);
+
+        //the reads go side by side to every server that has some, then the heads are where they left them
+        poolBegin();
+        if (ecGather() != 0 || poolRun(window, compound) != 0) goto done;
+        for (c = 0; c < poolCount; c++) poolTrack[c] = poolLanes[c].track;
+        if (ecCode() != 0) goto done;
+    }
+
+    //the batch itself, without what servers that are down would get, and the parity after it
+    if (poolPlan(cmds, rets, bufs, count) != 0) goto done;
+    for (c = 0; c < poolCount; c++){
+        if (!netDown[c / fs3_network_connections]) continue;
+        poolLanes[c].count = 0;
+        poolLanes[c].track = poolLanes[c].from;
+    }
+    for (k = 0; k < ecCount; k++){
+        col = &ecCols[ecOrder[k]];
+        for (pos = data; col->written && pos < fs3_network_servers; pos++){
+            if (netDown[ecServer(col->row, pos)]) continue;
+            if (laneRaw(last, ecServer(col->row, pos), col->at, ecScratch(k, pos), 1) != 0) goto done;
+            netParityWrites++;
+        }
+    }
+    if (poolRun(window, compound) != 0) goto done;
+    for (k = 0; k < ecRebuildCount; k++){
+        rb = &ecRebuilds[k];
+        memcpy(rb->dst, rb->src ? rb->src : ecScratch(ecCols[rb->col].slot, rb->pos), FS3_SECTOR_SIZE);
+    }
+    netRebuilt += ecRebuildCount;
+    ret = 0;
+
+done:
+    for (k = 0; k < ecCount; k++) ecMap[ecCols[k].at] = 0;
+    return ret;
+}
+
+//sends a batch over every connection of the pool (there may be just the one), in compound frames if asked
+int poolPipeline(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count, int window, int compound){
+    uint64_t start = fs3_event_micros();
+    long long data = 0;
+    int c, ret;
+
+    for (c = 0; c < count; c++) data += FS3_REQUEST_PAYLOAD(cmds[c]);
+    poolRets = rets;
+    if (fs3_network_parity > 0) ret = ecPipeline(cmds, rets, bufs, count, window, compound);
+    else ret = (poolPlan(cmds, rets, bufs, count) == 0) ? poolRun(window, compound) : -1;
+    if (data > 0){
+        netDataWritten += data;
+        netWriteMicros += fs3_event_micros() - start;
+    }
+    sock = poolSocks[0];
+    for (c = 0; c < poolCount; c++){
+        //after a failure nobody knows where the heads are, nor after giving up on a share
+        poolTrack[c] = (ret == 0 && !poolLanes[c].dropped) ? poolLanes[c].track : FS3_NO_TRACK;
+    }
+    if (ret != 0){
+        poolHead = FS3_NO_TRACK;
+        logMessage(LOG_ERROR_LEVEL, "FS3 network: pooled batch of %d commands failed", count);
+    }
+    return ret;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -135,6 +1331,26 @@ int unmountoperations(FS3CmdBlk *cmdBlk){
 //                buf - the buffer to place received data in
 // Outputs      : 0 if successful, -1 if failure
 
+//runs a command on the in-process controller, which takes the options a server would grant
+//(partial writes, copies) but has no wire to pack payloads for; the disk comes and goes with
+//the mount
+int loopbackSyscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf){
+    uint8_t op = FS3_CMD_OPCODE(cmd);
+
+    if (op == FS3_OP_MOUNT){
+        if (fs3_controller_init(*fs3_network_loopback ? fs3_network_loopback : NULL) != 0) return -1;
+        if (fs3_network_compress) logMessage(LOG_WARNING_LEVEL, "FS3 network: nothing to pack in-process, payloads stay raw");
+        if (fs3_network_servers > 1) logMessage(LOG_WARNING_LEVEL, "FS3 network: the in-process controller is one disk, nothing to stripe over");
+        fs3_network_connections = 1;
+        fs3_network_servers = 1;
+        fs3_network_mirrors = 1;
+        netPacked = 0;
+    }
+    *ret = fs3_controller_execute(&netLoopback, cmd, buf);
+    if (op == FS3_OP_UMOUNT && fs3_controller_close() != 0) return -1;
+    return 0;
+}
+
 int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
 {
     int opret;
@@ -143,25 +1359,35 @@ int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
     deconstVals vals;
     if (deconstCmdBlock(cmd, &vals) != 0) return -1;
     logMessage(LOG_INFO_LEVEL, "OPCODE RECIEVED: %d", vals.opcode);
+    netOperations++;
+    if (vals.opcode < FS3_OP_MAXVAL) netOpcodes[vals.opcode]++;
+
+    //on a striped volume a seek only names a track of the volume, and the sector it is
+    //followed by decides which server's head moves, so single commands go the way of a batch
+    if (fs3_network_servers > 1 && vals.opcode != FS3_OP_MOUNT && vals.opcode != FS3_OP_UMOUNT){
+        return poolPipeline(&cmd, ret, &buf, 1, 1, 0);
+    }
+    if (vals.opcode != FS3_OP_UMOUNT) netRoundTrips++;
+    if (fs3_network_loopback != NULL) return loopbackSyscall(cmd, ret, buf);
     switch(vals.opcode){
         case 0:
             //mounting op
-            opret = mountoperations(&blk, &ret);
+            opret = mountoperations(&blk, ret);
             logMessage(LOG_INFO_LEVEL, "Mounted Disk, Returned: %d ", opret);
             break;
         case 1:
             //seeking op
-            opret = seekoperations(&blk, &ret); //NEED TO IMPLEMENT
+            opret = seekoperations(&blk, ret); //NEED TO IMPLEMENT
             logMessage(LOG_INFO_LEVEL, "Seeking to track: %d ", vals.trackNumber);
             break;
         case 2:
             //reading op
-            opret = readoperations(&blk, &ret, buf); //NEED TO IMPLEMENT
+            opret = readoperations(&blk, ret, buf); //NEED TO IMPLEMENT
             logMessage(LOG_INFO_LEVEL, "Reading from {sector: %d, track: %d}", vals.sectorNumber, vals.trackNumber);
             break;
         case 3:
             //writing op
-            opret = writeoperations(&blk, &ret, buf); //NEED TO IMPLEMENT
+            opret = writeoperations(&blk, ret, buf); //NEED TO IMPLEMENT
             logMessage(LOG_INFO_LEVEL, "Writing from {sector: %d, track: %d}", vals.sectorNumber, vals.trackNumber);
             break;
         case 4:
@@ -177,5 +1403,208 @@ int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
     return opret;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_pipeline
+// Description  : Send a batch of commands without waiting for each reply.
+//                With fs3_network_compound set the batch travels as compound
+//                frames of up to FS3_MAX_COMPOUND operations, one round trip
+//                each. Otherwise up to fs3_network_window requests are in
+//                flight at once and the server answers them in order, so
+//                reply i belongs to command i. The event engine moves the
+//                requests; with a pool of connections the batch is spread
+//                over all of them (see poolPlan).
+//
+// Inputs       : cmds - the command blocks to send (TSEEK, sector or range)
+//                rets - receives the returned command blocks
+//                bufs - per command payload buffer (data to write / read into)
+//                count - number of commands
+// Outputs      : 0 if every exchange completed, -1 if the connection failed
 
+int network_fs3_pipeline(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count)
+{
+    int window = fs3_network_window, i;
 
+    if (window < 1) window = 1;
+    if (window > FS3_MAX_WINDOW) window = FS3_MAX_WINDOW;
+    netBatches++;
+    netOperations += count;
+    for (i = 0; i < count; i++){
+        if (FS3_CMD_OPCODE(cmds[i]) == FS3_OP_RDRANGE || FS3_CMD_OPCODE(cmds[i]) == FS3_OP_WRRANGE) netRanges++;
+        if (FS3_CMD_OPCODE(cmds[i]) < FS3_OP_MAXVAL) netOpcodes[FS3_CMD_OPCODE(cmds[i])]++;
+    }
+
+    //in-process the batch runs in order against the controller, straight from and into bufs
+    if (fs3_network_loopback != NULL){
+        for (i = 0; i < count; i++) rets[i] = fs3_controller_execute(&netLoopback, cmds[i], bufs[i]);
+        netRoundTrips++;
+        return 0;
+    }
+    return poolPipeline(cmds, rets, bufs, count, window, fs3_network_compound && count > 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_add_servers
+// Description  : Add servers to the volume the client stripes over
+//
+// Inputs       : list - comma separated "ip" or "ip:port" (fs3_network_port
+//                       if no port is given)
+// Outputs      : 0 if successful, -1 if a server is bad or there are too many
+
+int network_add_servers(char *list)
+{
+    char *copy = strdup(list), *spec, *save, *colon;
+    unsigned short port;
+
+    for (spec = strtok_r(copy, ",", &save); spec != NULL; spec = strtok_r(NULL, ",", &save)){
+        port = 0;
+        if ((colon = strchr(spec, ':')) != NULL){
+            *colon = '\0';
+            if (sscanf(colon + 1, "%hu", &port) != 1 || port == 0) spec = NULL;
+        }
+        if (spec == NULL || inet_addr(spec) == INADDR_NONE){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: bad server [%s], must be <ip> or <ip>:<port>", list);
+            free(copy);
+            return -1;
+        }
+        if (fs3_network_servers == FS3_MAX_SERVERS){
+            logMessage(LOG_ERROR_LEVEL, "FS3 network: a volume is striped over at most %d servers", FS3_MAX_SERVERS);
+            free(copy);
+            return -1;
+        }
+        netServerAddr[fs3_network_servers] = strdup(spec);
+        netServerPort[fs3_network_servers++] = port;
+    }
+    free(copy);
+    fs3_network_address = (unsigned char *)netServerAddr[0];
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_volume_tracks
+// Description  : Count the tracks of the volume
+//
+// Inputs       : none
+// Outputs      : FS3_MAX_TRACKS for every mirror set (or data position) of the volume
+
+int network_volume_tracks(void)
+{
+    int sets = (fs3_network_servers - fs3_network_parity) / fs3_network_mirrors;
+    return FS3_MAX_TRACKS * (sets > 1 ? sets : 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_transport
+// Description  : Name the transport the connections use
+//
+// Inputs       : none
+// Outputs      : "loopback", "unix" or "tcp"
+
+char *network_transport(void)
+{
+    if (fs3_network_loopback != NULL) return "loopback";
+    return netLocal ? "unix" : "tcp";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_round_trips
+// Description  : Round trips the driver's operations took so far (a
+//                pipelined batch or compound frame is one per connection)
+//
+// Inputs       : none
+// Outputs      : the round trips
+
+long network_round_trips(void)
+{
+    return netRoundTrips;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_requests
+// Description  : Operations with an opcode the driver sent so far, for
+//                FS3_OP_COMPOUND the compound frames they went in
+//
+// Inputs       : op - the opcode
+// Outputs      : the operations, 0 for an unknown opcode
+
+long network_requests(int op)
+{
+    if (op == FS3_OP_COMPOUND) return netFrames;
+    return (op >= 0 && op < FS3_OP_MAXVAL) ? netOpcodes[op] : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_log_metrics
+// Description  : Log the round trip and syscall counts of the network layer
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int network_log_metrics(void)
+{
+    char hist[FS3_NET_HIST_BUCKETS * 24];
+    double encode, decode;
+    NetReplica *rep;
+    int s, b, n;
+
+    logMessage(LOG_OUTPUT_LEVEL, "Transport        [     %s]", network_transport());
+    logMessage(LOG_OUTPUT_LEVEL, "Round trips      [     %ld]", netRoundTrips);
+    logMessage(LOG_OUTPUT_LEVEL, "Requests by op   [     mount %ld, seek %ld, read %ld, write %ld, umount %ld, rdrange %ld, wrrange %ld, wrpart %ld, copy %ld]",
+        netOpcodes[FS3_OP_MOUNT], netOpcodes[FS3_OP_TSEEK], netOpcodes[FS3_OP_RDSECT], netOpcodes[FS3_OP_WRSECT], netOpcodes[FS3_OP_UMOUNT],
+        netOpcodes[FS3_OP_RDRANGE], netOpcodes[FS3_OP_WRRANGE], netOpcodes[FS3_OP_WRPART], netOpcodes[FS3_OP_COPY]);
+    logMessage(LOG_OUTPUT_LEVEL, "Compound frames  [     %ld]", netFrames);
+    logMessage(LOG_OUTPUT_LEVEL, "Pipelined batches[     %ld]", netBatches);
+    logMessage(LOG_OUTPUT_LEVEL, "Pipelined reqs   [     %ld]", netRequests);
+    logMessage(LOG_OUTPUT_LEVEL, "Max in flight    [     %ld]", netMaxInflight);
+    logMessage(LOG_OUTPUT_LEVEL, "Window stalls    [     %ld]", fs3_event_stalls);
+    logMessage(LOG_OUTPUT_LEVEL, "Event wakeups    [     %ld]", fs3_event_wakeups);
+    logMessage(LOG_OUTPUT_LEVEL, "Range requests   [     %ld]", netRanges);
+    logMessage(LOG_OUTPUT_LEVEL, "Servers          [     %d, stripe unit %d sectors]", fs3_network_servers, fs3_network_stripe);
+    logMessage(LOG_OUTPUT_LEVEL, "Pool connections [     %d]", fs3_network_connections);
+    logMessage(LOG_OUTPUT_LEVEL, "Fan-out batches  [     %ld]", netFanouts);
+    logMessage(LOG_OUTPUT_LEVEL, "Pool seeks       [     %ld]", netPoolSeeks);
+    logMessage(LOG_OUTPUT_LEVEL, "Split ranges     [     %ld]", netPoolSplits);
+    logMessage(LOG_OUTPUT_LEVEL, "Stripe splits    [     %ld]", netStripeSplits);
+    if (fs3_network_mirrors > 1){
+        logMessage(LOG_OUTPUT_LEVEL, "Mirror sets      [     %d, %d servers each]", fs3_network_servers / fs3_network_mirrors, fs3_network_mirrors);
+        logMessage(LOG_OUTPUT_LEVEL, "Hedged reads     [     %ld, %ld answered by the repeat]", netHedges, netHedgeWins);
+    }
+    for (s = 0; s < fs3_network_servers && fs3_network_servers > 1; s++){
+        rep = &netReplicas[s];
+        logMessage(LOG_OUTPUT_LEVEL, "Server %-2d reads  [     %ld, p50 %lu p90 %lu p99 %lu usec, %ld hedged away, %ld hedges won]", s, rep->reads,
+            netPercentile(rep->hist, rep->reads, 50), netPercentile(rep->hist, rep->reads, 90), netPercentile(rep->hist, rep->reads, 99),
+            rep->hedged, rep->won);
+        for (b = 0, n = 0; b < FS3_NET_HIST_BUCKETS; b++){
+            if (rep->hist[b] > 0) n += snprintf(hist + n, sizeof(hist) - n, " <%lu:%ld", netBound(b), rep->hist[b]);
+        }
+        if (n > 0) logMessage(LOG_OUTPUT_LEVEL, "Server %-2d hist   [    %s]", s, hist);
+    }
+    if (fs3_network_parity > 0){
+        logMessage(LOG_OUTPUT_LEVEL, "Parity servers   [     %d data + %d parity, %d down]", fs3_network_servers - fs3_network_parity, fs3_network_parity, netDownCount);
+        logMessage(LOG_OUTPUT_LEVEL, "Parity writes    [     %ld sectors, %ld sectors read for them]", netParityWrites, netColumnReads);
+        logMessage(LOG_OUTPUT_LEVEL, "Rebuilt columns  [     %ld, answering %ld reads]", netDegraded, netRebuilt);
+        logMessage(LOG_OUTPUT_LEVEL, "Erasure coding   [     %.1f MB encoded at %.2f GB/s, %.1f MB rebuilt at %.2f GB/s]",
+            fs3_erasure_encoded / 1e6, fs3_erasure_encode_nsec ? (double)fs3_erasure_encoded / fs3_erasure_encode_nsec : 0.0,
+            fs3_erasure_decoded / 1e6, fs3_erasure_decode_nsec ? (double)fs3_erasure_decoded / fs3_erasure_decode_nsec : 0.0);
+        if (fs3_erasure_bench(FS3_NET_BENCH_SHARD, &encode, &decode) == 0){
+            logMessage(LOG_OUTPUT_LEVEL, "Erasure kernel   [     %s, encode %.2f GB/s, rebuild %.2f GB/s on %d KB shards]", fs3_erasure_kernel(),
+                encode, decode, FS3_NET_BENCH_SHARD / 1024);
+        }
+    }
+    logMessage(LOG_OUTPUT_LEVEL, "Write bandwidth  [     %.1f MB at %.1f MB/s, %.2f bytes sent per byte]", netDataWritten / 1e6,
+        netWriteMicros ? (double)netDataWritten / netWriteMicros : 0.0, netDataWritten ? (double)netStoredBytes / netDataWritten : 0.0);
+    logMessage(LOG_OUTPUT_LEVEL, "Socket syscalls  [     %ld]", netSyscalls + fs3_event_syscalls);
+    logMessage(LOG_OUTPUT_LEVEL, "Syscalls per op  [     %.2f]", netOperations ? (netSyscalls + fs3_event_syscalls) / (float)netOperations : 0.0);
+    logMessage(LOG_OUTPUT_LEVEL, "Network bytes    [     %lld out, %lld in]", netBytesOut, netBytesIn);
+    logMessage(LOG_OUTPUT_LEVEL, "Packed payloads  [     %s]", netPacked ? "yes" : "no");
+    logMessage(LOG_OUTPUT_LEVEL, "Packed sectors   [     %ld packed, %ld raw]", netPackedSectors, netRawSectors);
+    logMessage(LOG_OUTPUT_LEVEL, "Payload on wire  [     %lld of %lld bytes, %.1f%%]", netWireBytes, netPayloadBytes,
+        netPayloadBytes ? 100.0 * netWireBytes / netPayloadBytes : 100.0);
+    return 0;
+}
@@ -20,11 +20,113 @@
 #define FS3_NET_HEADER_SIZE sizeof(FS3CmdBlk)
 #define FS3_DEFAULT_IP "127.0.0.1"
 #define FS3_DEFAULT_PORT 22887
+#define FS3_UNIX_PATH_FORMAT "/tmp/fs3_server.%d.sock" // Unix domain socket of the server on a port
+#define FS3_MAX_WINDOW 64           // Most requests a pipelined batch keeps in flight
+#define FS3_MAX_COMPOUND 1024       // Most operations carried by one compound frame
+#define FS3_MAX_IOV 1024            // Most iovecs handed to one writev/readv (the Linux UIO_MAXIOV)
+#define FS3_MAX_CONNECTIONS 16      // Most connections in the pool
+#define FS3_POOL_MOUNT_WAIT 2       // Seconds an extra connection waits for its MOUNT reply
+#define FS3_MAX_SERVERS 4           // Most servers a volume is striped over (its tracks stay below FS3_NO_TRACK)
+#define FS3_VOLUME_TRACKS (FS3_MAX_TRACKS * FS3_MAX_SERVERS) // Most tracks a striped volume has
+#define FS3_DEFAULT_STRIPE 64       // Sectors in a stripe unit
+#define FS3_DEFAULT_HEDGE 95        // Percentile of recent read latency after which a mirrored read is hedged
+#define FS3_NET_HEDGE_SAMPLES 16    // Reads seen before the first hedge
+#define FS3_NET_RECENT 256          // Reads after which the older ones count half for hedging
+#define FS3_NET_HIST_BUCKETS 48     // Latency buckets, half an octave each from 1 usec
+#define FS3_NET_BENCH_SHARD 65536   // Shard length the erasure kernels are measured on for the metrics
+
+//
+// Compound frames (FS3_OP_COMPOUND)
+//
+//   request : header block (opcode COMPOUND, sector field = operation count)
+//             then per operation its command block, followed by its
+//             FS3_REQUEST_PAYLOAD (the sectors of a WRSECT/WRRANGE)
+//   reply   : header block (return bit set if any operation failed)
+//             then per operation its reply block, followed by its
+//             FS3_REPLY_PAYLOAD (the sectors of a RDSECT/RDRANGE)
+//
+// Operations run in order on the server, so a TSEEK applies to the ones
+// after it in the same frame.
+
+//
+// Packed payloads
+//
+//   A client sets FS3_MOUNT_PACK in its MOUNT; a server that keeps the bit
+//   in the reply may pack (fs3_codec.h) any sector payload from then on, in
+//   either direction. A packed payload's length goes in FS3_CMD_WIRE of the
+//   block in front of it, a block with none there is followed by the raw
+//   payload. fs3_server clears the bit, so its sessions stay raw.
+//
+// Partial writes (FS3_OP_WRPART)
+//
+//   Asked for with FS3_MOUNT_PATCH the same way. The block names the sector
+//   and, in its count field, the number of bytes; the payload is the byte
+//   offset in the sector (FS3_WRPART_HEADER bytes, big-endian) then the
+//   bytes. The server merges them into the sector, so the client neither
+//   reads the sector first nor sends the rest of it.
+//
+// Copies (FS3_OP_COPY)
+//
+//   Asked for with FS3_MOUNT_COPY. The block names the first sector to
+//   write on the current track and, in its count field, the number of
+//   sectors; the payload is the track and first sector to read them from
+//   (FS3_COPY_HEADER bytes, two big-endian 16 bit values). The sectors
+//   move inside the server, nothing but the request crosses the wire.
+
+//
+// Striping
+//
+//   With several servers the client sees one volume of FS3_MAX_TRACKS
+//   tracks per server. Sector n of the volume (track * FS3_TRACK_SIZE +
+//   sector) is in stripe unit n / fs3_network_stripe, and the units are
+//   dealt out to the servers in turn. Each server keeps its own head, and
+//   requests to different servers go out side by side. Copies need both
+//   ends on one server, so they go through the client when striping.
+//
+// Mirroring
+//
+//   With fs3_network_mirrors > 1 every fs3_network_mirrors servers in a
+//   row hold the same sectors, and the stripe units go to these mirror
+//   sets instead. A write goes to every server of its set, a batch's
+//   reads to the one that has been fastest lately. A connection that
+//   only reads and takes longer than the fs3_network_hedge percentile of
+//   recent reads has the rest of its share repeated on an idle connection
+//   of another server of the set. The first of the two to finish answers,
+//   and the replies still owed to the other are read and thrown away.
+//
+// Parity
+//
+//   With fs3_network_parity = m > 0 the volume is striped over the first
+//   n = servers - m positions of every row of stripe units and the other
+//   m hold parity (fs3_erasure.c), so it keeps n/(n+m) of the raw space
+//   and survives any m servers being down. The sector at the same place on
+//   every server of a row forms a column. Row r turns the positions by r
+//   servers, which spreads the parity writes over all of them. A batch
+//   that writes part of a column first reads what it needs of the rest to
+//   compute the column's new parity, then writes data and parity
+//   together. A server that cannot be reached at mount is left out while
+//   at most m are. Its writes are dropped, and its reads are rebuilt from
+//   the rest of the column, read side by side from the others.
 
 
 // Global data
 extern unsigned char *fs3_network_address;     // Address of FS3 server
 extern unsigned short fs3_network_port;        // Port of FS3 server
+extern int fs3_network_window;                 // Requests in flight per batch (1 = stop-and-wait)
+extern int fs3_network_compound;               // Send batches as one FS3_OP_COMPOUND frame
+extern int fs3_network_ranges;                 // Server accepts FS3_OP_RDRANGE/FS3_OP_WRRANGE
+extern int fs3_network_connections;            // Connections batches are spread over (each has its own head)
+extern int fs3_network_local;                  // Reach a server on this host over its Unix domain socket
+extern char *fs3_network_unix_path;            // That socket (FS3_UNIX_PATH_FORMAT for the port if NULL)
+extern int fs3_network_compress;               // Ask the server for packed payloads at mount
+extern int fs3_network_patch;                  // Send FS3_OP_WRPART for partial sectors (cleared at mount if refused)
+extern int fs3_network_copy;                   // Send FS3_OP_COPY for fs3_copy (cleared at mount if refused)
+extern char *fs3_network_loopback;             // Run the controller in-process on this image ("" for memory), no server
+extern int fs3_network_servers;                // Servers the volume is striped over (0 until any is named)
+extern int fs3_network_stripe;                 // Sectors per stripe unit, a power of two up to FS3_TRACK_SIZE
+extern int fs3_network_mirrors;                // Servers in every mirror set (1 for no mirroring)
+extern int fs3_network_hedge;                  // Percentile of read latency after which a mirrored read is hedged, 0 never
+extern int fs3_network_parity;                 // Servers of every row holding parity (0 for none)
 
 //
 // Functional Prototypes
@@ -32,5 +134,27 @@ extern unsigned short fs3_network_port;        // Port of FS3 server
 int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
 	// This is the client/network system call for communicating with controller
 
+int network_fs3_pipeline(FS3CmdBlk *cmds, FS3CmdBlk *rets, void **bufs, int count);
+	// Sends a batch of TSEEK/sector/range commands, as one compound frame or with
+	// up to fs3_network_window in flight
+
+int network_add_servers(char *list);
+	// Add the comma separated servers ("ip" or "ip:port") of list to the volume, -1 if one is bad
+
+int network_volume_tracks(void);
+	// Tracks of the volume, FS3_MAX_TRACKS for every mirror set (or data position)
+
+char *network_transport(void);
+	// Name of the transport the connections use ("loopback", "unix" or "tcp")
+
+long network_round_trips(void);
+	// Round trips the driver's operations took so far
+
+long network_requests(int op);
+	// Operations with opcode op sent so far (compound frames for FS3_OP_COMPOUND)
+
+int network_log_metrics(void);
+	// Log the round trip and syscall counts of the network layer
+
 
 #endif
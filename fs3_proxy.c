@@ -0,0 +1,664 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_proxy.c
+//  Description    : This is the main program of a link shaping proxy for the
+//                   FS3 protocol. It sits between fs3_client and a server,
+//                   reads every request and reply as whole FS3 messages (a
+//                   command block plus its payload, compound frames
+//                   included), and holds each back the way a real link
+//                   would: half the round trip each way plus jitter,
+//                   serialized at the link bandwidth, plus any delay set
+//                   for the request's opcode. Requests stay pipelined, and
+//                   the proxy counts the operations of every opcode.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define FS3_PROXY_ARGUMENTS "hvl:p:i:r:d:j:b:o:"
+#define FS3_PROXY_DEFAULT_PORT (FS3_DEFAULT_PORT + 1)
+#define USAGE \
+	"USAGE: fs3_proxy [-h] [-v] [-l <logfile>] [-p <port>] [-i <server ip>] [-r <server port>] [-d <usec>] [-j <usec>]\n" \
+	"                 [-b <Mbit/s>] [-o <opcode>:<usec>]...\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on (22888 by default)\n" \
+	"    -i - IP address of the server to forward to\n" \
+	"    -r - port number of the server to forward to\n" \
+	"    -d - round trip time of the link in microseconds, half of it each way\n" \
+	"    -j - add up to <usec> microseconds of random delay to every message\n" \
+	"    -b - limit the link to <Mbit/s> each way, shared by all connections\n" \
+	"    -o - hold every request with opcode <opcode> (0-9) back by <usec> microseconds more\n" \
+	"\n" \
+
+// A forwarded request whose reply is still to come
+typedef struct FS3ProxyRequest {
+	FS3CmdBlk *cmds;              // the command blocks (host order), the operations of a compound frame
+	int count;                    // number of them
+	int compound;                 // the request is a compound frame
+	struct FS3ProxyRequest *next;
+} FS3ProxyRequest;
+
+// A message on its way through one direction of the link
+typedef struct FS3ProxyPacket {
+	char *msg;
+	int len;
+	uint64_t due;                 // microsecond time it comes out of the link
+	struct FS3ProxyPacket *next;
+} FS3ProxyPacket;
+
+// One direction of a connection: messages go in as they are read and out to fd once due
+typedef struct {
+	int fd;
+	FS3ProxyPacket *head, *tail;
+	int closed;                   // no more messages will be queued
+	long long bytes;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_t thread;
+} FS3ProxyLink;
+
+// One client connection and its connection to the server
+typedef struct {
+	int id;
+	int client, server;           // the two sockets
+	FS3ProxyRequest *head, *tail; // forwarded requests in order, the replies come back in that order
+	int closed;                   // no more requests will be queued
+	pthread_mutex_t lock;
+	pthread_cond_t queued;
+	FS3ProxyLink up, down;        // towards the server, towards the client
+	unsigned int seed;            // jitter of the request direction
+	long ops[FS3_OP_MAXVAL];
+} FS3ProxyConnection;
+
+// A message read off one side
+typedef struct {
+	char *msg;
+	int len;
+	int cap;
+} FS3ProxyMessage;
+
+//
+// Global Data
+long fs3ProxyDelay = 0;                 // round trip time, microseconds
+long fs3ProxyJitter = 0;                // largest random delay per message, microseconds
+long fs3ProxyBandwidth = 0;             // Mbit/s each way, 0 for no limit
+long fs3ProxyOpDelay[FS3_OP_MAXVAL];    // added to a request per operation of the opcode, microseconds
+uint64_t linkUp, linkDown;              // nanosecond times the uplink / downlink next fall idle
+long proxyOps[FS3_OP_MAXVAL];           // operations forwarded over all connections
+pthread_mutex_t linkLock = PTHREAD_MUTEX_INITIALIZER;
+volatile sig_atomic_t fs3ProxyStop = 0; // SIGINT/SIGTERM seen, shut down
+char *fs3OpNames[FS3_OP_MAXVAL] = { "mount", "seek", "read", "write", "umount", "compound", "rdrange", "wrrange", "wrpart", "copy" };
+
+//
+// Functional Prototypes
+
+void *connection_thread(void *arg);  // Read the requests of a connection, then log its counts
+void *reply_thread(void *arg);       // Read the replies of a connection
+void *link_thread(void *arg);        // Deliver the messages of one direction once they are due
+int read_request(FS3ProxyConnection *conn, FS3ProxyMessage *msg, FS3ProxyRequest *req);
+	// Read one request (a compound frame as a whole) off the client
+int read_reply(FS3ProxyConnection *conn, FS3ProxyRequest *req, FS3ProxyMessage *msg);
+	// Read the reply to req off the server
+
+//
+// Functions
+
+//asks the accept loop to stop
+void stopProxy(int sig) {
+	fs3ProxyStop = 1;
+}
+
+//current time in microseconds
+uint64_t nowMicros(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//when a message of len bytes that arrived at now (microseconds) is through its direction of the
+//link: behind whatever is already on its way, then half the round trip, the jitter and extra
+//on top. Messages never overtake each other, so jitter only ever adds.
+uint64_t linkDue(uint64_t *link, uint64_t now, long len, long extra, unsigned int *seed) {
+	uint64_t due;
+
+	pthread_mutex_lock(&linkLock);
+	*link = ((*link > now * 1000) ? *link : now * 1000) + (fs3ProxyBandwidth ? (uint64_t)len * 8000 / fs3ProxyBandwidth : 0);
+	due = *link / 1000 + fs3ProxyDelay / 2 + extra;
+	pthread_mutex_unlock(&linkLock);
+	if (fs3ProxyJitter > 0) due += rand_r(seed) % (fs3ProxyJitter + 1);
+	return(due);
+}
+
+//waits until the microsecond time due
+void waitUntil(uint64_t due) {
+	uint64_t now = nowMicros();
+	if (due > now) usleep(due - now);
+}
+
+//reads exactly len bytes, 0 on success, -1 on error or end of stream
+int readExactly(int fd, void *buf, int len) {
+	int got = 0, r;
+	while (got < len) {
+		r = read(fd, (char *)buf + got, len - got);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return(-1);
+		got += r;
+	}
+	return(0);
+}
+
+//writes exactly len bytes, 0 on success, -1 on error
+int writeExactly(int fd, void *buf, int len) {
+	int put = 0, w;
+	while (put < len) {
+		w = write(fd, (char *)buf + put, len - put);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) return(-1);
+		put += w;
+	}
+	return(0);
+}
+
+//reads len more bytes of a message off fd onto its end
+int readMore(int fd, FS3ProxyMessage *msg, int len) {
+	char *grown;
+
+	if (msg->len + len > msg->cap) {
+		if ((grown = realloc(msg->msg, msg->len + len + FS3_SECTOR_SIZE)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "FS3 proxy: out of memory for a message");
+			return(-1);
+		}
+		msg->msg = grown;
+		msg->cap = msg->len + len + FS3_SECTOR_SIZE;
+	}
+	if (readExactly(fd, msg->msg + msg->len, len) != 0) return(-1);
+	msg->len += len;
+	return(0);
+}
+
+//reads a command block and converts it to host order
+int readBlock(int fd, FS3ProxyMessage *msg, FS3CmdBlk *blk) {
+	if (readMore(fd, msg, sizeof(FS3CmdBlk)) != 0) return(-1);
+	memcpy(blk, msg->msg + msg->len - sizeof(FS3CmdBlk), sizeof(FS3CmdBlk));
+	*blk = ntohll64(*blk);
+	return(0);
+}
+
+//starts one direction of a connection, delivering to fd
+int openLink(FS3ProxyLink *link, int fd) {
+	link->fd = fd;
+	pthread_mutex_init(&link->lock, NULL);
+	pthread_cond_init(&link->ready, NULL);
+	if (pthread_create(&link->thread, NULL, link_thread, link) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "FS3 proxy: cannot start a link thread");
+		return(-1);
+	}
+	return(0);
+}
+
+//queues a message (which the link then owns) to come out at due
+void sendLink(FS3ProxyLink *link, FS3ProxyMessage *msg, uint64_t due) {
+	FS3ProxyPacket *pkt = malloc(sizeof(FS3ProxyPacket));
+
+	if (pkt == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "FS3 proxy: out of memory for a message");
+		free(msg->msg);
+	} else {
+		pkt->msg = msg->msg;
+		pkt->len = msg->len;
+		pkt->due = due;
+		pkt->next = NULL;
+		pthread_mutex_lock(&link->lock);
+		if (link->tail != NULL) link->tail->next = pkt;
+		else link->head = pkt;
+		link->tail = pkt;
+		link->bytes += pkt->len;
+		pthread_cond_signal(&link->ready);
+		pthread_mutex_unlock(&link->lock);
+	}
+	msg->msg = NULL;
+	msg->len = msg->cap = 0;
+}
+
+//lets a link deliver what it holds, then stops it
+void closeLink(FS3ProxyLink *link) {
+	pthread_mutex_lock(&link->lock);
+	link->closed = 1;
+	pthread_cond_signal(&link->ready);
+	pthread_mutex_unlock(&link->lock);
+	pthread_join(link->thread, NULL);
+	pthread_mutex_destroy(&link->lock);
+	pthread_cond_destroy(&link->ready);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 proxy
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, listener, fd, clients = 0, one = 1, op;
+	long usec;
+	FS3ProxyConnection *conn;
+	pthread_t thread;
+	unsigned short port = FS3_PROXY_DEFAULT_PORT, rport = FS3_DEFAULT_PORT;
+	char *address = FS3_DEFAULT_IP;
+	struct sockaddr_in v4, server;
+	struct sigaction stop;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_PROXY_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the port to listen on
+			if ( sscanf(optarg, "%hu", &port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'i': // Set the server address
+			if ( inet_addr(optarg) == INADDR_NONE ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", optarg );
+				return(-1);
+			}
+			address = optarg;
+			break;
+
+		case 'r': // Set the server port
+			if ( sscanf(optarg, "%hu", &rport) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad server port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'd': // Set the round trip time
+			if ( sscanf(optarg, "%ld", &fs3ProxyDelay) != 1 || fs3ProxyDelay < 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad round trip time [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'j': // Set the jitter
+			if ( sscanf(optarg, "%ld", &fs3ProxyJitter) != 1 || fs3ProxyJitter < 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad jitter [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'b': // Set the link bandwidth
+			if ( sscanf(optarg, "%ld", &fs3ProxyBandwidth) != 1 || fs3ProxyBandwidth < 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad link bandwidth [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'o': // Set the delay of one opcode
+			if ( sscanf(optarg, "%d:%ld", &op, &usec) != 2 || op < 0 || op >= FS3_OP_MAXVAL || usec < 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad opcode delay [%s], must be <opcode>:<usec>", optarg );
+				return(-1);
+			}
+			fs3ProxyOpDelay[op] = usec;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	FS3ControllerLLevel = registerLogLevel("FS3_CONTROLLER", 0); // Controller log level
+	if ( verbose ) {
+		enableLogLevels(FS3ControllerLLevel);
+	}
+
+	// Setup the listening socket, a signal stops the proxy (accept is not restarted)
+	memset(&stop, 0, sizeof(stop));
+	stop.sa_handler = stopProxy;
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	v4.sin_family = AF_INET;
+	v4.sin_port = htons(port);
+	v4.sin_addr.s_addr = htonl(INADDR_ANY);
+	server.sin_family = AF_INET;
+	server.sin_port = htons(rport);
+	server.sin_addr.s_addr = inet_addr(address);
+	listener = socket(PF_INET, SOCK_STREAM, 0);
+	if ( (listener == -1) ||
+			(setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0) ||
+			(bind(listener, (struct sockaddr *)&v4, sizeof(v4)) != 0) ||
+			(listen(listener, FS3_MAX_BACKLOG) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 proxy: cannot listen on port %d [%s]", port, strerror(errno) );
+		return( -1 );
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 proxy on port %d forwarding to %s:%d, round trip %ld usec, jitter %ld usec, bandwidth %ld Mbit/s%s",
+		port, address, rport, fs3ProxyDelay, fs3ProxyJitter, fs3ProxyBandwidth, fs3ProxyBandwidth ? "" : " (unlimited)" );
+
+	// Every client gets its own connection to the server and a thread for each direction
+	while ( !fs3ProxyStop ) {
+		if ( (fd = accept(listener, NULL, NULL)) == -1 ) continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if ( (conn = calloc(1, sizeof(FS3ProxyConnection))) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 proxy: out of memory for a connection" );
+			close(fd);
+			continue;
+		}
+		conn->id = clients++;
+		conn->client = fd;
+		conn->seed = (unsigned int)nowMicros() ^ conn->id;
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_cond_init(&conn->queued, NULL);
+		if ( ((conn->server = socket(PF_INET, SOCK_STREAM, 0)) == -1) ||
+				(connect(conn->server, (struct sockaddr *)&server, sizeof(server)) != 0) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 proxy: cannot reach the server at %s:%d [%s]", address, rport, strerror(errno) );
+			if ( conn->server != -1 ) close(conn->server);
+			close(fd);
+			free(conn);
+			continue;
+		}
+		setsockopt(conn->server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if ( pthread_create(&thread, NULL, connection_thread, conn) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 proxy: cannot start a thread for the connection" );
+			close(conn->server);
+			close(fd);
+			free(conn);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	// Report what went through
+	close(listener);
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 proxy: stopping after %d connections", clients );
+	pthread_mutex_lock(&linkLock);
+	for ( op = 0; op < FS3_OP_MAXVAL; op++ ) {
+		logMessage( LOG_OUTPUT_LEVEL, "Proxied %-8s [     %ld]", fs3OpNames[op], proxyOps[op] );
+	}
+	pthread_mutex_unlock(&linkLock);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connection_thread
+// Description  : Read the requests of a connection and put each on the link
+//                to the server, then log what the connection did
+//
+// Inputs       : arg - the connection
+// Outputs      : NULL
+
+void *connection_thread(void *arg) {
+	FS3ProxyConnection *conn = arg;
+	FS3ProxyMessage msg = { NULL, 0, 0 };
+	FS3ProxyRequest *req;
+	pthread_t replies;
+	long extra;
+	int i, op, umount = 0;
+
+	if ( openLink(&conn->up, conn->server) != 0 ) {
+		close(conn->server);
+		close(conn->client);
+		free(conn);
+		return(NULL);
+	}
+	if ( (openLink(&conn->down, conn->client) != 0) || (pthread_create(&replies, NULL, reply_thread, conn) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 proxy: cannot start the threads of a connection" );
+		exit( -1 );
+	}
+
+	// A request is on the link from the moment it is read, so pipelined ones overlap
+	while ( !umount ) {
+		if ( (req = calloc(1, sizeof(FS3ProxyRequest))) == NULL || read_request(conn, &msg, req) != 0 ) {
+			if ( req != NULL ) free(req->cmds);
+			free(req);
+			break;
+		}
+		extra = 0;
+		for ( i = 0; i < req->count; i++ ) {
+			op = FS3_CMD_OPCODE(req->cmds[i]);
+			extra += fs3ProxyOpDelay[op];
+			conn->ops[op]++;
+		}
+		if ( req->compound ) conn->ops[FS3_OP_COMPOUND]++;
+
+		// The reply thread waits for the reply to everything but an UMOUNT, which has none
+		umount = (!req->compound && FS3_CMD_OPCODE(req->cmds[0]) == FS3_OP_UMOUNT);
+		if ( umount ) {
+			free(req->cmds);
+			free(req);
+		} else {
+			pthread_mutex_lock(&conn->lock);
+			if ( conn->tail != NULL ) conn->tail->next = req;
+			else conn->head = req;
+			conn->tail = req;
+			pthread_cond_signal(&conn->queued);
+			pthread_mutex_unlock(&conn->lock);
+		}
+		sendLink(&conn->up, &msg, linkDue(&linkUp, nowMicros(), msg.len, extra, &conn->seed));
+	}
+	free(msg.msg);
+
+	// Everything read goes through, then the server sees the end of the stream and the replies drain
+	closeLink(&conn->up);
+	shutdown(conn->server, SHUT_WR);
+	pthread_mutex_lock(&conn->lock);
+	conn->closed = 1;
+	pthread_cond_signal(&conn->queued);
+	pthread_mutex_unlock(&conn->lock);
+	pthread_join(replies, NULL);
+	closeLink(&conn->down);
+	close(conn->server);
+	close(conn->client);
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 proxy: client %d done [mount %ld, seek %ld, read %ld, write %ld, compound %ld, "
+		"rdrange %ld, wrrange %ld, wrpart %ld, copy %ld; %lld bytes up, %lld down]", conn->id, conn->ops[FS3_OP_MOUNT],
+		conn->ops[FS3_OP_TSEEK], conn->ops[FS3_OP_RDSECT], conn->ops[FS3_OP_WRSECT], conn->ops[FS3_OP_COMPOUND],
+		conn->ops[FS3_OP_RDRANGE], conn->ops[FS3_OP_WRRANGE], conn->ops[FS3_OP_WRPART], conn->ops[FS3_OP_COPY],
+		conn->up.bytes, conn->down.bytes );
+	pthread_mutex_lock(&linkLock);
+	for ( i = 0; i < FS3_OP_MAXVAL; i++ ) proxyOps[i] += conn->ops[i];
+	pthread_mutex_unlock(&linkLock);
+	while ( conn->head != NULL ) {
+		req = conn->head;
+		conn->head = req->next;
+		free(req->cmds);
+		free(req);
+	}
+	pthread_mutex_destroy(&conn->lock);
+	pthread_cond_destroy(&conn->queued);
+	free(conn);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reply_thread
+// Description  : Read the replies of a connection, in the order of the
+//                requests, and put each on the link to the client
+//
+// Inputs       : arg - the connection
+// Outputs      : NULL
+
+void *reply_thread(void *arg) {
+	FS3ProxyConnection *conn = arg;
+	FS3ProxyMessage msg = { NULL, 0, 0 };
+	FS3ProxyRequest *req;
+	unsigned int seed = conn->seed * 31 + 7;
+
+	while ( 1 ) {
+		pthread_mutex_lock(&conn->lock);
+		while ( conn->head == NULL && !conn->closed ) pthread_cond_wait(&conn->queued, &conn->lock);
+		req = conn->head;
+		pthread_mutex_unlock(&conn->lock);
+		if ( (req == NULL) || (read_reply(conn, req, &msg) != 0) ) break;
+		sendLink(&conn->down, &msg, linkDue(&linkDown, nowMicros(), msg.len, 0, &seed));
+
+		pthread_mutex_lock(&conn->lock);
+		conn->head = req->next;
+		if ( conn->head == NULL ) conn->tail = NULL;
+		pthread_mutex_unlock(&conn->lock);
+		free(req->cmds);
+		free(req);
+	}
+
+	// A server that is gone ends the client's side as well
+	free(msg.msg);
+	shutdown(conn->client, SHUT_RD);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : link_thread
+// Description  : Deliver the messages of one direction of a connection in
+//                order, each once it is due
+//
+// Inputs       : arg - the link
+// Outputs      : NULL
+
+void *link_thread(void *arg) {
+	FS3ProxyLink *link = arg;
+	FS3ProxyPacket *pkt;
+	int broken = 0;
+
+	while ( 1 ) {
+		pthread_mutex_lock(&link->lock);
+		while ( link->head == NULL && !link->closed ) pthread_cond_wait(&link->ready, &link->lock);
+		pkt = link->head;
+		if ( pkt != NULL ) {
+			link->head = pkt->next;
+			if ( link->head == NULL ) link->tail = NULL;
+		}
+		pthread_mutex_unlock(&link->lock);
+		if ( pkt == NULL ) break;
+
+		// Once the other end is gone the rest is dropped
+		waitUntil(pkt->due);
+		if ( !broken && writeExactly(link->fd, pkt->msg, pkt->len) != 0 ) {
+			broken = 1;
+			shutdown(link->fd, SHUT_RDWR);
+		}
+		free(pkt->msg);
+		free(pkt);
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_request
+// Description  : Read one request off the client, a compound frame with all
+//                of its operations, and note the command blocks its reply
+//                will follow
+//
+// Inputs       : conn - the connection
+//                msg - receives the request as it goes on to the server
+//                req - receives the command blocks
+// Outputs      : 0 if successful, -1 if the client is gone or sent an
+//                opcode the protocol does not have
+
+int read_request(FS3ProxyConnection *conn, FS3ProxyMessage *msg, FS3ProxyRequest *req) {
+	FS3CmdBlk cmd;
+	int i;
+
+	if ( readBlock(conn->client, msg, &cmd) != 0 ) return(-1);
+	if ( FS3_CMD_OPCODE(cmd) >= FS3_OP_MAXVAL ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 proxy: client %d sent bad opcode %d", conn->id, (int)FS3_CMD_OPCODE(cmd) );
+		return(-1);
+	}
+	req->compound = (FS3_CMD_OPCODE(cmd) == FS3_OP_COMPOUND);
+	req->count = req->compound ? FS3_CMD_SECTOR(cmd) : 1;
+	if ( req->count > FS3_MAX_COMPOUND || (req->cmds = calloc(req->count ? req->count : 1, sizeof(FS3CmdBlk))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 proxy: client %d sent a frame of %d operations", conn->id, req->count );
+		return(-1);
+	}
+	if ( !req->compound ) {
+		req->cmds[0] = cmd;
+		return(readMore(conn->client, msg, FS3_REQUEST_WIRE(cmd)));
+	}
+	for ( i = 0; i < req->count; i++ ) {
+		if ( readBlock(conn->client, msg, &req->cmds[i]) != 0 ) return(-1);
+		if ( FS3_CMD_OPCODE(req->cmds[i]) >= FS3_OP_MAXVAL ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 proxy: client %d sent bad opcode %d in a compound frame", conn->id,
+				(int)FS3_CMD_OPCODE(req->cmds[i]) );
+			return(-1);
+		}
+		if ( readMore(conn->client, msg, FS3_REQUEST_WIRE(req->cmds[i])) != 0 ) return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_reply
+// Description  : Read the reply to a request off the server, each reply
+//                block says how long a packed payload behind it is
+//
+// Inputs       : conn - the connection
+//                req - the request answered
+//                msg - receives the reply as it goes on to the client
+// Outputs      : 0 if successful, -1 if the server is gone
+
+int read_reply(FS3ProxyConnection *conn, FS3ProxyRequest *req, FS3ProxyMessage *msg) {
+	FS3CmdBlk ret;
+	int i;
+
+	if ( req->compound && readBlock(conn->server, msg, &ret) != 0 ) return(-1);
+	for ( i = 0; i < req->count; i++ ) {
+		if ( readBlock(conn->server, msg, &ret) != 0 ||
+				readMore(conn->server, msg, FS3_REPLY_WIRE(req->cmds[i], ret)) != 0 ) return(-1);
+	}
+	return(0);
+}
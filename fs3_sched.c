@@ -0,0 +1,359 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_sched.c
+//  Description    : This is the implementation of the elevator I/O scheduler
+//                   for the FS3 filesystem interface. Queued sector operations
+//                   are served in C-LOOK order over the tracks, operations on
+//                   the same track share one TSEEK, and operations on one
+//                   track keep their submission order so a read always sees
+//                   an earlier write to the same sector. A drained queue is
+//                   handed to the network layer as one pipelined batch, and
+//                   when the server takes range opcodes, runs of consecutive
+//                   sectors on a track become a single RDRANGE/WRRANGE.
+//                   Partial writes (WRPART) keep their place in that order
+//                   like any other write. Copies (COPY) are ordered by the
+//                   track they write; the one they read is the caller's to
+//                   keep quiet while they are queued.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Includes
+#include <string.h>
+#include <stdlib.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_sched.h>
+#include <fs3_cache.h>
+#include <fs3_driver.h>
+#include <fs3_network.h>
+#include <fs3_common.h>
+
+//
+// Support Macros/Data
+
+typedef struct{
+    uint8_t op;              // FS3_OP_RDSECT, FS3_OP_WRSECT, FS3_OP_WRPART or FS3_OP_COPY
+    FS3TrackIndex track;
+    FS3SectorIndex sector;
+    char *dest;              // where a read lands, NULL if it only goes to the cache
+    int flags;               // FS3_SCHED_CACHE / FS3_SCHED_PREFETCH for reads
+    int done;
+    uint64_t deadline;       // dispatch tick by which the operation must be served
+    int length;              // bytes a WRPART writes, sectors a COPY writes
+    char data[FS3_WRPART_HEADER + FS3_SECTOR_SIZE]; // the sector, a WRPART's offset and bytes, or a COPY's source
+}SchedOp;
+
+SchedOp schedQueue[FS3_SCHED_QUEUE_DEPTH];
+int schedDepth;
+
+//dispatch plan of one drain: planned[] is the operations in dispatch order, each command covers
+//planned[runStart[n] .. runStart[n]+runLen[n]) (runLen 0 for a seek), stage holds range payloads
+SchedOp *planned[FS3_SCHED_QUEUE_DEPTH];
+FS3CmdBlk schedCmds[FS3_SCHED_QUEUE_DEPTH * 2], schedRets[FS3_SCHED_QUEUE_DEPTH * 2];
+void *schedBufs[FS3_SCHED_QUEUE_DEPTH * 2];
+int runStart[FS3_SCHED_QUEUE_DEPTH * 2], runLen[FS3_SCHED_QUEUE_DEPTH * 2];
+FS3Sector schedStage[FS3_SCHED_QUEUE_DEPTH];
+FS3TrackIndex headTrack = FS3_NO_TRACK;
+uint64_t schedTicks;
+long schedOps, schedSeeks, schedRuns, schedDepthSum, schedMaxDepth, schedReorder, schedDeadlines, schedRanges, schedPatches, schedCopies;
+
+//
+// Implementation
+
+//picks the next track to serve: an expired operation first, otherwise the next
+//track at or above the head, wrapping to the lowest track (C-LOOK)
+int nextTrack(void){
+    int i, oldest = -1, above = -1, lowest = -1;
+
+    for(i = 0; i < schedDepth; i++){
+        if(schedQueue[i].done) continue;
+        if(oldest == -1) oldest = i; //queue order is submission order
+        if(schedQueue[i].track >= headTrack || headTrack == FS3_NO_TRACK){
+            if(above == -1 || schedQueue[i].track < schedQueue[above].track) above = i;
+        }
+        if(lowest == -1 || schedQueue[i].track < schedQueue[lowest].track) lowest = i;
+    }
+
+    if(oldest == -1) return -1;
+    i = (above != -1) ? above : lowest;
+    if(schedQueue[oldest].deadline <= schedTicks && schedQueue[oldest].track != schedQueue[i].track){
+        schedDeadlines++;
+        return schedQueue[oldest].track;
+    }
+    return schedQueue[i].track;
+}
+
+//finishes a queued operation once its reply is in, data is where its sector arrived
+void completeOp(SchedOp *op, char *data){
+    if(op->op == FS3_OP_RDSECT){
+        if(op->dest != NULL && op->dest != data) memcpy(op->dest, data, FS3_SECTOR_SIZE);
+        if(op->flags & FS3_SCHED_PREFETCH) fs3_prefetch_cache(op->track, op->sector, data);
+        else if(op->flags & FS3_SCHED_CACHE) fs3_put_cache(op->track, op->sector, data);
+    }
+    schedOps++;
+}
+
+//turns the plan entry n into a command block and points it at its payload
+void buildCommand(int n){
+    SchedOp *first = planned[runStart[n]];
+    int k;
+
+    if(runLen[n] == 1){
+        //a lone read with a destination is received straight into it
+        schedCmds[n] = makeCmdBlock(first->op, first->sector, first->track, 0);
+        if(first->op == FS3_OP_WRPART || first->op == FS3_OP_COPY) schedCmds[n] |= (FS3CmdBlk)first->length;
+        schedBufs[n] = (first->op == FS3_OP_RDSECT && first->dest != NULL) ? first->dest : first->data;
+        return;
+    }
+
+    //a run goes out as one range, its sectors staged back to back
+    schedCmds[n] = makeCmdBlock(first->op == FS3_OP_RDSECT ? FS3_OP_RDRANGE : FS3_OP_WRRANGE,
+        first->sector, first->track, 0) | (FS3CmdBlk)runLen[n];
+    schedBufs[n] = schedStage[runStart[n]];
+    if(first->op == FS3_OP_WRSECT){
+        for(k = 0; k < runLen[n]; k++) memcpy(schedStage[runStart[n] + k], planned[runStart[n] + k]->data, FS3_SECTOR_SIZE);
+    }
+    schedRanges++;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_init
+// Description  : Reset the queue and forget the head position
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_sched_init(void) {
+    schedDepth = 0;
+    headTrack = FS3_NO_TRACK;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_submit
+// Description  : Queue a sector operation
+//
+// Inputs       : op - FS3_OP_RDSECT or FS3_OP_WRSECT
+//                trk - the track of the sector
+//                sct - the sector number
+//                buf - read destination (may be NULL) or data to write
+//                flags - completion flags for reads
+// Outputs      : 0 if queued, -1 if failure
+
+int fs3_sched_submit(uint8_t op, FS3TrackIndex trk, FS3SectorIndex sct, void *buf, int flags) {
+    SchedOp *entry;
+
+    if((op != FS3_OP_RDSECT && op != FS3_OP_WRSECT) || trk >= network_volume_tracks() || sct >= FS3_TRACK_SIZE){
+        logMessage(LOG_ERROR_LEVEL, "FS3 scheduler: bad operation %d on %d.%d (trk.sct)", op, trk, sct);
+        return(-1);
+    }
+    if(schedDepth == FS3_SCHED_QUEUE_DEPTH && fs3_sched_run() != 0) return(-1);
+
+    entry = &schedQueue[schedDepth++];
+    entry->op = op;
+    entry->track = trk;
+    entry->sector = sct;
+    entry->flags = flags;
+    entry->done = 0;
+    entry->deadline = schedTicks + FS3_SCHED_DEADLINE;
+    entry->length = 0;
+    if(op == FS3_OP_WRSECT){
+        memcpy(entry->data, buf, FS3_SECTOR_SIZE);
+        entry->dest = NULL;
+    } else{
+        entry->dest = (char *)buf;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_patch
+// Description  : Queue a partial write (FS3_OP_WRPART) of len bytes at
+//                offset of a sector. Reads of the sector queued before it
+//                still see the old bytes, so they no longer fill the cache.
+//
+// Inputs       : trk - the track of the sector
+//                sct - the sector number
+//                offset - first byte written in the sector
+//                buf - the bytes (copied)
+//                len - number of bytes (1 .. FS3_SECTOR_SIZE - offset)
+// Outputs      : 0 if queued, -1 if failure
+
+int fs3_sched_patch(FS3TrackIndex trk, FS3SectorIndex sct, int offset, void *buf, int len) {
+    SchedOp *entry;
+    int i;
+
+    if(trk >= network_volume_tracks() || sct >= FS3_TRACK_SIZE || offset < 0 || len < 1 || offset + len > FS3_SECTOR_SIZE){
+        logMessage(LOG_ERROR_LEVEL, "FS3 scheduler: bad partial write of %d bytes at %d on %d.%d (trk.sct)", len, offset, trk, sct);
+        return(-1);
+    }
+    if(schedDepth == FS3_SCHED_QUEUE_DEPTH && fs3_sched_run() != 0) return(-1);
+
+    for(i = 0; i < schedDepth; i++){
+        if(schedQueue[i].op == FS3_OP_RDSECT && schedQueue[i].track == trk && schedQueue[i].sector == sct) schedQueue[i].flags = 0;
+    }
+    entry = &schedQueue[schedDepth++];
+    entry->op = FS3_OP_WRPART;
+    entry->track = trk;
+    entry->sector = sct;
+    entry->flags = 0;
+    entry->done = 0;
+    entry->deadline = schedTicks + FS3_SCHED_DEADLINE;
+    entry->dest = NULL;
+    entry->length = len;
+    entry->data[0] = (char)(offset >> 8);
+    entry->data[1] = (char)(offset & 0xff);
+    memcpy(entry->data + FS3_WRPART_HEADER, buf, len);
+    schedPatches++;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_copy
+// Description  : Queue a copy (FS3_OP_COPY) of count sectors inside the
+//                server. It is served with the other operations on the
+//                track it writes; nothing orders it against operations on
+//                the track it reads.
+//
+// Inputs       : trk - the track written
+//                sct - the first sector written
+//                strk - the track read
+//                ssct - the first sector read
+//                count - number of sectors (1 .. FS3_MAX_RANGE)
+// Outputs      : 0 if queued, -1 if failure
+
+int fs3_sched_copy(FS3TrackIndex trk, FS3SectorIndex sct, FS3TrackIndex strk, FS3SectorIndex ssct, int count) {
+    SchedOp *entry;
+
+    if(trk >= network_volume_tracks() || strk >= network_volume_tracks() || count < 1 || count > FS3_MAX_RANGE ||
+            sct + count > FS3_TRACK_SIZE || ssct + count > FS3_TRACK_SIZE){
+        logMessage(LOG_ERROR_LEVEL, "FS3 scheduler: bad copy of %d sectors from %d.%d to %d.%d (trk.sct)", count, strk, ssct, trk, sct);
+        return(-1);
+    }
+    if(schedDepth == FS3_SCHED_QUEUE_DEPTH && fs3_sched_run() != 0) return(-1);
+
+    entry = &schedQueue[schedDepth++];
+    entry->op = FS3_OP_COPY;
+    entry->track = trk;
+    entry->sector = sct;
+    entry->flags = 0;
+    entry->done = 0;
+    entry->deadline = schedTicks + FS3_SCHED_DEADLINE;
+    entry->dest = NULL;
+    entry->length = count;
+    entry->data[0] = (char)(strk >> 8);
+    entry->data[1] = (char)(strk & 0xff);
+    entry->data[2] = (char)(ssct >> 8);
+    entry->data[3] = (char)(ssct & 0xff);
+    schedCopies++;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_pending
+// Description  : Number of operations waiting in the queue
+//
+// Inputs       : none
+// Outputs      : the queue depth
+
+int fs3_sched_pending(void) {
+    return(schedDepth);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_run
+// Description  : Dispatch every queued operation in C-LOOK track order
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_sched_run(void) {
+    int trk, i, k, n = 0, dispatched = 0;
+    SchedOp *op, *prev;
+
+    if(schedDepth == 0) return(0);
+
+    schedRuns++;
+    schedDepthSum += schedDepth;
+    if(schedDepth > schedMaxDepth) schedMaxDepth = schedDepth;
+
+    //lay out the whole dispatch order first so the network layer can keep it in flight
+    while((trk = nextTrack()) != -1){
+        if(trk != headTrack){
+            schedCmds[n] = makeCmdBlock(FS3_OP_TSEEK, 0, trk, 0);
+            schedBufs[n] = NULL;
+            runLen[n++] = 0;
+            headTrack = trk;
+            schedSeeks++;
+        }
+
+        //everything queued for this track goes out under the one seek, in submission order
+        for(i = 0; i < schedDepth; i++){
+            op = &schedQueue[i];
+            if(op->done || op->track != trk) continue;
+
+            //the next sector of the same kind extends the previous run
+            prev = (n > 0 && runLen[n-1] > 0) ? planned[runStart[n-1] + runLen[n-1] - 1] : NULL;
+            if(fs3_network_ranges && prev != NULL && prev->track == trk && prev->op == op->op && (op->op == FS3_OP_RDSECT || op->op == FS3_OP_WRSECT) &&
+                    op->sector == prev->sector + 1 && runLen[n-1] < FS3_MAX_RANGE){
+                runLen[n-1]++;
+            } else{
+                runStart[n] = dispatched;
+                runLen[n++] = 1;
+            }
+            planned[dispatched] = op;
+            op->done = 1;
+            schedTicks++;
+            schedReorder += abs(dispatched - i);
+            dispatched++;
+        }
+    }
+    for(i = 0; i < n; i++){
+        if(runLen[i] > 0) buildCommand(i);
+    }
+
+    schedDepth = 0;
+    if(sectorBatch(schedCmds, schedRets, schedBufs, n) != 0){
+        headTrack = FS3_NO_TRACK; //the head position is unknown after a failed batch
+        return(-1);
+    }
+    for(i = 0; i < n; i++){
+        if(runLen[i] == 1) completeOp(planned[runStart[i]], schedBufs[i]);
+        else for(k = 0; k < runLen[i]; k++) completeOp(planned[runStart[i] + k], schedStage[runStart[i] + k]);
+    }
+
+    logMessage(LOG_INFO_LEVEL, "FS3 scheduler: dispatched %d operations in %d commands, head at track %d", dispatched, n, headTrack);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_sched_metrics
+// Description  : Log the metrics for the scheduler
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_sched_metrics(void) {
+    logMessage(LOG_OUTPUT_LEVEL, "Sched operations [     %ld]", schedOps);
+    logMessage(LOG_OUTPUT_LEVEL, "Sched seeks      [     %ld]", schedSeeks);
+    logMessage(LOG_OUTPUT_LEVEL, "Seeks saved      [     %ld]", schedOps - schedSeeks);
+    logMessage(LOG_OUTPUT_LEVEL, "Max queue depth  [     %ld]", schedMaxDepth);
+    logMessage(LOG_OUTPUT_LEVEL, "Avg queue depth  [     %.2f]", schedRuns ? schedDepthSum / (float)schedRuns : 0.0);
+    logMessage(LOG_OUTPUT_LEVEL, "Avg reorder dist [     %.2f]", schedOps ? schedReorder / (float)schedOps : 0.0);
+    logMessage(LOG_OUTPUT_LEVEL, "Deadline picks   [     %ld]", schedDeadlines);
+    logMessage(LOG_OUTPUT_LEVEL, "Range commands   [     %ld]", schedRanges);
+    logMessage(LOG_OUTPUT_LEVEL, "Partial writes   [     %ld]", schedPatches);
+    logMessage(LOG_OUTPUT_LEVEL, "Server copies    [     %ld]", schedCopies);
+    return(0);
+}
@@ -0,0 +1,49 @@
+#ifndef FS3_SCHED_INCLUDED
+#define FS3_SCHED_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_sched.h
+//  Description    : This is the interface for the elevator I/O scheduler that
+//                   orders pending FS3 sector operations by track.
+//
+//  Author         :
+//  Last Modified  :
+//
+
+// Include
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_SCHED_QUEUE_DEPTH 1024 // Pending operations before the queue drains itself (a track)
+#define FS3_SCHED_DEADLINE 64      // Operations dispatched before a queued one must be served
+
+// Completion flags for queued reads
+#define FS3_SCHED_CACHE    0x1     // Put the sector in the cache once read
+#define FS3_SCHED_PREFETCH 0x2     // Mark the cached sector as readahead
+
+//
+// Scheduler Functions
+
+int fs3_sched_init(void);
+    // Reset the queue and forget the head position (called at mount)
+
+int fs3_sched_submit(uint8_t op, FS3TrackIndex trk, FS3SectorIndex sct, void *buf, int flags);
+    // Queue a RDSECT (buf receives the data, may be NULL) or WRSECT (buf is copied)
+
+int fs3_sched_patch(FS3TrackIndex trk, FS3SectorIndex sct, int offset, void *buf, int len);
+    // Queue a WRPART of len bytes at offset of a sector (buf is copied)
+
+int fs3_sched_copy(FS3TrackIndex trk, FS3SectorIndex sct, FS3TrackIndex strk, FS3SectorIndex ssct, int count);
+    // Queue a COPY of count sectors from strk.ssct to trk.sct (keep strk.ssct unwritten until it runs)
+
+int fs3_sched_pending(void);
+    // Number of operations waiting in the queue
+
+int fs3_sched_run(void);
+    // Dispatch every queued operation in C-LOOK track order
+
+int fs3_log_sched_metrics(void);
+    // Log the metrics for the scheduler
+
+#endif
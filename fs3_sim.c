@@ -16,6 +16,9 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -25,6 +28,9 @@
 #include <fs3_controller.h>
 #include <fs3_common.h>
 #include <fs3_cache.h>
+#include <fs3_dedup.h>
+#include <fs3_sched.h>
+#include <fs3_journal.h>
 #include <fs3_network.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
@@ -32,21 +38,47 @@
 // Defines
 #define FS3_WORKLOAD_DIR "workload"
 #define FS3_SIM_MAX_OPEN_FILES 256
-#define FS3_ARGUMENTS "hvc:l:i:p:"
+#define FS3_SIM_CALLS 3             // Calls the workload times: fs3_read, fs3_write, fs3_seek
+#define FS3_SIM_HIST_BUCKETS (36 * 8) // Call latency buckets, eight to an octave from 1 nsec
+#define FS3_ARGUMENTS "hvdbrtzMsc:a:w:n:k:R:H:P:J:m:u:e:j:l:i:p:"
 #define USAGE \
-	"USAGE: fs3_sim [-h] [-v] [-c <cache size>] [-l <logfile>] <workload-file>\n" \
+	"USAGE: fs3_sim [-h] [-v] [-d] [-b] [-r] [-z] [-s] [-M] [-c <cache size>] [-a <sectors>] [-w <window>] [-n <connections>] [-k <sectors>] [-R <mirrors>] [-H <percentile>] [-P <parity>] [-J <writes>] [-t] [-u <path>] [-e <image>] [-m <ops>] [-j <results>] [-l <logfile>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
+	"    -d - deduplicate identical sectors on the write path\n" \
+	"    -b - send each batch of sector operations as one compound frame\n" \
+	"    -r - move runs of consecutive sectors with the range opcodes\n" \
+	"    -z - ask the server to compress sector payloads on the wire\n" \
+	"    -s - ask the server to take partial sector writes (only the changed bytes go out)\n" \
+	"    -M - load the files of a disk image built by fs3_mkimage at mount (one server only)\n" \
 	"    -c - set the cache size (in number of sectors)\n" \
+	"    -a - set the largest readahead window (in number of sectors, 0 disables)\n" \
+	"    -w - requests kept in flight to the server (1 waits for every reply)\n" \
+	"    -n - connections to the server, batches are spread over all of them\n" \
+	"    -k - sectors per stripe unit when striping over several servers (a power of two)\n" \
+	"    -R - servers in a row that mirror each other (writes go to all, reads to the fastest)\n" \
+	"    -H - hedge a mirrored read slower than this percentile of recent reads (0 never, 95 by default)\n" \
+	"    -P - servers of every stripe row that hold parity instead of data (Reed-Solomon, XOR for 1)\n" \
+	"    -J - journal writes, committing them as a group every <writes> writes (and at SYNC)\n" \
+	"    -t - always use TCP, even to a server on this host\n" \
+	"    -u - Unix domain socket of a server on this host\n" \
+	"    -e - run the controller in-process on the disk image <image> (\"\" for memory), no server\n" \
+	"    -m - measure the latency of <ops> sector reads and writes instead of running a workload\n" \
+	"    -j - write the results of the run (throughput, call latencies, requests, cache) as JSON to <results>\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
-    "    -i - IP address of server to connect to.\n" \
+    "    -i - IP address of server to connect to, \"ip:port,...\" or repeated to stripe over several.\n" \
     "    -p - port number of server to connect to.\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
 
+// The calls the workload times
+#define FS3_SIM_READ 0
+#define FS3_SIM_WRITE 1
+#define FS3_SIM_SEEK 2
+
 // This is the file table
 typedef struct {
 	char     *filename;  // This is the filename for the test file
@@ -57,16 +89,76 @@ typedef struct {
 // Global Data
 int verbose;
 uint16_t fs3CacheSize = FS3_DEFAULT_CACHE_SIZE; 
+char *fs3AdviceNames[FS3_ADV_MAXVAL] = { "NORMAL", "SEQUENTIAL", "RANDOM", "WILLNEED", "DONTNEED" };
+char *fs3CallNames[FS3_SIM_CALLS] = { "fs3_read", "fs3_write", "fs3_seek" };
+char *fs3OpNames[FS3_OP_MAXVAL] = { "mount", "seek", "read", "write", "umount", "compound", "rdrange", "wrrange", "wrpart", "copy" };
+char *fs3ResultsFile = NULL;          // -j, where the results of the run go
+char fs3SimOptions[1024];             // the options the run was started with, for the results
+long simHist[FS3_SIM_CALLS][FS3_SIM_HIST_BUCKETS]; // call latencies, bucket b below simBound(b) nanoseconds
+long simCalls[FS3_SIM_CALLS];
+uint64_t simLongest[FS3_SIM_CALLS];   // nanoseconds
+long long simBytes[FS3_SIM_CALLS];    // bytes read / written by the workload
 
 //
 // Functional Prototypes
 
 int simulate_FS3( char *wload );              // control loop of the FS3 simulation
 int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+int latency_FS3( int ops );                   // Time single sector operations against the server
+int log_call_metrics( void );                 // Log the latency percentiles of the timed calls
+int write_results( char *wload, double elapsed, double busy ); // Write the results of the run as JSON
 
 //
 // Functions
 
+//current monotonic time in nanoseconds
+uint64_t simNanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//upper end of latency bucket b in nanoseconds, eight buckets to an octave
+uint64_t simBound(int b) {
+	return (((uint64_t)1 << (b / 8)) * (8 + b % 8 + 1)) / 8;
+}
+
+//counts a call that started at start (simNanos) and moved bytes
+void simCount(int call, uint64_t start, long bytes) {
+	uint64_t ns = simNanos() - start;
+	int b = 0;
+
+	while (b < FS3_SIM_HIST_BUCKETS - 1 && ns >= simBound(b)) b++;
+	simHist[call][b]++;
+	simCalls[call]++;
+	simBytes[call] += bytes;
+	if (ns > simLongest[call]) simLongest[call] = ns;
+}
+
+//the latency in microseconds below which permille thousandths of the calls fall (at most the longest)
+double simPercentile(int call, int permille) {
+	long seen = 0;
+	int b;
+
+	if (simCalls[call] == 0) return(0.0);
+	for (b = 0; b < FS3_SIM_HIST_BUCKETS - 1; b++) {
+		seen += simHist[call][b];
+		if (seen * 1000 >= simCalls[call] * permille) break;
+	}
+	return(((simBound(b) < simLongest[call]) ? simBound(b) : simLongest[call]) / 1000.0);
+}
+
+//writes str as a JSON string
+void jsonString(FILE *out, char *str) {
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20) fprintf(out, "\\u%04x", *str);
+		else fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : main
@@ -79,7 +171,7 @@ int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesyst
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
+	int ch, verbose = 0, log_initialized = 0, latency = 0;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, FS3_ARGUMENTS)) != -1) {
@@ -93,6 +185,30 @@ int main( int argc, char *argv[] ) {
 			verbose = 1;
 			break;
 
+		case 'd': // Deduplicate sectors on the write path
+			fs3_dedup_enabled = 1;
+			break;
+
+		case 'b': // Batch sector operations into compound frames
+			fs3_network_compound = 1;
+			break;
+
+		case 'r': // Use the range opcodes for consecutive sectors
+			fs3_network_ranges = 1;
+			break;
+
+		case 'z': // Negotiate packed (compressed) payloads
+			fs3_network_compress = 1;
+			break;
+
+		case 's': // Negotiate partial sector writes
+			fs3_network_patch = 1;
+			break;
+
+		case 'M': // Load the file table of a preloaded disk image
+			fs3_load_image = 1;
+			break;
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
@@ -105,12 +221,93 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
-		case 'i': // Get the IP address
-			if (inet_addr(optarg) == INADDR_NONE) {
-				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", argv[optind] );
+		case 'a': // Set the readahead window
+			if ( sscanf(optarg, "%d", &fs3_readahead_max) != 1 ) {
+				logMessage(LOG_ERROR_LEVEL, "Failed parsing readahead window [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'w': // Set the pipeline window
+			if ( (sscanf(optarg, "%d", &fs3_network_window) != 1) ||
+					(fs3_network_window < 1) || (fs3_network_window > FS3_MAX_WINDOW) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad pipeline window [%s], must be 1-%d", optarg, FS3_MAX_WINDOW);
+				return(-1);
+			}
+			break;
+
+		case 'n': // Set the connection pool size
+			if ( (sscanf(optarg, "%d", &fs3_network_connections) != 1) ||
+					(fs3_network_connections < 1) || (fs3_network_connections > FS3_MAX_CONNECTIONS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad connection count [%s], must be 1-%d", optarg, FS3_MAX_CONNECTIONS);
+				return(-1);
+			}
+			break;
+
+		case 'k': // Set the stripe unit
+			if ( (sscanf(optarg, "%d", &fs3_network_stripe) != 1) || (fs3_network_stripe < 1) ||
+					(fs3_network_stripe > FS3_TRACK_SIZE) || (fs3_network_stripe & (fs3_network_stripe - 1)) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad stripe unit [%s], must be a power of two up to %d", optarg, FS3_TRACK_SIZE);
+				return(-1);
+			}
+			break;
+
+		case 'R': // Set the mirror set size
+			if ( (sscanf(optarg, "%d", &fs3_network_mirrors) != 1) || (fs3_network_mirrors < 1) || (fs3_network_mirrors > FS3_MAX_SERVERS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad mirror count [%s], must be 1-%d", optarg, FS3_MAX_SERVERS);
+				return(-1);
+			}
+			break;
+
+		case 'H': // Set the hedging percentile
+			if ( (sscanf(optarg, "%d", &fs3_network_hedge) != 1) || (fs3_network_hedge < 0) || (fs3_network_hedge > 100) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad hedging percentile [%s], must be 0-100", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'P': // Set the parity servers per row
+			if ( (sscanf(optarg, "%d", &fs3_network_parity) != 1) || (fs3_network_parity < 1) || (fs3_network_parity >= FS3_MAX_SERVERS) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad parity count [%s], must be 1-%d", optarg, FS3_MAX_SERVERS - 1);
+				return(-1);
+			}
+			break;
+
+		case 'J': // Journal writes with group commits
+			if ( (sscanf(optarg, "%d", &fs3_journal_group) != 1) || (fs3_journal_group < 1) ||
+					(fs3_journal_group > FS3_JOURNAL_MAX_GROUP) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad group commit size [%s], must be 1-%d", optarg, FS3_JOURNAL_MAX_GROUP);
+				return(-1);
+			}
+			break;
+
+		case 't': // Stay on TCP for a local server
+			fs3_network_local = 0;
+			break;
+
+		case 'u': // Set the Unix domain socket of a local server
+			fs3_network_unix_path = optarg;
+			break;
+
+		case 'e': // Run the controller in-process
+			fs3_network_loopback = optarg;
+			break;
+
+		case 'j': // Write the results as JSON
+			fs3ResultsFile = optarg;
+			break;
+
+		case 'm': // Run the latency microbenchmark
+			if ( (sscanf(optarg, "%d", &latency) != 1) || (latency < 1) ) {
+				logMessage(LOG_ERROR_LEVEL, "Bad operation count [%s]", optarg);
+				return(-1);
+			}
+			break;
+
+		case 'i': // Add the server(s) to stripe over
+			if ( network_add_servers(optarg) != 0 ) {
 				return(-1);
 			}
-			fs3_network_address = (unsigned char *)strdup(optarg);
 			break;
 
 		case 'p': // Set the network port number
@@ -126,6 +323,12 @@ int main( int argc, char *argv[] ) {
 		}
 	}
 
+	// The results name the options the run was started with
+	for ( ch = 1; ch < optind; ch++ ) {
+		snprintf(fs3SimOptions + strlen(fs3SimOptions), sizeof(fs3SimOptions) - strlen(fs3SimOptions),
+			"%s%s", (ch > 1) ? " " : "", argv[ch]);
+	}
+
 	// Setup the log as needed
 	if ( ! log_initialized ) {
 		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
@@ -138,6 +341,18 @@ int main( int argc, char *argv[] ) {
 		enableLogLevels(FS3ControllerLLevel | FS3DriverLLevel | FS3SimulatorLLevel);
 	}
 
+	// A preloaded image is laid out for one disk, not striped over several
+	if ( fs3_load_image && (fs3_network_servers > 1) ) {
+		fprintf( stderr, "-M loads an image built for one server, it cannot be used with %d servers, aborting.\n",
+				fs3_network_servers );
+		return( -1 );
+	}
+
+	// The microbenchmark needs no workload
+	if ( latency > 0 ) {
+		return( latency_FS3(latency) );
+	}
+
 	// The filename should be the next option
 	if ( optind >= argc ) {
 		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
@@ -167,11 +382,12 @@ int main( int argc, char *argv[] ) {
 int simulate_FS3( char *wload ) {
 
 	// Local variables
-	char line[1024], fname[128], command[128], text[1025], *sep, *rbuf;
+	char line[1024], fname[128], command[128], srcname[128], text[1025], *sep, *rbuf;
 	FILE *fhandle = NULL;
 	int32_t err=0, len, off, fields, linecount;
 	FS3SimulationTable ftable[FS3_SIM_MAX_OPEN_FILES];
 	int idx, i, millions;
+	uint64_t begin = simNanos(), start, busy;
 
 	// Setup the file table
 	memset(ftable, 0x0, sizeof(FS3SimulationTable)*FS3_SIM_MAX_OPEN_FILES);
@@ -184,13 +400,15 @@ int simulate_FS3( char *wload ) {
 		return( -1 );
 	}
 
-	// Startup the interface
-	if ( (fs3_mount_disk() == -1) || (fs3_init_cache(fs3CacheSize) == -1) ){
+	// Startup the interface (the dedup index first, a preloaded image counts its sectors at mount)
+	if ( (fs3_dedup_enabled && (fs3_init_dedup() == -1)) || (fs3_mount_disk() == -1) ||
+			(fs3_init_cache(fs3CacheSize) == -1) ){
 		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed initialization.");
 		fclose( fhandle );
 		return( -1 );
 	}
 	logMessage(FS3SimulatorLLevel, "FS3 simulator initialization complete.");
+	busy = simNanos();
 
 	// While file not done
 	while (!feof(fhandle)) {
@@ -260,11 +478,13 @@ int simulate_FS3( char *wload ) {
 				logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
 
 				// First perform the seek
+				start = simNanos();
 				if (fs3_seek(ftable[idx].fhandle, off)) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
 					return(-1);
 				}
+				simCount(FS3_SIM_SEEK, start, 0);
 
 				// Now see if we need more data to fill, terminate the lines
 				CMPSC311_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
@@ -278,11 +498,13 @@ int simulate_FS3( char *wload ) {
 				}
 
 				// Now perform the write
+				start = simNanos();
 				if (fs3_write(ftable[idx].fhandle, text, len) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
 					return(-1);
 				}
+				simCount(FS3_SIM_WRITE, start, len);
 
 
 			} else if (strncmp(command, "WRITE", 5) == 0) {
@@ -302,11 +524,13 @@ int simulate_FS3( char *wload ) {
 				logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes to file [%s]", len, fname);
 
 				// Now perform the write
+				start = simNanos();
 				if (fs3_write(ftable[idx].fhandle, text, len) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
 					return(-1);
 				}
+				simCount(FS3_SIM_WRITE, start, len);
 
 
 			} else if (strncmp(command, "SEEK", 4) == 0) {
@@ -315,11 +539,13 @@ int simulate_FS3( char *wload ) {
 				logMessage(FS3SimulatorLLevel, "FS3_SIM : Seeking to position %d in file [%s]", off, fname);
 
 				// Now perform the seek
+				start = simNanos();
 				if (fs3_seek(ftable[idx].fhandle, off) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
 					return(-1);
 				}
+				simCount(FS3_SIM_SEEK, start, 0);
 
 			} else if (strncmp(command, "READ", 4) == 0) {
 
@@ -328,14 +554,72 @@ int simulate_FS3( char *wload ) {
 
 				// Now perform the read
 				rbuf = malloc(len);
+				start = simNanos();
 				if (fs3_read(ftable[idx].fhandle, rbuf, len) != len) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
 					return(-1);
 				}
+				simCount(FS3_SIM_READ, start, len);
 				free(rbuf);
 				rbuf = NULL;
 
+			} else if (strncmp(command, "COPY", 4) == 0) {
+
+				// The file copied from follows the colon and must already be open, e.g. "copy COPY 0 0 :file"
+				if (sscanf(sep+1, "%127s", srcname) != 1) {
+					srcname[0] = 0x0;
+				}
+				for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
+					if ((ftable[i].filename != NULL) && (strcmp(ftable[i].filename, srcname) == 0)) {
+						break;
+					}
+				}
+				CMPSC311_ASSERT1(i<FS3_SIM_MAX_OPEN_FILES, "FS3_SIM : Failed, copy from unknown file [%s]", srcname);
+
+				// Log the command executed
+				logMessage(FS3SimulatorLLevel, "FS3_SIM : Copying file [%s] to file [%s]", srcname, fname);
+
+				// Now perform the copy
+				if (fs3_copy(ftable[i].fhandle, ftable[idx].fhandle) == -1) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Copy of file [%s] to file [%s] failed, aborting simulation.", srcname, fname);
+					return(-1);
+				}
+
+			} else if (strncmp(command, "ADVISE", 6) == 0) {
+
+				// The hint name follows the colon, e.g. "file ADVISE 4096 0 :WILLNEED"
+				for (i=0; i<FS3_ADV_MAXVAL; i++) {
+					if (strncmp(sep+1, fs3AdviceNames[i], strlen(fs3AdviceNames[i])) == 0) {
+						break;
+					}
+				}
+				CMPSC311_ASSERT1(i<FS3_ADV_MAXVAL, "FS3_SIM : Failed, unknown advice [%s]", sep+1);
+
+				// Log the command executed
+				logMessage(FS3SimulatorLLevel, "FS3_SIM : Advising %s for %d bytes at position %d in file [%s]",
+						fs3AdviceNames[i], len, off, fname);
+
+				// Now pass on the hint
+				if (fs3_advise(ftable[idx].fhandle, off, len, i) != 0) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Advise on file [%s] failed, aborting simulation.", fname);
+					return(-1);
+				}
+
+			} else if (strncmp(command, "SYNC", 4) == 0) {
+
+				// Log the command executed
+				logMessage(FS3SimulatorLLevel, "FS3_SIM : Syncing after file [%s]", fname);
+
+				// Every write so far must be durable before the workload goes on
+				if (fs3_sync() != 0) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Sync after file [%s] failed, aborting simulation.", fname);
+					return(-1);
+				}
+
 			} else {
 
 				// Bomb out, don't understand the command
@@ -352,6 +636,9 @@ int simulate_FS3( char *wload ) {
 		}
 	}
 
+	// The workload is done, the validation reads are not timed
+	busy = simNanos() - busy;
+
 	// Now walk the the table looking for the file
 	for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
 		if (ftable[i].filename != NULL) {
@@ -370,16 +657,24 @@ int simulate_FS3( char *wload ) {
 	}
 
 	// Log cache metrics, shut down the interface
-	if ( fs3_log_cache_metrics() == -1 ) {
+	if ( (log_call_metrics() == -1) || (fs3_log_cache_metrics() == -1) || (fs3_log_sched_metrics() == -1) ||
+			(network_log_metrics() == -1) ||
+			(fs3_dedup_enabled && (fs3_log_dedup_metrics() == -1)) ||
+			(fs3_journal_group && (fs3_log_journal_metrics() == -1)) ) {
 		logMessage(LOG_ERROR_LEVEL, "FS3 simulation failed, controller metrics failed");
 		return(-1);
 	}
-	if ((fs3_unmount_disk() == -1) || (fs3_close_cache() == -1)) {
+	if ((fs3_unmount_disk() == -1) || (fs3_close_cache() == -1) ||
+			(fs3_dedup_enabled && (fs3_close_dedup() == -1))) {
 		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed shutdown.");
 		fclose( fhandle );
 		return( -1 );
 	}
 	logMessage(FS3SimulatorLLevel, "FS3 simulator shutdown complete.");
+	if ( (fs3ResultsFile != NULL) && (write_results(wload, (simNanos() - begin) / 1e9, busy / 1e9) != 0) ) {
+		fclose( fhandle );
+		return( -1 );
+	}
 	logMessage(LOG_OUTPUT_LEVEL, "FS3 simulation: all tests successful!!!.");
 
 	// Close the workload file, successfully
@@ -387,6 +682,136 @@ int simulate_FS3( char *wload ) {
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : latency_FS3
+// Description  : Time single sector reads and writes, each waiting for its
+//                reply, to show what one operation costs on the transport
+//
+// Inputs       : ops - number of reads (and of writes) to time
+// Outputs      : 0 if successful test, -1 if failure
+
+int latency_FS3( int ops ) {
+
+	// Local variables
+	char sector[FS3_SECTOR_SIZE];
+	struct timeval start, reads, writes;
+	double rdus, wrus;
+	int i;
+
+	memset(sector, 0x5a, FS3_SECTOR_SIZE);
+	if ( (sectorSyscall(FS3_OP_MOUNT, 0, 0, NULL) != 0) || (sectorSyscall(FS3_OP_TSEEK, 0, 0, NULL) != 0) ||
+			(sectorSyscall(FS3_OP_WRSECT, 0, 0, sector) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 latency: could not set up the disk" );
+		return( -1 );
+	}
+
+	// Every operation is one full round trip to the server
+	gettimeofday(&start, NULL);
+	for ( i = 0; i < ops; i++ ) {
+		if ( sectorSyscall(FS3_OP_RDSECT, 0, i % FS3_TRACK_SIZE, sector) != 0 ) return( -1 );
+	}
+	gettimeofday(&reads, NULL);
+	for ( i = 0; i < ops; i++ ) {
+		if ( sectorSyscall(FS3_OP_WRSECT, 0, i % FS3_TRACK_SIZE, sector) != 0 ) return( -1 );
+	}
+	gettimeofday(&writes, NULL);
+	sectorSyscall(FS3_OP_UMOUNT, 0, 0, NULL);
+
+	rdus = ((reads.tv_sec - start.tv_sec) * 1000000.0 + (reads.tv_usec - start.tv_usec)) / ops;
+	wrus = ((writes.tv_sec - reads.tv_sec) * 1000000.0 + (writes.tv_usec - reads.tv_usec)) / ops;
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 latency over %s: read %.2f usec/op, write %.2f usec/op (%d each)",
+		network_transport(), rdus, wrus, ops );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_call_metrics
+// Description  : Log the latency percentiles of the fs3_read, fs3_write and
+//                fs3_seek calls of the workload
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int log_call_metrics( void ) {
+	char *labels[FS3_SIM_CALLS] = { "Read latency", "Write latency", "Seek latency" };
+	int c;
+
+	for ( c = 0; c < FS3_SIM_CALLS; c++ ) {
+		logMessage( LOG_OUTPUT_LEVEL, "%-16s [     %ld calls, p50 %.2f p90 %.2f p99 %.2f p99.9 %.2f max %.2f usec]", labels[c],
+			simCalls[c], simPercentile(c, 500), simPercentile(c, 900), simPercentile(c, 990), simPercentile(c, 999),
+			simLongest[c] / 1000.0 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_results
+// Description  : Write the results of the run to fs3ResultsFile as a JSON
+//                object, one value to a line so scripts can pick them out:
+//                throughput, call latency percentiles (usec), the requests
+//                the driver sent by opcode, the cache counters and the peak
+//                resident set size of the client
+//
+// Inputs       : wload - the workload file
+//                elapsed - seconds the whole run took (mount to unmount)
+//                busy - seconds the workload's calls took, validation aside
+// Outputs      : 0 if successful, -1 if failure
+
+int write_results( char *wload, double elapsed, double busy ) {
+
+	// Local variables
+	FS3CacheStats stats;
+	struct rusage usage;
+	long calls = simCalls[FS3_SIM_READ] + simCalls[FS3_SIM_WRITE] + simCalls[FS3_SIM_SEEK];
+	long long bytes = simBytes[FS3_SIM_READ] + simBytes[FS3_SIM_WRITE];
+	FILE *out;
+	int c, op;
+
+	if ( (out = fopen(fs3ResultsFile, "w")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 simulator cannot write the results to [%s], error: %s", fs3ResultsFile, strerror(errno) );
+		return( -1 );
+	}
+	fs3_cache_stats(&stats);
+	getrusage(RUSAGE_SELF, &usage);
+	if ( busy <= 0 ) busy = 1e-9;
+
+	fprintf( out, "{\n  \"workload\": " );
+	jsonString( out, wload );
+	fprintf( out, ",\n  \"options\": " );
+	jsonString( out, fs3SimOptions );
+	fprintf( out, ",\n  \"transport\": \"%s\",\n", network_transport() );
+	fprintf( out, "  \"elapsed_s\": %.6f,\n  \"workload_s\": %.6f,\n", elapsed, busy );
+	fprintf( out, "  \"calls\": %ld,\n  \"bytes_read\": %lld,\n  \"bytes_written\": %lld,\n", calls,
+		simBytes[FS3_SIM_READ], simBytes[FS3_SIM_WRITE] );
+	fprintf( out, "  \"calls_per_s\": %.1f,\n  \"throughput_mb_s\": %.3f,\n", calls / busy, bytes / busy / 1e6 );
+	fprintf( out, "  \"latency_us\": {\n" );
+	for ( c = 0; c < FS3_SIM_CALLS; c++ ) {
+		fprintf( out, "    \"%s\": {\n      \"calls\": %ld,\n      \"p50\": %.3f,\n      \"p90\": %.3f,\n"
+			"      \"p99\": %.3f,\n      \"p999\": %.3f,\n      \"max\": %.3f\n    }%s\n", fs3CallNames[c], simCalls[c],
+			simPercentile(c, 500), simPercentile(c, 900), simPercentile(c, 990), simPercentile(c, 999),
+			simLongest[c] / 1000.0, (c < FS3_SIM_CALLS - 1) ? "," : "" );
+	}
+	fprintf( out, "  },\n  \"round_trips\": %ld,\n  \"requests\": {\n", network_round_trips() );
+	for ( op = 0; op < FS3_OP_MAXVAL; op++ ) {
+		fprintf( out, "    \"%s\": %ld%s\n", fs3OpNames[op], network_requests(op), (op < FS3_OP_MAXVAL - 1) ? "," : "" );
+	}
+	fprintf( out, "  },\n  \"cache\": {\n    \"lines\": %d,\n    \"inserts\": %d,\n    \"gets\": %d,\n"
+		"    \"hits\": %d,\n    \"misses\": %d,\n    \"hit_ratio\": %.4f,\n    \"readahead_fills\": %d,\n"
+		"    \"readahead_hits\": %d,\n    \"readahead_wasted\": %d\n  },\n", fs3CacheSize, stats.inserts, stats.gets,
+		stats.hits, stats.misses, stats.gets ? (double)stats.hits / stats.gets : 0.0, stats.raFills, stats.raHits, stats.raWasted );
+	fprintf( out, "  \"peak_rss_kb\": %ld\n}\n", usage.ru_maxrss );
+
+	if ( fclose(out) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 simulator cannot write the results to [%s], error: %s", fs3ResultsFile, strerror(errno) );
+		return( -1 );
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 simulation results written to [%s]", fs3ResultsFile );
+	return( 0 );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : validate_file